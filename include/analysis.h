@@ -0,0 +1,143 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "ast.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * Names a piece of code reads, writes and calls without declaring them itself.
+ * Because Ankr is dynamically scoped, these are the names that can observe or
+ * change variables belonging to the surrounding code.
+ */
+struct Effects {
+  std::set<std::string> reads;  ///< Free variables read.
+  std::set<std::string> writes; ///< Free variables assigned.
+  std::set<std::string> calls;  ///< Functions called, including builtins.
+  bool unknown_calls = false;   ///< Set when a called function has no definition anywhere.
+};
+
+/**
+ * Description of a for-loop shaped like `for (var i = A; i < N; i++)` whose
+ * counter and bound are never changed by its body, so the interpreter can
+ * drive it with a native integer instead of evaluating the condition and
+ * update nodes on every iteration.
+ */
+struct CountedLoop {
+  bool eligible = false;      ///< Whether the loop has the required shape.
+  std::string variable;       ///< Name of the induction variable.
+  TokenType comparison = LESS_THAN; ///< Comparison with the counter on the left-hand side.
+  Node *bound = nullptr;      ///< Expression on the other side of the comparison.
+  int step = 0;               ///< Amount added to the counter after each iteration.
+  bool body_reads = false;    ///< Whether the body, or anything it calls, reads the counter.
+};
+
+/**
+ * Static analysis over a parsed program. Collects every function definition so
+ * that the effects of a call can be followed into the callee.
+ */
+class Analyzer {
+private:
+  std::map<std::string, std::vector<FunctionNode *>> functions; ///< Function definitions by name.
+  std::map<std::string, Effects> summaries; ///< Cached transitive effects of calling a function.
+  std::map<std::string, ValueType> annotations; ///< Declared type of each annotated name, TYPE_ANY if they disagree.
+
+  /**
+   * Records every function definition under a node, including nested ones,
+   * and the types variables and parameters are declared with.
+   * @param node Node to search.
+   */
+  void collect_functions(Node *node);
+
+  /**
+   * Records the type a variable or parameter is declared with.
+   * @param variable The declared variable; nothing is recorded without an annotation.
+   */
+  void collect_annotation(VariableNode *variable);
+
+  /**
+   * Walks a node and records its free reads, writes and calls. Declarations are
+   * tracked on a stack mirroring the scopes the interpreter would push.
+   * @param node Node to walk.
+   * @param scopes Names declared in each enclosing scope.
+   * @param effects Where the effects are accumulated.
+   */
+  void walk(Node *node, std::vector<std::set<std::string>> *scopes, Effects *effects);
+
+  /**
+   * Computes the effects of calling a function, including everything it calls.
+   * @param identifier Name of the function.
+   * @return Effects of the call.
+   */
+  const Effects &summary(const std::string &identifier);
+
+public:
+  /**
+   * Constructs an analyzer for a program.
+   * @param root Root of the program's AST.
+   */
+  Analyzer(BlockNode *root);
+
+  /**
+   * Computes the free effects of a node, following calls into their callees.
+   * @param node Node to analyze.
+   * @return Effects of executing the node.
+   */
+  Effects effects(Node *node);
+
+  /**
+   * Computes the effects of calling a user-defined function, including
+   * everything it calls, but not of evaluating the arguments.
+   * @param identifier Name of the function.
+   * @return Effects of the call.
+   */
+  const Effects &call_effects(const std::string &identifier);
+
+  /**
+   * Checks whether a for-loop can run as a counted loop.
+   * @param fn The for-loop.
+   * @return Description of the loop; `eligible` is false if it does not qualify.
+   */
+  CountedLoop counted_loop(ForNode *fn);
+
+  /**
+   * Checks a function declared pure: it may only use its parameters and its
+   * own variables, and may only call functions that are pure themselves.
+   * @param def The function definition.
+   * @return Why the function is not pure, or an empty string if it is.
+   */
+  std::string impurity(FunctionNode *def);
+
+  /**
+   * Retrieves every function definition in the program.
+   * @return Function definitions by name.
+   */
+  const std::map<std::string, std::vector<FunctionNode *>> &definitions() const;
+
+  /**
+   * Finds the type a name is declared with anywhere in the program.
+   * @param identifier Name of a variable or parameter.
+   * @return The type if every annotation of the name agrees, TYPE_ANY if they
+   * disagree, or TYPE_NONE if the name is never annotated.
+   */
+  ValueType annotation(const std::string &identifier) const;
+
+  /**
+   * Checks whether a function is provided by the interpreter itself.
+   * @param identifier Name of the function.
+   * @return true if the function is a builtin.
+   */
+  static bool is_builtin(const std::string &identifier);
+
+  /**
+   * Checks whether calls to a name reach a builtin. A program that defines a
+   * function with a builtin's name calls its own function instead.
+   * @param identifier Name of the function.
+   * @return true if the name is a builtin the program does not redefine.
+   */
+  bool calls_builtin(const std::string &identifier) const;
+};
+
+#endif // ANALYSIS_H
@@ -10,6 +10,9 @@
  * Provides a virtual destructor and a pure virtual method for converting nodes to strings.
  */
 struct Node {
+  int line = 0;       ///< Source line a statement starts on, 0 for expressions.
+  int statement = -1; ///< Index of the statement's coverage counter, -1 if it has none.
+
   virtual ~Node() = default;
   virtual std::string to_string() const = 0;
 };
@@ -39,13 +42,18 @@ struct VariableNode : Node {
   Token identifier;
   Node* initializer;
   bool is_definition;
+  ValueType annotation = TYPE_ANY; ///< Type declared with ':' for a declared variable or parameter, TYPE_ANY if none.
 
   VariableNode(Token identifier, Node* initializer, bool is_definition)
       : identifier(std::move(identifier)), initializer(initializer), is_definition(is_definition) {}
   ~VariableNode() { delete initializer; }
 
-  std::string to_string() const override { 
-    return is_definition ? "var" : identifier.value; }
+  std::string to_string() const override {
+    if (is_definition) {
+      return "var";
+    }
+    return annotation == TYPE_ANY ? identifier.value : identifier.value + ": " + type_name(annotation);
+  }
 };
 
 /**
@@ -58,9 +66,12 @@ struct FunctionNode : Node {
   std::vector<Node*> parameters;
   BlockNode* body;
   bool is_definition;
+  bool is_pure; ///< Declared with 'pure': calls depend only on the arguments, so results can be cached.
+  ValueType return_type = TYPE_ANY; ///< Type declared with ':' after the parameters, TYPE_ANY if none.
 
-  FunctionNode(Token identifier, std::vector<Node*> parameters, BlockNode* body, bool is_definition)
-      : identifier(std::move(identifier)), parameters(std::move(parameters)), body(body), is_definition(is_definition) {}
+  FunctionNode(Token identifier, std::vector<Node*> parameters, BlockNode* body, bool is_definition, bool is_pure = false)
+      : identifier(std::move(identifier)), parameters(std::move(parameters)), body(body), is_definition(is_definition),
+        is_pure(is_pure) {}
   ~FunctionNode() {
     for (Node* n : parameters) {
       delete n;
@@ -74,15 +85,18 @@ struct FunctionNode : Node {
     }
 
     std::string ret;
-    ret += "function " + identifier.value + "(";
+    ret += (is_pure ? "pure function " : "function ") + identifier.value + "(";
     for (size_t i = 0; i < parameters.size(); i++) {
       VariableNode *param = dynamic_cast<VariableNode *>(parameters[i]);
-      ret += param->identifier.value;
+      ret += param->to_string();
       if (i + 1 < parameters.size()) {
         ret += ", ";
       }
     }
     ret += ")";
+    if (return_type != TYPE_ANY) {
+      ret += std::string(": ") + type_name(return_type);
+    }
 
     return ret;
   }
@@ -134,6 +148,39 @@ struct BinaryNode : Node {
   }
 };
 
+/**
+ * A variable read whose type was proven by type inference, so its value can
+ * be used unboxed without checking what kind of Value it is.
+ */
+struct TypedVariableNode : VariableNode {
+  ValueType type;
+
+  TypedVariableNode(Token identifier, ValueType type)
+      : VariableNode(std::move(identifier), nullptr, false), type(type) {}
+
+  std::string to_string() const override {
+    return identifier.value + " : " + type_name(type);
+  }
+};
+
+/**
+ * A binary operation whose operand types were proven by type inference. It is
+ * evaluated on raw ints and doubles instead of through Value::apply_operator.
+ * For assignment operators the left operand is the variable being assigned.
+ */
+struct TypedBinaryNode : BinaryNode {
+  ValueType left_type;
+  ValueType right_type;
+  ValueType type; ///< Type of the result.
+
+  TypedBinaryNode(Token token, Node* left, Node* right, ValueType left_type, ValueType right_type, ValueType type)
+      : BinaryNode(std::move(token), left, right), left_type(left_type), right_type(right_type), type(type) {}
+
+  std::string to_string() const override {
+    return token.value + " : " + type_name(type);
+  }
+};
+
 /**
  * Represents an if-statement in the program, including 'if', 'else if', and 'else' branches.
  */
@@ -191,4 +238,14 @@ struct ForNode : Node {
   std::string to_string() const override { return "for"; }
 };
 
+/**
+ * A variable or function on the interpreter's value stack.
+ */
+struct Binding {
+  Symbol name;             ///< Interned name, or NO_SYMBOL while an argument is still being evaluated.
+  Value *value;            ///< Value of a variable.
+  FunctionNode *function;  ///< Definition of a function, nullptr for variables.
+  ValueType type = TYPE_ANY; ///< Type a variable was declared with, which every value stored in it must have.
+};
+
 #endif // AST_H
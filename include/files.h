@@ -0,0 +1,165 @@
+#ifndef FILES_H
+#define FILES_H
+
+#include "input.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Reads the lines of a file through a read-only memory mapping. Lines are
+ * handed out as slices of the mapping, so nothing is copied until a line
+ * becomes a value.
+ */
+class MappedLines {
+private:
+  const char *data; ///< Start of the mapping, or nullptr for an empty file.
+  size_t size;      ///< Length of the file.
+  size_t position;  ///< Offset of the next unread line.
+
+public:
+  /**
+   * Maps a file.
+   * @param fd Open file descriptor of the file, which may be closed afterwards.
+   */
+  MappedLines(int fd);
+
+  /**
+   * Unmaps the file.
+   */
+  ~MappedLines();
+
+  /**
+   * Reads the next line, without its trailing newline.
+   * @param line Set to a slice of the mapping, valid until the file is closed.
+   * @return true if a line was read, false at end of file.
+   */
+  bool read_line(std::string_view *line);
+
+  /**
+   * Checks whether every line has been read.
+   * @return true if no more lines can be read.
+   */
+  bool eof() const;
+};
+
+/**
+ * Writes to a file descriptor through a large buffer, so each line written
+ * does not cost a system call.
+ */
+class OutputWriter {
+private:
+  int fd;                   ///< File descriptor being written.
+  std::vector<char> buffer; ///< Bytes waiting to be written.
+
+public:
+  /**
+   * Constructs a writer over a file descriptor.
+   * @param fd The file descriptor to write to.
+   */
+  OutputWriter(int fd);
+
+  /**
+   * Appends text to the buffer, writing the buffer out when it is full.
+   * @param text The text to write.
+   */
+  void write(std::string_view text);
+
+  /**
+   * Writes out everything buffered so far.
+   */
+  void flush();
+};
+
+/**
+ * Files opened by a script, addressed by the integer handles the file
+ * builtins return. Every file still open is flushed and closed on destruction.
+ */
+class FileTable {
+private:
+  /**
+   * One open file. Exactly one of reader, lines and writer is set.
+   */
+  struct File {
+    int fd;               ///< File descriptor, or -1 once closed.
+    InputReader *reader;  ///< Buffered reader for files opened with open_read.
+    std::string line;     ///< Last line read through reader.
+    MappedLines *lines;   ///< Mapping for files opened with lines.
+    OutputWriter *writer; ///< Buffered writer for files opened with open_write.
+  };
+
+  std::vector<File> files; ///< Files by handle.
+
+  /**
+   * Looks up an open file.
+   * @param handle The file's handle.
+   * @return The file.
+   */
+  File &find(int handle);
+
+  /**
+   * Registers an open file.
+   * @return Handle of the file.
+   */
+  int add(File file);
+
+public:
+  ~FileTable();
+
+  /**
+   * Opens a file to read line by line through a buffer.
+   * @param path Path of the file.
+   * @return Handle of the file.
+   */
+  int open_read(const std::string &path);
+
+  /**
+   * Opens a file to read line by line through a memory mapping.
+   * @param path Path of the file.
+   * @return Handle of the file.
+   */
+  int open_lines(const std::string &path);
+
+  /**
+   * Creates or truncates a file to write through a buffer.
+   * @param path Path of the file.
+   * @return Handle of the file.
+   */
+  int open_write(const std::string &path);
+
+  /**
+   * Reads the next line of a file opened for reading.
+   * @param handle The file's handle.
+   * @param line Set to the line, valid until the next read or close.
+   * @return true if a line was read, false at end of file.
+   */
+  bool read_line(int handle, std::string_view *line);
+
+  /**
+   * Checks whether a file opened for reading has no more lines.
+   * @param handle The file's handle.
+   * @return true at end of file.
+   */
+  bool eof(int handle);
+
+  /**
+   * Writes text to a file opened for writing.
+   * @param handle The file's handle.
+   * @param text The text to write.
+   */
+  void write(int handle, std::string_view text);
+
+  /**
+   * Flushes and closes a file. The handle cannot be used afterwards.
+   * @param handle The file's handle.
+   */
+  void close(int handle);
+
+  /**
+   * Checks whether any file is still open.
+   * @return true if a file has not been closed.
+   */
+  bool any_open() const;
+};
+
+#endif // FILES_H
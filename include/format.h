@@ -0,0 +1,28 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include "value.h"
+#include <cstddef>
+#include <string>
+
+/**
+ * Formats values into a template the way the format() builtin does. Each
+ * `{}` is replaced by the text of the next value, and `{{` and `}}` stand for
+ * single braces. A placeholder may hold a specifier, `{:[[fill]align][0][width][.precision]}`:
+ *  - align is `<`, `>` or `^`; numbers are right-aligned and everything else
+ *    left-aligned by default, padded with spaces or the given fill character;
+ *  - a leading `0` pads numbers with zeros after the sign;
+ *  - precision sets the digits after the point of a float and the most
+ *    characters written of a string.
+ *
+ * Numbers are converted with std::to_chars straight into the output, so no
+ * temporary strings are built. Throws if the template is malformed or the
+ * number of placeholders differs from the number of values.
+ * @param pattern The template.
+ * @param values The values, in the order of the placeholders.
+ * @param count Number of values.
+ * @param out Where the text is appended.
+ */
+extern void format_values(const std::string &pattern, Value *const *values, size_t count, std::string *out);
+
+#endif // FORMAT_H
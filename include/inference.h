@@ -0,0 +1,131 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+
+#include "analysis.h"
+#include "ast.h"
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * What is known about the type of one variable.
+ */
+struct VariableType {
+  ValueType type; ///< Type of the variable's value.
+  bool declared;  ///< Whether the type is annotated, so the interpreter keeps it through every assignment.
+
+  bool operator==(const VariableType &other) const { return type == other.type && declared == other.declared; }
+};
+
+/**
+ * Inferred types of the variables visible at one point of the program, one map
+ * per scope the interpreter would have pushed.
+ */
+typedef std::vector<std::map<std::string, VariableType>> TypeScopes;
+
+/**
+ * Flow-sensitive type inference over a parsed program.
+ *
+ * Every function body and the top level are analyzed in order, following the
+ * scopes the interpreter pushes. Loops are repeated until the types at their
+ * head stop changing, and parameter and return types are joined over every
+ * call site until the whole program stops changing. Because Ankr is
+ * dynamically scoped, variables a function does not declare itself are
+ * untyped, and variables a call may assign become untyped after the call.
+ * Variables and parameters declared with a type keep it everywhere, since the
+ * interpreter checks every value stored in them, and functions declared with
+ * a return type return it.
+ *
+ * Once types are known, arithmetic and comparisons on ints and floats are
+ * rewritten into TypedBinaryNodes and typed variable reads into
+ * TypedVariableNodes, which the interpreter evaluates without boxing.
+ */
+class TypeInference {
+private:
+  Analyzer *analyzer; ///< Source of function definitions and call effects.
+  std::unordered_map<FunctionNode *, std::vector<ValueType>> parameters; ///< Joined argument types of each definition.
+  std::map<std::string, ValueType> returns; ///< Joined return type of each function name.
+  std::unordered_map<Node *, ValueType> types; ///< Type of each expression in the latest pass.
+  std::unordered_set<BinaryNode *> assignments; ///< Assignments that appear as statements.
+  bool changed; ///< Whether a parameter or return type grew during the current pass.
+
+  /**
+   * Infers the type of an expression and records it.
+   * @param node Expression to analyze.
+   * @param scopes Variable types before the expression, updated for calls it makes.
+   * @return Type of the expression's value.
+   */
+  ValueType expression(Node *node, TypeScopes *scopes);
+
+  /**
+   * Infers types through a statement.
+   * @param node Statement to analyze.
+   * @param scopes Variable types before the statement, updated to those after it.
+   */
+  void statement(Node *node, TypeScopes *scopes);
+
+  /**
+   * Infers types through a loop until the types at its head stop changing.
+   * @param condition Loop condition.
+   * @param body Loop body.
+   * @param update Statement run after the body, or nullptr.
+   * @param scopes Variable types before the loop, updated to those after it.
+   */
+  void loop(Node *condition, Node *body, Node *update, TypeScopes *scopes);
+
+  /**
+   * Infers the types of a function body given its parameter types.
+   * @param def The function definition.
+   * @return Type of the value the body returns.
+   */
+  ValueType function_body(FunctionNode *def);
+
+  /**
+   * Replaces nodes with typed nodes where the types allow it.
+   * @param node Node to rewrite, its children are rewritten as well.
+   * @param statement Whether the node is a statement rather than an expression.
+   * @return The node to use in its place.
+   */
+  Node *rewrite(Node *node, bool statement);
+
+public:
+  /**
+   * Constructs the inference pass.
+   * @param analyzer Analysis of the same program.
+   */
+  TypeInference(Analyzer *analyzer);
+
+  /**
+   * Records a call the interpreter makes itself, which appears nowhere in the
+   * program, so the called function's parameters get the arguments' types.
+   * Must be used before run.
+   * @param identifier Name of the function.
+   * @param arguments Types of the arguments it is called with.
+   */
+  void assume_call(const std::string &identifier, const std::vector<ValueType> &arguments);
+
+  /**
+   * Infers types for a whole program and rewrites it to use typed nodes.
+   * @param root Root of the program's AST.
+   */
+  void run(BlockNode *root);
+
+  /**
+   * Computes the type apply_operator gives for two operand types.
+   * @param op The operator.
+   * @param left Type of the left operand.
+   * @param right Type of the right operand.
+   * @return Type of the result, TYPE_ANY if it may vary or fail.
+   */
+  static ValueType binary_type(TokenType op, ValueType left, ValueType right);
+
+  /**
+   * Joins the types a variable may have along two paths.
+   * @return The common type, or TYPE_ANY if they differ.
+   */
+  static ValueType join(ValueType a, ValueType b);
+};
+
+#endif // INFERENCE_H
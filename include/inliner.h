@@ -0,0 +1,175 @@
+#ifndef INLINER_H
+#define INLINER_H
+
+#include "analysis.h"
+#include "ast.h"
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * Copies the bodies of small non-recursive functions into their call sites,
+ * so those calls skip the function lookup, the argument checks and the scope
+ * a call pushes.
+ *
+ * An inlined call becomes an `if (true)` block, which gives the body its own
+ * scope just like the call did. The block declares the parameters and runs
+ * the body with every parameter and local renamed to `function@site.name`, a
+ * name no script can spell, then runs the rest of the statement with the call
+ * replaced by the returned expression. Because Ankr is dynamically scoped,
+ * renaming is only safe when no function the body calls can see the callee's
+ * variables, and the rest of the statement is only moved after the body when
+ * nothing evaluated before the call could notice.
+ *
+ * A function is inlined when its definition is at the top level, runs before
+ * anything calls a function, and is the only definition of its name; when it
+ * is neither pure nor annotated nor recursive; and when its body is small and
+ * only returns as its last statement. Call sites inside loops are always
+ * considered; a function called from more than MAX_SITES places is not
+ * inlined elsewhere, so code does not grow without a reason. A coverage file
+ * from an earlier run may guide the decisions: call sites on lines that never
+ * ran are skipped, and lines that ran at least HOT_RUNS times accept bodies up
+ * to HOT_BODY_SIZE nodes.
+ */
+class Inliner {
+private:
+  static const size_t BODY_SIZE = 40;      ///< Most nodes of an inlined body.
+  static const size_t HOT_BODY_SIZE = 120; ///< Most nodes of a body inlined into a hot line.
+  static const size_t MAX_SITES = 8;       ///< Most call sites outside loops a function is inlined into.
+  static const uint64_t HOT_RUNS = 1000;   ///< Runs of a line, according to the profile, that make it hot.
+
+  /**
+   * A function that may be inlined.
+   */
+  struct Candidate {
+    FunctionNode *def;             ///< The definition.
+    std::set<std::string> locals;  ///< Parameters and the variables its body declares at its top level.
+    size_t size;                   ///< Number of nodes in its body.
+    bool returns;                  ///< Whether the body ends with a return.
+  };
+
+  Analyzer analyzer; ///< Analysis of the program before anything was inlined.
+  std::map<int, uint64_t> profile; ///< Runs of each line in an earlier run, empty without a profile.
+  std::map<std::string, Candidate> candidates; ///< Functions that may be inlined, by name.
+  std::map<std::string, size_t> sites; ///< Number of calls to each function in the program.
+  std::set<std::string> globals; ///< Top-level variables declared before any function can run.
+  std::vector<std::string> log; ///< Description of each decision, in order.
+  unsigned inlined_calls = 0; ///< Number of calls inlined so far, used to make names unique.
+
+  /**
+   * Decides which functions may be inlined.
+   * @param root Root of the program.
+   */
+  void find_candidates(BlockNode *root);
+
+  /**
+   * Checks the body of a function and collects its locals.
+   * @param def The definition.
+   * @param candidate Where the locals, size and return are recorded.
+   * @return Why the function cannot be inlined, or an empty string if it can.
+   */
+  std::string check_body(FunctionNode *def, Candidate *candidate);
+
+  /**
+   * Counts the calls to each function under a node.
+   */
+  void count_sites(Node *node);
+
+  /**
+   * Inlines calls in every statement of a block and the blocks they contain.
+   * @param block The block, modified in place.
+   * @param declared Names certainly declared where the block runs, one set per scope.
+   * @param loops Number of loops around the block.
+   * @param function_body Whether the block is the body of a function, where
+   * a return at the top level ends the call.
+   */
+  void inline_block(BlockNode *block, std::vector<std::set<std::string>> *declared, int loops, bool function_body);
+
+  /**
+   * Inlines calls in the blocks a statement contains.
+   * @param node The statement.
+   * @param declared Names certainly declared where the statement runs.
+   * @param loops Number of loops around the statement.
+   */
+  void inline_nested(Node *node, std::vector<std::set<std::string>> *declared, int loops);
+
+  /**
+   * Inlines the first call a statement makes, if it is safe and worth it.
+   * @param statement The statement.
+   * @param declared Names certainly declared where the statement runs.
+   * @param loops Number of loops around the statement.
+   * @param function_body Whether the statement is at the top level of a function body.
+   * @param out Where the statements to use in its place are added.
+   */
+  void inline_statement(Node *statement, const std::vector<std::set<std::string>> &declared, int loops,
+                        bool function_body, std::vector<Node *> *out);
+
+  /**
+   * Finds the first call worth inlining that an expression evaluates, as long
+   * as only variables and literals are evaluated before it.
+   * @param slot Where the expression is stored.
+   * @param line Line of the statement holding the expression.
+   * @param loops Number of loops around the statement.
+   * @param reads Where the variables evaluated before the call are added.
+   * @param blocked Set when something else completes before any such call.
+   * @return Where the call is stored, or nullptr if there is none.
+   */
+  Node **first_call(Node **slot, int line, int loops, std::vector<VariableNode *> *reads, bool *blocked);
+
+  /**
+   * Checks whether a call site is worth inlining.
+   * @param call The call.
+   * @param line Line of the statement holding it.
+   * @param loops Number of loops around the statement.
+   */
+  bool worth_inlining(FunctionNode *call, int line, int loops);
+
+  /**
+   * Builds the block that replaces a call.
+   * @param call The call; its arguments are moved into the block.
+   * @param rest Statement to run after the body, with the call replaced by the
+   * returned expression, or nullptr if the result is not used.
+   * @param result Where the returned expression is stored in `rest`.
+   * @param line Line of the statement holding the call.
+   * @return The block.
+   */
+  Node *expand(FunctionNode *call, Node *rest, Node **result, int line);
+
+public:
+  /**
+   * Constructs the pass for a program.
+   * @param root Root of the program's AST, after dead code was removed.
+   * @param profile Runs of each line in an earlier run of the program, or empty.
+   */
+  Inliner(BlockNode *root, std::map<int, uint64_t> profile = {});
+
+  /**
+   * Inlines calls throughout the program. Must run before the program is
+   * analyzed and typed.
+   * @param root Root of the program's AST, modified in place.
+   */
+  void inline_calls(BlockNode *root);
+
+  /**
+   * Describes what was inlined and why functions were not, for debug output.
+   * @return One line per decision.
+   */
+  const std::vector<std::string> &decisions() const;
+
+  /**
+   * Counts the calls that were inlined.
+   * @return Number of call sites replaced by a copy of the body.
+   */
+  unsigned inlined() const;
+
+  /**
+   * Reads how often each line ran from a coverage file written by --coverage.
+   * @param path The file.
+   * @return Runs of each line.
+   */
+  static std::map<int, uint64_t> read_profile(const std::string &path);
+};
+
+#endif // INLINER_H
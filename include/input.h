@@ -0,0 +1,72 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "value.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * The InputReader class reads lines from a file descriptor through a large
+ * buffer, bypassing the synchronised iostream machinery of std::cin.
+ */
+class InputReader {
+private:
+  int fd;                  ///< File descriptor being read.
+  std::vector<char> buffer; ///< Block of bytes read from the file descriptor.
+  size_t start;            ///< Position of the first unread byte in the buffer.
+  size_t end;              ///< Position one past the last valid byte in the buffer.
+  bool at_eof;             ///< Set once the file descriptor has no more data.
+
+  /**
+   * Reads the next block from the file descriptor into the buffer.
+   * @return true if any bytes were read, false at end of input.
+   */
+  bool fill();
+
+  /**
+   * Reads more bytes after the unread ones, first moving them to the start of
+   * the buffer and growing it if they already fill it.
+   * @return true if any bytes were read, false at end of input.
+   */
+  bool extend();
+
+public:
+  /**
+   * Constructs a reader over a file descriptor.
+   * @param fd The file descriptor to read from.
+   */
+  InputReader(int fd);
+
+  /**
+   * Reads the next line, without its trailing newline or carriage return.
+   * @param line Where the line is stored.
+   * @return true if a line was read, false at end of input.
+   */
+  bool read_line(std::string *line);
+
+  /**
+   * Reads the next line, without its trailing newline or carriage return,
+   * without copying it.
+   * @param line Where a view of the line is stored. It points into the buffer
+   * and is only valid until the next read.
+   * @return true if a line was read, false at end of input.
+   */
+  bool read_record(std::string_view *line);
+
+  /**
+   * Checks whether all input has been consumed. May block waiting for input.
+   * @return true if no more lines can be read.
+   */
+  bool eof();
+};
+
+/**
+ * Converts a line of input into the value it spells out: an int or float if the
+ * whole text is a number, a bool for "true" or "false", and a string otherwise.
+ * @param text The text to convert.
+ * @return A new Value.
+ */
+extern Value *parse_value(std::string_view text);
+
+#endif // INPUT_H
@@ -1,11 +1,43 @@
 #ifndef INTERPRETER_H
 #define INTERPRETER_H
 
+#include "analysis.h"
 #include "ast.h"
+#include "files.h"
+#include "inference.h"
+#include "inliner.h"
+#include "input.h"
+#include "ir.h"
+#include "jit.h"
+#include "kernels.h"
+#include "memo.h"
+#include "optimizer.h"
 #include "parser.h"
 #include "lexer.h"
+#include "snapshot.h"
+#include "trace.h"
+#include <unordered_map>
 #include <vector>
 
+/**
+ * Settings for an interpreter, chosen on the command line.
+ */
+struct InterpreterOptions {
+  bool debug_mode = false; ///< Print tokens, the AST and every evaluation step.
+  bool jit = true;         ///< Compile hot loops to native code.
+  bool ir = true;          ///< Optimize hot loops the JIT cannot compile through the SSA IR.
+  bool dump_ir = false;    ///< Print the IR of every loop translated to it.
+  bool simd = true;        ///< Run array builtins with the CPU's vector instructions.
+  size_t memo_size = 4096; ///< Largest number of results cached for pure functions.
+  bool lazy_parsing = true; ///< Skip the bodies of functions nothing calls.
+  bool dead_code = true;    ///< Remove code that cannot affect the program before running it.
+  bool inlining = true;     ///< Copy the bodies of small functions into their call sites.
+  std::string inline_profile; ///< Coverage file of an earlier run guiding which calls are inlined, empty for none.
+  std::string snapshot_path; ///< Where checkpoint() saves the program's state, empty to ignore checkpoints.
+  bool coverage = false; ///< Count how often each statement runs.
+  bool per_line = false; ///< After the script, call on_line(line) for each line of standard input.
+};
+
 /**
  * The Interpreter class executes the abstract syntax tree (AST) generated by the Parser.
  * It maintains a runtime environment, manages scopes, and handles variable and function evaluations.
@@ -13,46 +45,118 @@
 class Interpreter {
 private:
   BlockNode* ast; ///< Pointer to the root of the AST.
+  size_t next_statement; ///< Index of the next top-level statement to run.
+  std::string snapshot_path; ///< Where checkpoint() saves the program's state, empty to ignore checkpoints.
 
   bool debug_mode; ///< Flag to enable debug mode which provides detailed logs.
+  bool per_line; ///< Whether to call on_line(line) for each line of standard input after the script.
+
+  static const size_t STACK_SIZE = 1 << 20; ///< Most variables and functions alive at once.
 
-  std::vector<std::vector<Node*>> scope; ///< Stack of scopes, each containing a list of nodes (variables/functions).
+  /// Variables and functions of every open scope, innermost last. The storage is
+  /// reserved up front, so pointers to values stay valid while scopes are pushed.
+  std::vector<Binding> stack;
+  std::vector<size_t> frames; ///< Index in the stack where each open scope starts.
   size_t scope_index; ///< Current index in the scope stack.
 
+  InputReader input_reader; ///< Buffered reader behind the input() builtin.
+  Trace *trace; ///< Log that standard input and random numbers are recorded to or replayed from, or nullptr.
+  FileTable files; ///< Files opened by the file builtins.
+  StringValue *split_line; ///< Line most recently split by fields(), or nullptr.
+  std::vector<std::string_view> split_fields; ///< Fields of split_line, pointing into its text.
+  std::string format_buffer; ///< Text of the last format() call, reused so formatting stops allocating once it is large enough.
+
+  Analyzer *analyzer; ///< Static analysis of the program, used to pick faster execution strategies.
+  std::unordered_map<ForNode *, CountedLoop> counted_loops; ///< Cached counted-loop analysis for each for-loop.
+
+  Jit *jit; ///< Compiler for hot loops, or nullptr when native code is disabled.
+  IrCompiler *ir; ///< Translator of hot loops to the SSA IR, or nullptr when it is disabled.
+
+  MemoCache memo; ///< Cached results of pure function calls.
+  Random random; ///< Generator behind rand(), seeded with 0 until the program calls seed().
+  const ArrayKernels *kernels; ///< Loops behind the array builtins.
+
+  std::vector<uint64_t> coverage; ///< Times each statement ran, indexed by Node::statement.
+  std::vector<int> statement_lines; ///< Source line of each counted statement.
+  uint64_t *coverage_counts; ///< Start of coverage, or nullptr when statements are not counted.
+
   /**
    * Increases the scope level.
+   * @param arguments Number of entries at the top of the stack that belong to the new scope.
    */
-  void scope_increase();
+  void scope_increase(size_t arguments = 0);
 
   /**
    * Decreases the scope level and pops the top scope.
    */
   void scope_decrease();
 
+  /**
+   * Adds a variable or function to the current scope.
+   * @param binding The new entry.
+   */
+  void push_binding(const Binding &binding);
+
   /**
    * Prints the current state of all scopes, useful for debugging.
    */
   void print_scope();
 
+  /**
+   * Finds the innermost variable or function with a name. Within one scope the
+   * first definition wins.
+   * @param identifier The interned name to look up.
+   * @param function Whether to look for a function rather than a variable.
+   * @return The entry, or nullptr if none is defined.
+   */
+  Binding *find_binding(Symbol identifier, bool function);
+
   /**
    * Retrieves the function defintion matching the identifier
-   * @param identifier The name of the function
+   * @param identifier The interned name of the function
+   */
+  FunctionNode *get_function_from_scope(Symbol identifier);
+
+  /**
+   * Calls a function the program defines at the top level, if it does.
+   * @param call A call node naming the function, without arguments.
+   * @param argument Value of the only argument, or nullptr to pass none.
+   */
+  void call_hook(FunctionNode *call, Value *argument);
+
+  /**
+   * Calls on_begin(), then on_line(line) with each line of standard input as a
+   * string, then on_end(). on_begin and on_end are optional.
+   */
+  void run_lines();
+
+  /**
+   * Finds the binding of a variable, counting the lookup.
+   * @param identifier The interned name of the variable.
+   * @return The binding, or nullptr if the variable is not defined.
+   */
+  Binding *get_variable_binding(Symbol identifier);
+
+  /**
+   * Finds where the value of a variable is stored.
+   * @param identifier The interned name of the variable.
+   * @return Pointer to the variable's value slot, or nullptr if it is not defined.
    */
-  FunctionNode *get_function_from_scope(std::string identifier);
+  Value **get_variable_slot(Symbol identifier);
 
   /**
    * Retrieves the value of a variable from the current scope.
-   * @param identifier The name of the variable.
+   * @param identifier The interned name of the variable.
    * @return Value* Pointer to the Value object associated with the variable.
    */
-  Value* get_variable_value(std::string identifier);
+  Value* get_variable_value(Symbol identifier);
 
   /**
    * Sets or updates the value of a variable in the current scope.
-   * @param identifier The name of the variable.
+   * @param identifier The interned name of the variable.
    * @param new_value Pointer to the new value to be assigned to the variable.
    */
-  void set_variable_value(std::string identifier, Value* new_value);
+  void set_variable_value(Symbol identifier, Value* new_value);
 
   /**
    * Defines a variable by evaluating its initializer and storing it in the current scope.
@@ -61,12 +165,98 @@ private:
   void define_variable(VariableNode* vn);
 
   /**
-   * Evaluates a function call by setting up the environment, evaluating parameters, and executing the function body.
+   * Reads the next line of standard input, or of the trace being replayed.
+   * @param line Set to the line, valid until the next read.
+   * @return true if a line was read, false at end of input.
+   */
+  bool read_input(std::string_view *line);
+
+  /**
+   * Checks whether standard input, or the trace being replayed, has no more lines.
+   * @return true at end of input.
+   */
+  bool input_eof();
+
+  /**
+   * Evaluates a call to a builtin function.
    * @param identifier Name of the function.
    * @param parameters Vector of pointers to Values passed as arguments to the function.
+   * @return Value* Result of the call, or nullptr if there is no builtin with that name.
+   */
+  Value* evaluate_builtin(const std::string &identifier, const std::vector<Value*> &parameters);
+
+  /**
+   * Formats the parameters of a format() call into format_buffer.
+   * @param parameters The template followed by the values.
+   */
+  void format_parameters(const std::vector<Value*> &parameters);
+
+  /**
+   * Evaluates a function call. Arguments are evaluated straight onto the value
+   * stack, where they become the parameters of the callee's scope.
+   * @param call The call expression.
    * @return Value* Result of the function execution.
    */
-  Value* evaluate_function(std::string identifier, std::vector<Value*> parameters);
+  Value* evaluate_function(FunctionNode* call);
+
+  /**
+   * Calls a user function whose arguments have been pushed onto the value stack.
+   * @param call The call expression.
+   * @param base Index in the stack of the first argument.
+   * @return Value* Result of the function execution.
+   */
+  Value* call_function(FunctionNode* call, size_t base);
+
+  /**
+   * Gives every statement under a node a coverage counter.
+   * @param node Node to search for statements.
+   */
+  void number_statements(Node *node);
+
+  /**
+   * Starts counting how often each statement runs.
+   */
+  void enable_coverage();
+
+  /**
+   * Saves the program's state for a later run to continue from, as requested
+   * by a checkpoint() statement.
+   */
+  void save_checkpoint();
+
+  /**
+   * Runs a for-loop with a native integer counter if it qualifies as a counted loop.
+   * Must be called after the loop's initialization has been visited.
+   * @param fn The for-loop.
+   * @return true if the loop was run, false if it must be run generically.
+   */
+  bool run_counted_loop(ForNode *fn);
+
+  /**
+   * Runs the rest of a hot loop as native code, compiling it first if needed.
+   * The loop must be at the start of an iteration, before its condition is checked.
+   * @param loop The WhileNode or ForNode.
+   * @param retry Set to false when later iterations of this run should not try again.
+   * @return true if the loop ran to completion, false if it must keep being interpreted.
+   */
+  bool run_compiled_loop(Node *loop, bool *retry);
+
+  /**
+   * Runs the rest of a hot loop through the SSA IR, translating it first if needed.
+   * The loop must be at the start of an iteration, before its condition is checked.
+   * @param loop The WhileNode or ForNode.
+   * @param retry Set to false when later iterations of this run should not try again.
+   * @return true if the loop ran to completion, false if it must keep being interpreted.
+   */
+  bool run_ir_loop(Node *loop, bool *retry);
+
+  /**
+   * Runs a call instruction of an IR region.
+   * @param instruction The call.
+   * @param values Registers of the region.
+   * @return Value* Result of the call.
+   */
+  Value* run_ir_call(IrInstruction *instruction, const std::vector<Value *> &values);
 
   /**
    * Evaluates an AST node and returns its value.
@@ -75,6 +265,54 @@ private:
    */
   Value* evaluate(Node* node);
 
+  /**
+   * Evaluates a condition straight to a native bool, short-circuiting && and ||
+   * and comparing numbers and strings without allocating intermediate values.
+   * @param node Pointer to the condition node.
+   * @param result Where the outcome is stored if the condition is a boolean.
+   * @return nullptr if the condition produced a boolean, otherwise the non-boolean value it produced.
+   */
+  Value* evaluate_condition(Node* node, bool* result);
+
+  /**
+   * Evaluates an expression type inference proved to be an int, without boxing
+   * the results of typed operations inside it.
+   * @param node Pointer to the expression.
+   * @return The int it evaluates to.
+   */
+  int evaluate_int(Node* node);
+
+  /**
+   * Evaluates an expression type inference proved to be an int or a float.
+   * @param node Pointer to the expression.
+   * @return The number it evaluates to, as a double.
+   */
+  double evaluate_number(Node* node);
+
+  /**
+   * Evaluates a typed comparison on raw numbers.
+   * @param node Pointer to the comparison.
+   * @return The outcome of the comparison.
+   */
+  bool compare_typed(TypedBinaryNode* node);
+
+  /**
+   * Evaluates a typed operation and boxes its result.
+   * @param node Pointer to the operation.
+   * @return Value* Result of the operation.
+   */
+  Value* evaluate_typed(TypedBinaryNode* node);
+
+  /**
+   * Applies a typed operation to operands that were already evaluated, the
+   * same way evaluate_typed would.
+   * @param node The typed operation.
+   * @param left Value of the left operand; ignored for assignments.
+   * @param right Value of the right operand.
+   * @return Value* Result of the operation.
+   */
+  Value* apply_typed(TypedBinaryNode* node, Value* left, Value* right);
+
   /**
    * Visits an AST node and performs actions based on its type.
    * @param node Pointer to the node to be visited.
@@ -85,9 +323,16 @@ public:
   /**
    * Constructor that initializes the interpreter with the provided code.
    * @param code The source code to be interpreted.
-   * @param debug_mode Whether debugging is enabled.
+   * @param options Settings such as debug mode.
+   */
+  Interpreter(std::string code, const InterpreterOptions &options);
+
+  /**
+   * Constructor that continues a program from a snapshot saved by checkpoint().
+   * @param snapshot The saved state, whose AST and values the interpreter takes over.
+   * @param options Settings such as debug mode.
    */
-  Interpreter(std::string code, bool debug_mode);
+  Interpreter(const Snapshot &snapshot, const InterpreterOptions &options);
 
   /**
    * Destructor that cleans up the AST and other dynamically allocated resources.
@@ -98,6 +343,21 @@ public:
    * Executes the program by visiting and evaluating the AST.
    */
   void execute();
+
+  /**
+   * Records the results of input(), eof(), rand() and rand_float() to a trace,
+   * or takes them from one instead of standard input and the generator.
+   * @param trace The trace, owned by the caller, or nullptr to stop.
+   */
+  void set_trace(Trace *trace);
+
+  /**
+   * Writes how often each line ran in lcov format. A line with several
+   * statements reports the count of the one that ran most.
+   * @param path Path of the file, replaced if it exists.
+   * @param source Name of the script, recorded as the source file.
+   */
+  void write_coverage(const std::string &path, const std::string &source) const;
 };
 
 #endif // INTERPRETER_H
@@ -0,0 +1,217 @@
+#ifndef IR_H
+#define IR_H
+
+#include "analysis.h"
+#include "ast.h"
+#include "inference.h"
+#include "jit.h"
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @enum IrOp
+ * @brief Operations of the mid-level IR. The last three end a basic block.
+ */
+enum IrOp {
+  IR_CONST,  ///< A literal.
+  IR_LOAD,   ///< Reads an interpreter variable.
+  IR_STORE,  ///< Writes an interpreter variable so code outside the IR sees it.
+  IR_UNARY,  ///< A unary operator.
+  IR_BINARY, ///< A binary operator, typed when `node` is set.
+  IR_ASSIGN, ///< The value a variable holds after an assignment operator.
+  IR_CALL,   ///< A call to a builtin or user function.
+  IR_LOOP,   ///< A nested loop the interpreter runs as native code.
+  IR_PHI,    ///< Picks an operand by the predecessor control came from.
+  IR_JUMP,   ///< Continues at `targets[0]`.
+  IR_BRANCH, ///< Continues at `targets[0]` if the operand is true, `targets[1]` if false.
+  IR_EXIT    ///< Leaves the region.
+};
+
+/**
+ * @enum IrBranch
+ * @brief What a branch does when its operand is not a bool, mirroring the
+ * statement the branch came from.
+ */
+enum IrBranch {
+  BRANCH_IF,    ///< Throws, like an if statement.
+  BRANCH_LOOP,  ///< Leaves the loop through `targets[1]`.
+  BRANCH_LOGIC  ///< Continues at `targets[2]`, where && or || reports the error.
+};
+
+struct IrBlock;
+
+/**
+ * One SSA instruction. Every instruction that produces a value owns the
+ * register numbered by its id.
+ */
+struct IrInstruction {
+  IrOp op;
+  int id;                               ///< Unique number, also the index of its register.
+  std::vector<IrInstruction *> operands; ///< Values used; for a phi, one per predecessor.
+  Token token;                          ///< The operator of unary, binary and assignment instructions.
+  Node *node = nullptr;                 ///< TypedBinaryNode of a typed operation, FunctionNode of a call, or the nested loop.
+  Value *constant = nullptr;            ///< Value of a constant.
+  int variable = -1;                    ///< Variable loaded, stored, assigned or merged by a phi.
+  ValueType type = TYPE_ANY;            ///< Type of the result when it is known.
+  /// For `+` and `+=`, the string on the left may be appended to because
+  /// nothing uses it afterwards. For `=`, a fresh string on the right may be
+  /// kept without a copy.
+  bool in_place = false;
+  IrBranch branch = BRANCH_IF;
+  IrBlock *targets[3] = {};
+  IrBlock *block = nullptr; ///< Block holding the instruction.
+};
+
+/**
+ * A basic block: phis first, then straight-line code, then one terminator.
+ */
+struct IrBlock {
+  int id;
+  std::vector<IrInstruction *> instructions;
+  std::vector<IrBlock *> predecessors; ///< Blocks that jump here, in the order of phi operands.
+
+  ~IrBlock();
+
+  /**
+   * Finds the instruction that ends the block.
+   * @return The jump, branch or exit.
+   */
+  IrInstruction *terminator() const { return instructions.back(); }
+};
+
+/**
+ * A name the region reads or writes. Slot variables live in the interpreter's
+ * scopes and are loaded and stored around the region; local ones are declared
+ * inside a nested scope of the region and only ever live in registers.
+ */
+struct IrVariable {
+  std::string name;
+  bool local;    ///< Declared by a nested scope, so it never leaves the region.
+  bool declared; ///< Declared by the loop itself, so its slot is in the loop's own scope.
+  ValueType type = TYPE_NONE; ///< Type the code assumes the variable has on entry, TYPE_NONE if any.
+};
+
+/**
+ * A loop in a region. The preheader runs once before the loop is entered.
+ */
+struct IrLoop {
+  IrBlock *preheader;
+  IrBlock *header;
+  std::vector<IrBlock *> blocks; ///< Blocks of the loop, including the header and nested loops.
+};
+
+/**
+ * SSA code for the rest of one hot loop. The entry block loads the loop's
+ * variables, the loop runs, and the exit block stores the variables it
+ * changed back into the interpreter's scopes.
+ */
+struct IrRegion {
+  Node *loop;                    ///< The WhileNode or ForNode.
+  std::vector<IrBlock *> blocks; ///< Blocks, starting with the entry block.
+  std::vector<IrVariable> variables;
+  std::vector<IrLoop> loops; ///< Loops, inner ones before the loops containing them.
+  int registers = 0;         ///< Number of registers needed to run the code.
+  int copies = 0;            ///< Copies and trivial phis removed.
+  int common = 0;            ///< Repeated computations removed.
+  int hoisted = 0;           ///< Instructions moved out of loops.
+
+  ~IrRegion();
+
+  /**
+   * Formats the region as text, one instruction per line.
+   * @return The listing.
+   */
+  std::string to_string() const;
+};
+
+/**
+ * The IrCompiler class translates hot loops the native JIT cannot handle into
+ * the SSA IR and optimizes them. Any statement the IR cannot express, such as
+ * a return, a function definition or a call whose effects are unknown, leaves
+ * the loop to the AST interpreter.
+ */
+class IrCompiler {
+private:
+  std::unordered_map<Node *, unsigned> iterations; ///< Iterations run so far by each loop.
+  std::unordered_map<Node *, IrRegion *> regions;  ///< Compiled loops; nullptr when a loop cannot be compiled.
+  Analyzer *analyzer; ///< Effects of calls, used to keep variables in sync with callees.
+  const Jit *jit;     ///< Nested loops it compiled keep running as native code, or nullptr.
+  bool dump;          ///< Print each region after it is compiled.
+
+public:
+  static const unsigned THRESHOLD = 64; ///< Iterations a loop runs before it is compiled.
+
+  /**
+   * Constructs a compiler.
+   * @param analyzer Static analysis of the program.
+   * @param jit The native compiler, or nullptr when it is disabled.
+   * @param dump Whether to print every region to standard error.
+   */
+  IrCompiler(Analyzer *analyzer, const Jit *jit, bool dump);
+
+  /**
+   * Frees every region.
+   */
+  ~IrCompiler();
+
+  /**
+   * Counts an iteration of a loop.
+   * @param loop The WhileNode or ForNode.
+   * @return true once the loop has run enough iterations to be worth compiling.
+   */
+  bool is_hot(Node *loop);
+
+  /**
+   * Translates and optimizes a loop, or returns the result of an earlier attempt.
+   * For a ForNode only the condition, body and update are translated; the
+   * initialization must already have run. Variables the loop reads on entry
+   * are specialized to the types they have now.
+   * @param loop The WhileNode or ForNode.
+   * @param lookup Returns the current value of a variable, or nullptr if it is not defined.
+   * @return The region, or nullptr if the loop uses anything unsupported.
+   */
+  IrRegion *compile(Node *loop, const std::function<Value *(const std::string &)> &lookup);
+};
+
+/**
+ * Removes phis whose operands are all the same value, assignments that only
+ * copy a value of a known type, stores of a value just loaded from the same
+ * variable, and instructions whose results are unused and cannot fail.
+ * @param region The region, modified in place.
+ * @return Number of instructions removed.
+ */
+int propagate_copies(IrRegion *region);
+
+/**
+ * Works out the type of every instruction from constants, typed operations
+ * and the types inference proved for variable reads.
+ * @param region The region, modified in place.
+ */
+void infer_types(IrRegion *region);
+
+/**
+ * Replaces constants and operators that repeat a computation already done
+ * on every path to them with the earlier result.
+ * @param region The region, modified in place.
+ * @return Number of instructions removed.
+ */
+int eliminate_common_subexpressions(IrRegion *region);
+
+/**
+ * Moves operators whose operands do not change inside a loop, and which
+ * cannot fail, to the loop's preheader.
+ * @param region The region, modified in place.
+ * @return Number of instructions moved.
+ */
+int hoist_loop_invariants(IrRegion *region);
+
+/**
+ * Marks the string concatenations and assignments whose operand nothing
+ * uses afterwards, so they may reuse it instead of copying.
+ * @param region The region, modified in place.
+ */
+void plan_in_place(IrRegion *region);
+
+#endif // IR_H
@@ -0,0 +1,89 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "ast.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Native code for one hot loop, together with the interpreter variables it reads
+ * and writes. Variables live in a frame of 32-bit slots while the code runs;
+ * bools are stored as 0 or 1.
+ */
+struct CompiledLoop {
+  std::vector<std::string> variables; ///< Interpreter variables loaded into the frame.
+  std::vector<int> slots;             ///< Frame slot of each variable.
+  std::vector<ValueType> types;       ///< Type of each variable when the loop was compiled.
+  std::vector<bool> written;          ///< Whether the loop may assign each variable.
+  std::vector<bool> declared;         ///< Whether each variable is declared by the loop body itself.
+  size_t frame_size;                  ///< Number of frame slots, including locals of nested loops.
+  void (*code)(int32_t *frame);       ///< Entry point, runs the loop until its condition fails.
+  void *memory;                       ///< Executable mapping holding the code.
+  size_t memory_size;                 ///< Size of the mapping.
+};
+
+/**
+ * The Jit class compiles hot while- and for-loops to x86-64 machine code.
+ *
+ * A loop becomes a candidate once it has run THRESHOLD iterations. It is then
+ * compiled for the types its variables hold at that moment, provided it only
+ * uses int and bool variables, arithmetic, comparisons, logical operators,
+ * assignments, if statements and nested loops. Each time the compiled code is
+ * entered the interpreter checks that every variable still has the recorded
+ * type, and keeps interpreting the loop if one does not.
+ */
+class Jit {
+private:
+  std::unordered_map<Node *, unsigned> iterations; ///< Iterations run so far by each loop.
+  std::unordered_map<Node *, CompiledLoop *> loops; ///< Compiled loops; nullptr when a loop cannot be compiled.
+  uint64_t *coverage = nullptr; ///< Counters compiled statements increment, indexed by Node::statement.
+
+public:
+  static const unsigned THRESHOLD = 64; ///< Iterations a loop runs before it is compiled.
+
+  /**
+   * Frees the code of every compiled loop.
+   */
+  ~Jit();
+
+  /**
+   * Counts an iteration of a loop.
+   * @param loop The WhileNode or ForNode.
+   * @return true once the loop has run enough iterations to be worth compiling.
+   */
+  bool is_hot(Node *loop);
+
+  /**
+   * Compiles a loop, or returns the result of an earlier attempt.
+   * For a ForNode only the condition, body and update are compiled; the
+   * initialization must already have run.
+   * @param loop The WhileNode or ForNode.
+   * @param lookup Returns the current value of a variable, or nullptr if it is not defined.
+   * @return The compiled loop, or nullptr if it uses anything unsupported.
+   */
+  CompiledLoop *compile(Node *loop, const std::function<Value *(const std::string &)> &lookup);
+
+  /**
+   * Checks whether a loop has been compiled.
+   * @param loop The WhileNode or ForNode.
+   * @return true if native code exists for the loop.
+   */
+  bool compiled(Node *loop) const;
+
+  /**
+   * Makes loops compiled from now on count how often each statement runs.
+   * @param counters Counter of each statement, indexed by Node::statement.
+   */
+  void count_statements(uint64_t *counters);
+
+  /**
+   * Checks whether native code can be generated on this platform.
+   * @return true on x86-64 Linux.
+   */
+  static bool supported();
+};
+
+#endif // JIT_H
@@ -0,0 +1,45 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+
+/**
+ * Loops over the elements of int and float arrays, used by the array
+ * builtins. Each instruction set has its own table; int arithmetic wraps
+ * around on overflow like it does on IntValues.
+ */
+struct ArrayKernels {
+  const char *name; ///< Instruction set the kernels use.
+
+  int (*sum_int)(const int *a, size_t n);
+  double (*sum_float)(const double *a, size_t n);
+  int (*min_int)(const int *a, size_t n);                      ///< Requires n > 0.
+  double (*min_float)(const double *a, size_t n);              ///< Requires n > 0.
+  int (*max_int)(const int *a, size_t n);                      ///< Requires n > 0.
+  double (*max_float)(const double *a, size_t n);              ///< Requires n > 0.
+  int (*dot_int)(const int *a, const int *b, size_t n);
+  double (*dot_float)(const double *a, const double *b, size_t n);
+  void (*scale_int)(int *a, size_t n, int factor);             ///< Multiplies every element in place.
+  void (*scale_float)(double *a, size_t n, double factor);     ///< Multiplies every element in place.
+  void (*add_int)(int *a, const int *b, size_t n);             ///< Adds b to a element by element.
+  void (*add_float)(double *a, const double *b, size_t n);     ///< Adds b to a element by element.
+  size_t (*count_gt_int)(const int *a, size_t n, int limit);   ///< Counts elements greater than limit.
+  size_t (*count_gt_float)(const double *a, size_t n, double limit); ///< Counts elements greater than limit.
+  void (*prefix_sum_int)(int *a, size_t n);                    ///< Replaces each element by the sum up to it.
+  void (*prefix_sum_float)(double *a, size_t n);               ///< Replaces each element by the sum up to it.
+};
+
+/**
+ * Retrieves the plain C++ kernels, which run everywhere.
+ * @return The scalar kernel table.
+ */
+extern const ArrayKernels &scalar_kernels();
+
+/**
+ * Retrieves the fastest kernels this CPU supports: AVX2, then SSE2 on
+ * x86-64, otherwise the scalar ones. The CPU is checked once.
+ * @return The chosen kernel table.
+ */
+extern const ArrayKernels &best_kernels();
+
+#endif // KERNELS_H
@@ -15,6 +15,7 @@ private:
   std::string code; ///< The source code to tokenize.
   size_t pos;       ///< Current position in the source code string.
   char current_char;///< Current character at the position in the source code.
+  int line;         ///< Line of the current character, counting from 1.
 
   /**
    * Advances the current position in the source code by one character.
@@ -0,0 +1,60 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "ast.h"
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Results of calls to pure functions, keyed by the function and its argument
+ * values. Holds at most a fixed number of results, evicting the least
+ * recently used one when full.
+ */
+class MemoCache {
+private:
+  /**
+   * A cached result.
+   */
+  struct Entry {
+    std::string key; ///< Encoded function and arguments.
+    Value *value;    ///< The call's result.
+  };
+
+  std::list<Entry> entries; ///< Cached results, most recently used first.
+  std::unordered_map<std::string, std::list<Entry>::iterator> index; ///< Entries by key.
+  size_t capacity; ///< Largest number of results kept.
+
+public:
+  /**
+   * Constructs an empty cache.
+   * @param capacity Largest number of results kept, 0 disables caching.
+   */
+  MemoCache(size_t capacity);
+
+  /**
+   * Encodes a call as a cache key.
+   * @param function The function definition being called.
+   * @param arguments The argument values.
+   * @param key Where the key is stored.
+   * @return false if an argument cannot be part of a key.
+   */
+  static bool make_key(FunctionNode *function, const std::vector<Value *> &arguments, std::string *key);
+
+  /**
+   * Looks up the result of a call and marks it as recently used.
+   * @param key Key from make_key.
+   * @return The cached result, or nullptr on a miss.
+   */
+  Value *find(const std::string &key);
+
+  /**
+   * Caches the result of a call, evicting the least recently used result if full.
+   * @param key Key from make_key.
+   * @param value The call's result.
+   */
+  void insert(const std::string &key, Value *value);
+};
+
+#endif // MEMO_H
@@ -0,0 +1,96 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "ast.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * Removes code from a parsed program that cannot affect what it does:
+ * branches and loops whose condition is a constant, statements after a
+ * function's return, functions nothing reachable calls, and declarations of
+ * variables no code refers to whose initial value is a constant.
+ *
+ * Because Ankr is dynamically scoped, a variable declared in one function
+ * can be read by any function it calls, so a declaration is only dead when
+ * its name appears nowhere else in the program. Initializers are only
+ * removed when they are literals or operators on literals that evaluate
+ * without an error, so a removed statement could never have failed.
+ */
+class Optimizer {
+private:
+  std::vector<std::string> log; ///< Description of each removal, in order.
+  std::map<std::string, std::vector<FunctionNode *>> functions; ///< Function definitions by name.
+  std::set<std::string> called;     ///< Functions called from reachable code.
+  std::set<std::string> referenced; ///< Variables read or assigned anywhere.
+  std::vector<std::string> entry_points; ///< Functions the interpreter calls itself.
+
+  /**
+   * Evaluates an expression made only of literals and operators.
+   * @param node The expression.
+   * @return Its value, or nullptr if it is not constant or fails.
+   */
+  static Value *fold(Node *node);
+
+  /**
+   * Records every function definition under a node, including nested ones.
+   * @param node Node to search.
+   */
+  void collect_functions(Node *node);
+
+  /**
+   * Records the functions a node calls and the variables it refers to. The
+   * bodies of function definitions are skipped.
+   * @param node Node to search.
+   * @param calls Where called names are added.
+   */
+  void collect_uses(Node *node, std::set<std::string> *calls);
+
+  /**
+   * Finds the functions reachable from the top level and the variables
+   * referred to by reachable code.
+   * @param root Root of the program.
+   */
+  void find_uses(BlockNode *root);
+
+  /**
+   * Removes dead code from a statement and everything it contains.
+   * @param node The statement.
+   * @param function_body Whether the node is the body of a function.
+   * @return The statement to use in its place, or nullptr to drop it.
+   */
+  Node *simplify(Node *node, bool function_body);
+
+  /**
+   * Removes dead statements from a block.
+   * @param block The block, modified in place.
+   * @param function_body Whether the block is the body of a function, where
+   * statements after a return never run.
+   */
+  void simplify_block(BlockNode *block, bool function_body);
+
+public:
+  /**
+   * Constructs the pass.
+   * @param entry_points Functions the interpreter calls itself, which are kept
+   * like functions the top level calls.
+   */
+  Optimizer(std::vector<std::string> entry_points = {});
+
+  /**
+   * Removes dead code from a whole program until nothing more can be removed.
+   * Must run before the program is analyzed, since definitions are deleted.
+   * @param root Root of the program's AST, modified in place.
+   */
+  void eliminate_dead_code(BlockNode *root);
+
+  /**
+   * Describes what was removed, for debug output.
+   * @return One line per removal.
+   */
+  const std::vector<std::string> &removed() const;
+};
+
+#endif // OPTIMIZER_H
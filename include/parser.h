@@ -3,6 +3,9 @@
 
 #include "ast.h"
 #include "token.h"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 /**
@@ -16,6 +19,11 @@ private:
   size_t pos; ///< Current position in the tokens vector.
   bool debug_mode; ///< Indicates whether to log parsing steps for debugging.
 
+  bool lazy_bodies; ///< Whether function bodies are only parsed once something calls the function.
+  std::unordered_map<std::string, std::vector<std::pair<FunctionNode *, size_t>>> deferred; ///< Unparsed definitions by name, with the position of their body's '{'.
+  std::unordered_set<std::string> called; ///< Names of every function called by the code parsed so far.
+  std::vector<std::string> pending; ///< Called names whose deferred definitions may still need parsing.
+
   /**
    * Parses a block of statements enclosed by curly braces.
    * @return Pointer to a BlockNode representing the parsed block.
@@ -28,6 +36,23 @@ private:
    */
   IfNode *parse_if();
 
+  /**
+   * Skips a block of statements enclosed by curly braces, only matching braces.
+   */
+  void skip_block();
+
+  /**
+   * Notes that a function is called, so that its definitions get parsed.
+   * @param identifier Name of the function.
+   */
+  void record_call(const std::string &identifier);
+
+  /**
+   * Parses the deferred bodies of every function the parsed code can call,
+   * repeating for the calls those bodies make.
+   */
+  void parse_called_bodies();
+
   /**
    * Parses a 'while' loop statement.
    * @return Pointer to a WhileNode representing the parsed loop.
@@ -47,6 +72,24 @@ private:
    */
   VariableNode *parse_variable(bool is_definition);
 
+  /**
+   * Checks whether the next tokens are a name followed by ':', which starts a
+   * variable or parameter with a type annotation.
+   */
+  bool at_annotated_name();
+
+  /**
+   * Parses a name followed by ':' and a type.
+   * @return A VariableNode referring to the name, with its annotation set.
+   */
+  VariableNode *parse_annotated_name();
+
+  /**
+   * Parses the type of an annotation: int, float, string, bool or array.
+   * @return The type.
+   */
+  ValueType parse_type();
+
   /**
    * Parses a function declaration or function call.
    * @param is_definition Specifies whether the function is being declared (true) or called (false).
@@ -119,8 +162,12 @@ public:
    * Constructs a Parser with a list of tokens to parse and an optional debug mode.
    * @param tokens Vector of tokens to parse.
    * @param debug_mode Whether to output debug information during parsing.
+   * @param lazy_bodies Whether to skip the bodies of functions nothing calls. Their
+   * definitions are kept with a nullptr body, so they cannot be checked for errors.
+   * @param entry_points Functions the interpreter calls itself, whose bodies are always parsed.
    */
-  Parser(std::vector<Token> tokens, bool debug_mode);
+  Parser(std::vector<Token> tokens, bool debug_mode, bool lazy_bodies,
+         const std::vector<std::string> &entry_points = {});
   
   /**
    * Destructor.
@@ -0,0 +1,64 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The xoshiro256** pseudo-random number generator. Each interpreter owns one,
+ * so sequences are reproducible from a seed and never shared between threads.
+ */
+class Random {
+public:
+  uint64_t state[4]; ///< Generator state, never all zero. Saved in snapshots.
+
+  /**
+   * Constructs a generator.
+   * @param seed Initial seed, see reseed.
+   */
+  explicit Random(uint64_t seed);
+
+  /**
+   * Restarts the sequence. The seed is expanded with splitmix64, so nearby
+   * seeds give unrelated sequences.
+   * @param seed Any value.
+   */
+  void reseed(uint64_t seed);
+
+  /**
+   * Generates the next 64 random bits.
+   * @return Uniformly distributed bits.
+   */
+  uint64_t next();
+
+  /**
+   * Generates an integer in [0, bound) without modulo bias, using Lemire's
+   * multiply-and-reject method.
+   * @param bound Exclusive upper limit, greater than zero.
+   * @return The integer.
+   */
+  uint32_t below(uint32_t bound);
+
+  /**
+   * Generates a float in [0, 1) from the top 53 bits of the next output.
+   * @return The float.
+   */
+  double uniform();
+
+  /**
+   * Fills a buffer with integers in [0, bound).
+   * @param out First element to fill.
+   * @param count Number of elements.
+   * @param bound Exclusive upper limit, greater than zero.
+   */
+  void fill(int *out, size_t count, uint32_t bound);
+
+  /**
+   * Fills a buffer with floats in [0, 1).
+   * @param out First element to fill.
+   * @param count Number of elements.
+   */
+  void fill(double *out, size_t count);
+};
+
+#endif // RANDOM_H
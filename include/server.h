@@ -0,0 +1,152 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "interpreter.h"
+#include <deque>
+#include <functional>
+#include <list>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
+
+/// Runs a program the way a direct invocation would, returning the exit status.
+typedef std::function<int(Interpreter *interpreter, const std::string &source)> ProgramRunner;
+
+/**
+ * A long-lived process that runs scripts for clients connecting over a Unix
+ * domain socket, so each run skips starting the interpreter and, once the
+ * script was run before, lexing, parsing and analyzing it.
+ *
+ * A client sends the absolute path of a script along with its standard input,
+ * output and error. Requests are read without blocking, so a client that
+ * connects and sends nothing holds up nobody. Each run forks a worker, so runs
+ * never see each other's state and write straight to the client's streams.
+ * A new or changed script is constructed inside its worker under a time
+ * limit; once that succeeds the server constructs it too and caches it by
+ * path and modification time, so later runs fork from the cached program.
+ * The worker's exit status is sent back when it finishes.
+ */
+class Server {
+private:
+  /**
+   * A constructed program that has not run yet.
+   */
+  struct Program {
+    std::string path;         ///< Absolute path of the script.
+    struct timespec modified; ///< Modification time of the script when it was read.
+    off_t size;               ///< Size of the script when it was read.
+    Interpreter *interpreter; ///< The program, ready to execute.
+  };
+
+  /**
+   * A connection whose run request has not fully arrived.
+   */
+  struct Request {
+    std::string data; ///< Bytes received so far: the path's length, then the path.
+    int streams[3];   ///< The client's standard streams, once received.
+    bool has_streams; ///< Whether the streams arrived.
+  };
+
+  /**
+   * A worker running a script for a client.
+   */
+  struct Worker {
+    int connection;           ///< Where the exit status goes.
+    std::string path;         ///< Absolute path of the script.
+    struct timespec modified; ///< Modification time of the script when it was read.
+    off_t size;               ///< Size of the script when it was read.
+    std::string code;         ///< Source the worker constructed, empty if it ran a cached program.
+    int compiled;             ///< Pipe the worker writes to once the source is constructed, or -1.
+  };
+
+  static const size_t CACHE_SIZE = 64;        ///< Most programs kept at once.
+  static const unsigned COMPILE_SECONDS = 10; ///< Longest a worker may spend constructing a program.
+
+  std::string socket_path;     ///< Where clients connect.
+  InterpreterOptions options;  ///< Options every program is constructed with.
+  size_t workers;              ///< Most scripts running at once.
+  ProgramRunner runner;        ///< Runs a program inside a worker.
+  std::list<Program> programs; ///< Cached programs, most recently used first.
+  std::unordered_map<std::string, std::list<Program>::iterator> cache; ///< Cached programs by path.
+  std::unordered_map<int, Request> pending; ///< Requests still arriving, by connection.
+  std::deque<std::pair<int, Request>> queued; ///< Complete requests waiting for a worker.
+  std::unordered_map<pid_t, Worker> running; ///< Each running worker.
+  int listener;                ///< Socket accepting connections.
+
+  /**
+   * Finds the cached program for a script, dropping it if the script
+   * changed since it was cached.
+   * @param path Absolute path of the script.
+   * @param info The script's current status.
+   * @return The program, owned by the cache, or nullptr.
+   */
+  Interpreter *find(const std::string &path, const struct stat &info);
+
+  /**
+   * Constructs a program in the server and caches it. Only called with
+   * source a worker already constructed, so a script that crashes or hangs
+   * the parser only takes its own worker down.
+   * @param worker The finished worker that constructed the source.
+   */
+  void store(const Worker &worker);
+
+  /**
+   * Reads what arrived on a connection whose request is incomplete, and
+   * queues the request once it is whole.
+   */
+  void receive(int connection);
+
+  /**
+   * Starts a worker for each queued request while fewer than the limit run.
+   */
+  void start();
+
+  /**
+   * Starts a worker for a complete request.
+   * @param connection The connection, closed when the run is over.
+   * @param request The request; its streams are closed here.
+   */
+  void handle(int connection, Request &request);
+
+  /**
+   * Sends the exit status of every worker that finished to its client,
+   * caching the programs workers constructed.
+   */
+  void reap();
+
+public:
+  /**
+   * Constructs a server without opening its socket.
+   * @param socket_path Where clients connect. An existing file there is replaced.
+   * @param options Options every program is constructed with.
+   * @param workers Most scripts running at once.
+   * @param runner Runs a program inside a worker.
+   */
+  Server(std::string socket_path, const InterpreterOptions &options, size_t workers, ProgramRunner runner);
+
+  /**
+   * Frees the cached programs.
+   */
+  ~Server();
+
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+
+  /**
+   * Opens the socket and serves clients until the process is killed.
+   * Throws if the socket cannot be opened.
+   */
+  void run();
+};
+
+/**
+ * Runs a script on a server, passing it this process's standard input,
+ * output and error.
+ * @param socket_path Where the server listens.
+ * @param script Path of the script, relative to the current directory.
+ * @return The exit status of the script.
+ */
+extern int run_client(const std::string &socket_path, const std::string &script);
+
+#endif // SERVER_H
@@ -0,0 +1,40 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "ast.h"
+#include "random.h"
+#include <string>
+#include <vector>
+
+/**
+ * State of a program stopped at a top-level checkpoint() statement: its AST
+ * after type inference, where to continue, its global variables and
+ * functions, and its random number generator. Restoring it skips lexing,
+ * parsing, analysis and every statement before the checkpoint.
+ */
+struct Snapshot {
+  BlockNode *ast = nullptr;     ///< The whole program.
+  size_t next_statement = 0;    ///< Index of the top-level statement to continue from.
+  std::vector<Binding> globals; ///< Global scope; names point into the AST.
+  Random random{0};             ///< Generator behind rand(), so restored runs draw the same numbers.
+};
+
+/**
+ * Writes a snapshot to a file.
+ * Values are written by content, so values shared between variables are
+ * restored as copies. This is safe because values are never modified in
+ * place, apart from strings only one variable holds. Arrays are the
+ * exception and keep their sharing.
+ * @param path Path of the file, replaced if it exists.
+ * @param snapshot The state to write.
+ */
+extern void save_snapshot(const std::string &path, const Snapshot &snapshot);
+
+/**
+ * Reads a snapshot written by save_snapshot through a memory mapping.
+ * @param path Path of the file.
+ * @return The restored state. The caller owns the AST and the global values.
+ */
+extern Snapshot load_snapshot(const std::string &path);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "token.h"
+#include "value.h"
+#include <cstdint>
+#include <string>
+
+/**
+ * @enum NodeKind
+ * @brief Categories of AST nodes counted by the runtime statistics.
+ */
+enum NodeKind {
+  NODE_BLOCK, NODE_VARIABLE, NODE_FUNCTION, NODE_TERMINAL, NODE_UNARY,
+  NODE_BINARY, NODE_IF, NODE_WHILE, NODE_FOR,
+  NODE_KIND_COUNT
+};
+
+const int TOKEN_TYPE_COUNT = IDENTIFIER + 1; ///< Number of entries in TokenType.
+
+/**
+ * @struct Stats
+ * @brief Counters collected while a program runs. Every counter is a plain
+ * increment, so collection is always on and only printing is optional.
+ */
+struct Stats {
+  uint64_t nodes[NODE_KIND_COUNT];    ///< Nodes evaluated or visited, by kind.
+  /// apply_operator calls by operator, left operand type and right operand type.
+  /// The extra right-hand type slot counts unary operators.
+  uint64_t operators[TOKEN_TYPE_COUNT][VALUE_TYPE_COUNT][VALUE_TYPE_COUNT + 1];
+  uint64_t values_allocated[VALUE_TYPE_COUNT]; ///< Values constructed, by type.
+  uint64_t values_freed[VALUE_TYPE_COUNT];     ///< Values destroyed, by type.
+  uint64_t scope_pushes;           ///< Scopes entered.
+  uint64_t scope_pops;             ///< Scopes left.
+  uint64_t peak_scope_depth;       ///< Largest number of scopes alive at once.
+  uint64_t variable_lookups;       ///< Variable lookups by name.
+  uint64_t lookup_entries_scanned; ///< Scope entries compared during variable lookups.
+  uint64_t function_calls;         ///< Calls to user-defined functions.
+  uint64_t builtin_calls;          ///< Calls to builtin functions.
+  uint64_t typed_operations;       ///< Operations evaluated on unboxed values after type inference.
+  uint64_t strings_appended;       ///< String concatenations done in place instead of copying.
+  uint64_t memo_hits;              ///< Pure function calls answered from the cache.
+  uint64_t memo_misses;            ///< Pure function calls that had to run.
+  uint64_t memo_evictions;         ///< Cached results dropped to make room.
+  uint64_t jit_compiled;           ///< Loops compiled to native code.
+  uint64_t jit_failed;             ///< Hot loops that could not be compiled.
+  uint64_t jit_entries;            ///< Times compiled loops were run.
+  uint64_t jit_guard_exits;        ///< Times a variable's type did not match its compiled loop.
+  uint64_t ir_compiled;            ///< Loops translated to the SSA IR.
+  uint64_t ir_failed;              ///< Hot loops the IR could not express.
+  uint64_t ir_entries;             ///< Times IR regions were run.
+  uint64_t ir_guard_exits;         ///< Times a variable's type did not match its IR region.
+};
+
+/**
+ * Counters for the current thread.
+ */
+extern thread_local Stats stats;
+
+/**
+ * Counts one apply_operator call.
+ * @param op The operator being applied.
+ * @param left The value the operator is applied to.
+ * @param right The other operand, or nullptr for unary operators.
+ */
+inline void count_operator(TokenType op, const Value *left, const Value *right) {
+  stats.operators[op][left->type][right ? right->type : VALUE_TYPE_COUNT]++;
+}
+
+/**
+ * Formats counters as a JSON object.
+ * @param s The counters to format.
+ * @return JSON text.
+ */
+extern std::string stats_to_json(const Stats &s);
+
+#endif // STATS_H
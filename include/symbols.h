@@ -0,0 +1,109 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef uint32_t Symbol; ///< Number of an interned string.
+
+const Symbol NO_SYMBOL = 0; ///< Stands for no name; never given to a string.
+
+/**
+ * Interns identifiers and string literals as 32-bit symbols, so names are
+ * compared as integers. The table may be shared by threads lexing different
+ * sources: finding a symbol or its name never takes a lock, and adding a new
+ * string only locks one of several shards, picked by the string's hash.
+ * Strings are never removed.
+ */
+class SymbolTable {
+private:
+  static const unsigned SHARDS = 16;       ///< Independent hash tables, a power of two.
+  static const unsigned FIRST_CHUNK = 256; ///< Names in the first chunk; each later chunk is twice as large.
+  static const unsigned CHUNKS = 24;       ///< Enough chunks for every 32-bit symbol.
+
+  /**
+   * An open-addressing hash table of symbols. A full table is replaced by a
+   * larger copy, and the old one is kept for readers that may still use it.
+   */
+  struct Table {
+    size_t capacity; ///< Number of slots, a power of two.
+    std::unique_ptr<std::atomic<Symbol>[]> slots; ///< Symbols, NO_SYMBOL for free slots.
+
+    explicit Table(size_t capacity);
+  };
+
+  /**
+   * One hash table and the lock its writers take.
+   */
+  struct Shard {
+    std::mutex lock;
+    std::atomic<Table *> table; ///< Current table.
+    std::vector<Table *> tables; ///< Every table ever used, freed with the symbol table.
+    size_t count = 0;            ///< Symbols in the table.
+  };
+
+  Shard shards[SHARDS];
+  std::atomic<std::atomic<const std::string *> *> chunks[CHUNKS]; ///< Names by symbol, allocated on demand.
+  std::atomic<Symbol> next; ///< Next symbol to give out.
+
+  /**
+   * Looks for a string in one table without locking.
+   * @return Its symbol, or NO_SYMBOL if the table does not hold it.
+   */
+  Symbol probe(const Table *table, size_t hash, const std::string &name) const;
+
+  /**
+   * Finds where the name of a symbol is stored.
+   * @param chunk Where the number of the chunk holding it is stored.
+   * @return Its position in the chunk.
+   */
+  static size_t locate(Symbol symbol, unsigned *chunk);
+
+public:
+  SymbolTable();
+
+  /**
+   * Frees every name and table.
+   */
+  ~SymbolTable();
+
+  SymbolTable(const SymbolTable &) = delete;
+  SymbolTable &operator=(const SymbolTable &) = delete;
+
+  /**
+   * Finds the symbol of a string, adding the string if it is new.
+   * @param name Any string.
+   * @return Its symbol, the same for every call with an equal string.
+   */
+  Symbol intern(const std::string &name);
+
+  /**
+   * Finds the symbol of a string without adding it.
+   * @param name Any string.
+   * @return Its symbol, or NO_SYMBOL if it was never interned.
+   */
+  Symbol find(const std::string &name) const;
+
+  /**
+   * Looks up the string a symbol stands for.
+   * @param symbol A symbol returned by intern, or NO_SYMBOL.
+   * @return The string, empty for NO_SYMBOL. It stays valid as long as the table.
+   */
+  const std::string &name(Symbol symbol) const;
+
+  /**
+   * Counts the strings interned so far.
+   * @return Number of symbols given out.
+   */
+  size_t size() const;
+};
+
+/// Symbols shared by every lexer and interpreter of the process.
+extern SymbolTable symbols;
+
+#endif // SYMBOLS_H
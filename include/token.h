@@ -1,6 +1,7 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include "symbols.h"
 #include <map>
 #include <string>
 
@@ -13,12 +14,12 @@
  */
 enum TokenType {
   // Keywords
-  IF, ELSE, WHILE, FOR, FUNCTION, VAR, RETURN, TRUE, FALSE, BREAK,
+  IF, ELSE, WHILE, FOR, FUNCTION, VAR, RETURN, TRUE, FALSE, BREAK, PURE,
   // Literals
   INT, FLOAT, STRING,
   // Operators and Punctuation
   ADD, SUBTRACT, MULTIPLY, DIVIDE, MODULO, NEGATIVE, INCREMENT, DECREMENT,
-  LEFT_PARENTHESIS, RIGHT_PARENTHESIS, LEFT_BRACKET, RIGHT_BRACKET, COMMA, DOT,
+  LEFT_PARENTHESIS, RIGHT_PARENTHESIS, LEFT_BRACKET, RIGHT_BRACKET, COMMA, DOT, COLON,
   // Assignment Operators
   ASSIGN, ASSIGN_ADD, ASSIGN_SUBTRACT, ASSIGN_MULTIPLY, ASSIGN_DIVIDE, ASSIGN_MODULO,
   // Boolean Operators
@@ -39,6 +40,8 @@ enum TokenType {
 struct Token {
   TokenType type;      ///< Type of the token.
   std::string value;   ///< The textual value of the token.
+  int line = 0;        ///< Source line the token starts on, counting from 1; 0 if unknown.
+  Symbol symbol = NO_SYMBOL; ///< Interned value of identifiers and string literals.
 };
 
 /**
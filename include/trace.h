@@ -0,0 +1,122 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "files.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @enum TraceMode
+ * @brief Whether a trace is being written or read back.
+ */
+enum TraceMode { TRACE_RECORD, TRACE_REPLAY };
+
+/**
+ * A log of every result a run got from outside the program: the lines
+ * input() and -n read from standard input, the answers of eof(), and the
+ * numbers rand() and rand_float() drew. Replaying the log repeats the run
+ * exactly without reading standard input, so interactive sessions can be
+ * benchmarked and profiled.
+ *
+ * The file starts with a magic number and a version, followed by one event
+ * per result: a tag byte, then a varint length and the bytes of a line, a
+ * zigzag varint for an int, or eight bytes for a float. A replay that asks
+ * for a different kind of event than the one recorded next throws, since the
+ * program no longer runs the way it did.
+ */
+class Trace {
+private:
+  /**
+   * Kinds of event in a trace.
+   */
+  enum Event : uint8_t {
+    EVENT_LINE = 1, EVENT_END_OF_INPUT, EVENT_MORE_INPUT, EVENT_NO_MORE_INPUT, EVENT_INT, EVENT_FLOAT
+  };
+
+  std::string path;      ///< The trace file, for error messages.
+  OutputWriter *writer;  ///< Where a recording goes, nullptr when replaying.
+  int fd;                ///< File descriptor of a recording, -1 when replaying.
+  bool interactive;      ///< Whether standard input is a terminal, so recorded input is written out at once.
+  std::string data;      ///< Contents of a replayed trace.
+  size_t position;       ///< Offset of the next event to replay.
+
+  void put(Event event);
+  void put_varint(uint64_t value);
+
+  /**
+   * Reads the tag of the next event, which must be one of two kinds.
+   * @param what Description of the expected event for the error message.
+   * @return The tag.
+   */
+  Event take(Event expected, Event alternative, const char *what);
+
+  uint64_t take_varint();
+
+public:
+  /**
+   * Opens a trace.
+   * @param path The trace file, created or truncated when recording.
+   * @param mode Whether to record or replay.
+   */
+  Trace(const std::string &path, TraceMode mode);
+
+  /**
+   * Writes out the rest of a recording and closes it.
+   */
+  ~Trace();
+
+  Trace(const Trace &) = delete;
+  Trace &operator=(const Trace &) = delete;
+
+  /**
+   * Checks whether results come from the trace rather than from outside.
+   * @return true when replaying.
+   */
+  bool replaying() const;
+
+  /**
+   * Records a line read from standard input.
+   * @param line The line, or nullptr if the input had ended.
+   */
+  void record_line(const std::string_view *line);
+
+  /**
+   * Replays a line read from standard input.
+   * @param line Set to the line, valid as long as the trace.
+   * @return false if the input had ended.
+   */
+  bool replay_line(std::string_view *line);
+
+  /**
+   * Records the answer of eof() on standard input.
+   */
+  void record_eof(bool eof);
+
+  /**
+   * Replays the answer of eof() on standard input.
+   */
+  bool replay_eof();
+
+  /**
+   * Records an int rand() drew, or replaces it by the recorded one.
+   * @param drawn The number the generator gave.
+   * @return The number the program sees.
+   */
+  int random_int(int drawn);
+
+  /**
+   * Records a float rand_float() drew, or replaces it by the recorded one.
+   * @param drawn The number the generator gave.
+   * @return The number the program sees.
+   */
+  double random_float(double drawn);
+
+  /**
+   * Writes out everything recorded so far.
+   */
+  void flush();
+};
+
+#endif // TRACE_H
@@ -5,6 +5,44 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
+
+/**
+ * @enum ValueType
+ * @brief Runtime type of a value, available without a virtual call or a dynamic_cast.
+ */
+enum ValueType {
+  TYPE_INT, TYPE_FLOAT, TYPE_STRING, TYPE_BOOL, TYPE_VOID, TYPE_ARRAY,
+  VALUE_TYPE_COUNT
+};
+
+const ValueType TYPE_ANY = VALUE_TYPE_COUNT;                                   ///< May hold values of more than one type.
+const ValueType TYPE_NONE = static_cast<ValueType>(VALUE_TYPE_COUNT + 1); ///< No value has been seen yet.
+
+/**
+ * Names a value type the same way Value::get_type does.
+ * @param type The type to name.
+ * @return The type name, or "unknown" for anything past TYPE_ARRAY.
+ */
+extern const char *type_name(ValueType type);
+
+/**
+ * Appends an int in decimal, converting it with std::to_chars straight into
+ * the string.
+ * @param out The string to append to.
+ * @param value The number.
+ */
+extern void append_int(std::string *out, long value);
+
+/**
+ * Appends a float in fixed notation, converting it with std::to_chars straight
+ * into the string. With the default precision the text is the same
+ * std::to_string gives, without going through the locale.
+ * @param out The string to append to.
+ * @param value The number.
+ * @param precision Digits after the decimal point.
+ */
+extern void append_float(std::string *out, double value, int precision = 6);
 
 /**
  * Abstract base class for all value types in the interpreter.
@@ -13,7 +51,10 @@
  */
 class Value {
 public:
-  virtual ~Value() {}
+  const ValueType type; ///< Runtime type of the value.
+
+  explicit Value(ValueType type);
+  virtual ~Value();
 
   /**
    * Converts the value to a string representation.
@@ -43,7 +84,7 @@ class IntValue : public Value {
 public:
   int value; ///< The integer value.
 
-  explicit IntValue(int value) : value(value) {}
+  explicit IntValue(int value) : Value(TYPE_INT), value(value) {}
 
   std::string to_string() const override;
   std::string get_type() const override;
@@ -57,7 +98,7 @@ class FloatValue : public Value {
 public:
   double value; ///< The floating-point value.
 
-  explicit FloatValue(float value) : value(value) {}
+  explicit FloatValue(double value) : Value(TYPE_FLOAT), value(value) {}
 
   std::string to_string() const override;
   std::string get_type() const override;
@@ -68,10 +109,43 @@ public:
  * Represents a string value in the interpreter.
  */
 class StringValue : public Value {
+private:
+  mutable size_t cached_hash; ///< Hash of the text, valid when `hashed` is set.
+  mutable bool hashed;        ///< Whether the hash has been computed since the text last changed.
+
 public:
   std::string value; ///< The string value.
+  /// Set once the value may be reachable from more than one place, such as a
+  /// literal or a variable that has been read. Only values that are not shared
+  /// may be appended to in place.
+  bool shared;
+  /// Interned symbol of the text, NO_SYMBOL if it was not interned. Two
+  /// strings with symbols are equal exactly when their symbols are.
+  Symbol symbol;
+
+  explicit StringValue(std::string value, Symbol symbol = NO_SYMBOL)
+      : Value(TYPE_STRING), cached_hash(), hashed(false), value(std::move(value)), shared(false), symbol(symbol) {}
 
-  explicit StringValue(std::string value) : value(std::move(value)) {}
+  /**
+   * Appends the text of another value in place, growing the storage
+   * geometrically so repeated appends take amortized linear time.
+   * @param to The value to append.
+   */
+  void append(const Value *to);
+
+  /**
+   * Hashes the text, computing the hash only the first time after it changes.
+   * @return The hash.
+   */
+  size_t hash() const;
+
+  /**
+   * Compares the text with another string, deciding from the symbols, the
+   * lengths or the cached hashes before comparing characters.
+   * @param other The other string.
+   * @return true if both hold the same text.
+   */
+  bool equals(const StringValue *other) const;
 
   std::string to_string() const override;
   std::string get_type() const override;
@@ -85,7 +159,7 @@ class BoolValue : public Value {
 public:
   bool value; ///< The boolean value.
 
-  explicit BoolValue(bool value) : value(value) {}
+  explicit BoolValue(bool value) : Value(TYPE_BOOL), value(value) {}
 
   std::string to_string() const override;
   std::string get_type() const override;
@@ -99,11 +173,48 @@ class VoidValue : public Value {
 public:
   int val;
 
-  VoidValue() : val(0) {}
+  VoidValue() : Value(TYPE_VOID), val(0) {}
 
   std::string to_string() const override;
   std::string get_type() const override;
   Value* apply_operator(Token op, Value *to) override;
 };
 
+/**
+ * Represents a fixed-length array of ints or of floats, stored unboxed so that
+ * builtins can work on the raw numbers. Arrays are passed and assigned by
+ * reference: every variable holding the same array sees changes made by set().
+ */
+class ArrayValue : public Value {
+public:
+  ValueType element_type;     ///< TYPE_INT or TYPE_FLOAT.
+  std::vector<int> ints;      ///< Elements of an int array.
+  std::vector<double> floats; ///< Elements of a float array.
+
+  /**
+   * Constructs an array of zeros.
+   * @param element_type TYPE_INT or TYPE_FLOAT.
+   * @param size Number of elements.
+   */
+  ArrayValue(ValueType element_type, size_t size);
+
+  /**
+   * Retrieves the number of elements.
+   * @return The length of the array.
+   */
+  size_t size() const { return element_type == TYPE_INT ? ints.size() : floats.size(); }
+
+  std::string to_string() const override;
+  std::string get_type() const override;
+  Value* apply_operator(Token op, Value *to) override;
+};
+
+/**
+ * Appends the text to_string gives for a value, writing ints, floats and
+ * strings straight into the string instead of building a temporary one.
+ * @param out The string to append to.
+ * @param value The value.
+ */
+extern void append_text(std::string *out, const Value *value);
+
 #endif // VALUE_H
@@ -0,0 +1,380 @@
+#include "../include/analysis.h"
+#include <algorithm>
+#include <unordered_set>
+
+/**
+ * Merges the effects of a callee into a caller.
+ * @return true if anything new was added.
+ */
+static bool merge(Effects *into, const Effects &from) {
+  size_t before = into->reads.size() + into->writes.size() + into->calls.size();
+  bool unknown_before = into->unknown_calls;
+  into->reads.insert(from.reads.begin(), from.reads.end());
+  into->writes.insert(from.writes.begin(), from.writes.end());
+  into->calls.insert(from.calls.begin(), from.calls.end());
+  into->unknown_calls |= from.unknown_calls;
+  return before != into->reads.size() + into->writes.size() + into->calls.size() ||
+         unknown_before != into->unknown_calls;
+}
+
+static bool is_declared(std::vector<std::set<std::string>> *scopes, const std::string &identifier) {
+  for (const std::set<std::string> &s : *scopes) {
+    if (s.count(identifier)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Analyzer::Analyzer(BlockNode *root) : functions(), summaries(), annotations() {
+  collect_functions(root);
+}
+
+bool Analyzer::is_builtin(const std::string &identifier) {
+  static const std::unordered_set<std::string> builtins = {"input", "eof", "output", "format", "rand", "open_read", "lines", "open_write", "read_line", "write", "close", "fields", "field", "checkpoint",
+                                                           "seed", "rand_float", "rand_fill", "array", "len", "get", "set",
+                                                           "sum", "min", "max", "dot", "scale", "add", "count_if_gt", "sort", "prefix_sum"};
+  return builtins.count(identifier) > 0;
+}
+
+bool Analyzer::calls_builtin(const std::string &identifier) const {
+  return is_builtin(identifier) && functions.find(identifier) == functions.end();
+}
+
+std::string Analyzer::impurity(FunctionNode *def) {
+  Effects e;
+  std::vector<std::set<std::string>> scopes(1);
+  for (Node *p : def->parameters) {
+    if (auto *parameter = dynamic_cast<VariableNode *>(p)) {
+      scopes[0].insert(parameter->identifier.value);
+    }
+  }
+  walk(def->body, &scopes, &e);
+
+  // Callers' variables are visible through dynamic scoping, so using them
+  // would make the result depend on more than the arguments.
+  if (!e.reads.empty()) {
+    return "reads variable '" + *e.reads.begin() + "' it does not declare";
+  } else if (!e.writes.empty()) {
+    return "assigns variable '" + *e.writes.begin() + "' it does not declare";
+  }
+
+  for (const std::string &callee : e.calls) {
+    auto defs = functions.find(callee);
+    if (calls_builtin(callee)) {
+      return "calls builtin '" + callee + "'";
+    } else if (defs == functions.end()) {
+      return "calls undefined function '" + callee + "'";
+    } else if (defs->second.size() > 1) {
+      return "calls function '" + callee + "', which is defined more than once";
+    } else if (!defs->second[0]->is_pure) {
+      return "calls function '" + callee + "', which is not pure";
+    }
+  }
+  return "";
+}
+
+const std::map<std::string, std::vector<FunctionNode *>> &Analyzer::definitions() const {
+  return functions;
+}
+
+void Analyzer::collect_functions(Node *node) {
+  if (!node) {
+    return;
+  }
+
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    for (Node *s : bn->statements) {
+      collect_functions(s);
+    }
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    // Bodies that were never parsed belong to functions nothing calls.
+    if (fnn->is_definition && fnn->body) {
+      functions[fnn->identifier.value].push_back(fnn);
+      for (Node *p : fnn->parameters) {
+        collect_annotation(dynamic_cast<VariableNode *>(p));
+      }
+      collect_functions(fnn->body);
+    }
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    if (vn->is_definition) {
+      auto *assign = dynamic_cast<BinaryNode *>(vn->initializer);
+      collect_annotation(dynamic_cast<VariableNode *>(assign ? assign->left : vn->initializer));
+    }
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    collect_functions(in->true_body);
+    collect_functions(in->false_body);
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    collect_functions(wn->body);
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    collect_functions(fn->initialization);
+    collect_functions(fn->body);
+  }
+}
+
+void Analyzer::collect_annotation(VariableNode *variable) {
+  if (!variable || variable->annotation == TYPE_ANY) {
+    return;
+  }
+  auto inserted = annotations.emplace(variable->identifier.value, variable->annotation);
+  if (!inserted.second && inserted.first->second != variable->annotation) {
+    inserted.first->second = TYPE_ANY;
+  }
+}
+
+ValueType Analyzer::annotation(const std::string &identifier) const {
+  auto found = annotations.find(identifier);
+  return found != annotations.end() ? found->second : TYPE_NONE;
+}
+
+void Analyzer::walk(Node *node, std::vector<std::set<std::string>> *scopes, Effects *effects) {
+  if (!node) {
+    return;
+  }
+
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    // Blocks share the scope of the statement that owns them.
+    for (Node *s : bn->statements) {
+      walk(s, scopes, effects);
+    }
+
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    if (vn->is_definition) {
+      VariableNode *variable;
+      if (auto *assign = dynamic_cast<BinaryNode *>(vn->initializer)) {
+        walk(assign->right, scopes, effects);
+        variable = dynamic_cast<VariableNode *>(assign->left);
+      } else {
+        variable = dynamic_cast<VariableNode *>(vn->initializer);
+      }
+      if (variable) {
+        scopes->back().insert(variable->identifier.value);
+      }
+    } else if (!is_declared(scopes, vn->identifier.value)) {
+      effects->reads.insert(vn->identifier.value);
+    }
+
+  } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    walk(un->child, scopes, effects);
+    // Any unary statement other than return stores its result back into the variable.
+    auto *variable = dynamic_cast<VariableNode *>(un->child);
+    if (variable && un->token.type != RETURN && !is_declared(scopes, variable->identifier.value)) {
+      effects->writes.insert(variable->identifier.value);
+    }
+
+  } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    walk(bnn->left, scopes, effects);
+    walk(bnn->right, scopes, effects);
+    auto *variable = dynamic_cast<VariableNode *>(bnn->left);
+    if (is_assign(bnn->token.type) && variable && !is_declared(scopes, variable->identifier.value)) {
+      effects->writes.insert(variable->identifier.value);
+    }
+
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    walk(in->condition, scopes, effects);
+    scopes->push_back({});
+    walk(in->true_body, scopes, effects);
+    scopes->back().clear();
+    walk(in->false_body, scopes, effects);
+    scopes->pop_back();
+
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    scopes->push_back({});
+    walk(wn->condition, scopes, effects);
+    walk(wn->body, scopes, effects);
+    scopes->pop_back();
+
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    scopes->push_back({});
+    walk(fn->initialization, scopes, effects);
+    walk(fn->condition, scopes, effects);
+    walk(fn->body, scopes, effects);
+    walk(fn->update, scopes, effects);
+    scopes->pop_back();
+
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    // Definitions are analyzed when they are called.
+    if (!fnn->is_definition) {
+      effects->calls.insert(fnn->identifier.value);
+      for (Node *p : fnn->parameters) {
+        walk(p, scopes, effects);
+      }
+    }
+  }
+}
+
+const Effects &Analyzer::summary(const std::string &identifier) {
+  auto cached = summaries.find(identifier);
+  if (cached != summaries.end()) {
+    return cached->second;
+  }
+
+  // Collect the local effects of every function reachable from this one.
+  std::vector<std::string> reachable = {identifier};
+  std::map<std::string, Effects> local;
+  for (size_t i = 0; i < reachable.size(); i++) {
+    std::string name = reachable[i];
+    Effects &e = local[name];
+
+    auto defs = functions.find(name);
+    if (defs == functions.end()) {
+      e.unknown_calls = !is_builtin(name);
+      continue;
+    }
+
+    for (FunctionNode *def : defs->second) {
+      std::vector<std::set<std::string>> scopes(1);
+      for (Node *p : def->parameters) {
+        if (auto *parameter = dynamic_cast<VariableNode *>(p)) {
+          scopes[0].insert(parameter->identifier.value);
+        }
+      }
+      walk(def->body, &scopes, &e);
+    }
+
+    for (const std::string &callee : e.calls) {
+      if (!local.count(callee) && !summaries.count(callee) &&
+          std::find(reachable.begin(), reachable.end(), callee) == reachable.end()) {
+        reachable.push_back(callee);
+      }
+    }
+  }
+
+  // Propagate callee effects into callers until nothing changes.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const std::string &name : reachable) {
+      Effects merged = local[name];
+      for (const std::string &callee : local[name].calls) {
+        auto done = summaries.find(callee);
+        merge(&merged, done != summaries.end() ? done->second : local[callee]);
+      }
+      changed |= merge(&local[name], merged);
+    }
+  }
+
+  for (const std::string &name : reachable) {
+    summaries[name] = local[name];
+  }
+  return summaries[identifier];
+}
+
+Effects Analyzer::effects(Node *node) {
+  Effects e;
+  std::vector<std::set<std::string>> scopes(1);
+  walk(node, &scopes, &e);
+
+  std::set<std::string> calls = e.calls;
+  for (const std::string &callee : calls) {
+    merge(&e, summary(callee));
+  }
+  return e;
+}
+
+const Effects &Analyzer::call_effects(const std::string &identifier) {
+  return summary(identifier);
+}
+
+CountedLoop Analyzer::counted_loop(ForNode *fn) {
+  CountedLoop loop;
+
+  // Initialization: var i = A
+  auto *init = dynamic_cast<VariableNode *>(fn->initialization);
+  auto *init_assign = init && init->is_definition ? dynamic_cast<BinaryNode *>(init->initializer) : nullptr;
+  auto *counter = init_assign ? dynamic_cast<VariableNode *>(init_assign->left) : nullptr;
+  if (!counter || init_assign->token.type != ASSIGN) {
+    return loop;
+  }
+  loop.variable = counter->identifier.value;
+
+  // Condition: i < N, or N > i
+  auto *condition = dynamic_cast<BinaryNode *>(fn->condition);
+  if (!condition) {
+    return loop;
+  }
+  auto *left = dynamic_cast<VariableNode *>(condition->left);
+  auto *right = dynamic_cast<VariableNode *>(condition->right);
+  bool flipped = false;
+  if (left && left->identifier.value == loop.variable) {
+    loop.bound = condition->right;
+  } else if (right && right->identifier.value == loop.variable) {
+    loop.bound = condition->left;
+    flipped = true;
+  } else {
+    return loop;
+  }
+
+  switch (condition->token.type) {
+  case LESS_THAN: loop.comparison = flipped ? GREATER_THAN : LESS_THAN; break;
+  case GREATER_THAN: loop.comparison = flipped ? LESS_THAN : GREATER_THAN; break;
+  case LESS_THAN_OR_EQUAL: loop.comparison = flipped ? GREATER_THAN_OR_EQUAL : LESS_THAN_OR_EQUAL; break;
+  case GREATER_THAN_OR_EQUAL: loop.comparison = flipped ? LESS_THAN_OR_EQUAL : GREATER_THAN_OR_EQUAL; break;
+  case NOT_EQUAL: loop.comparison = NOT_EQUAL; break;
+  default: return loop;
+  }
+
+  // Update: i++, i--, i += k or i -= k with a literal k
+  if (auto *un = dynamic_cast<UnaryNode *>(fn->update)) {
+    auto *variable = dynamic_cast<VariableNode *>(un->child);
+    if (!variable || variable->identifier.value != loop.variable) {
+      return loop;
+    }
+    if (un->token.type == INCREMENT) {
+      loop.step = 1;
+    } else if (un->token.type == DECREMENT) {
+      loop.step = -1;
+    } else {
+      return loop;
+    }
+  } else if (auto *bnn = dynamic_cast<BinaryNode *>(fn->update)) {
+    auto *variable = dynamic_cast<VariableNode *>(bnn->left);
+    auto *amount = dynamic_cast<TerminalNode *>(bnn->right);
+    auto *step = amount ? dynamic_cast<IntValue *>(amount->v) : nullptr;
+    if (!variable || variable->identifier.value != loop.variable || !step) {
+      return loop;
+    }
+    if (bnn->token.type == ASSIGN_ADD) {
+      loop.step = step->value;
+    } else if (bnn->token.type == ASSIGN_SUBTRACT) {
+      loop.step = -step->value;
+    } else {
+      return loop;
+    }
+  } else {
+    return loop;
+  }
+
+  // The bound is evaluated once, so it must not call anything.
+  Effects bound = effects(loop.bound);
+  if (!bound.calls.empty()) {
+    return loop;
+  }
+
+  // Neither the counter nor anything the bound reads may change inside the body,
+  // including through functions it calls or variables it redeclares.
+  Effects body = effects(fn->body);
+  if (body.unknown_calls || body.writes.count(loop.variable)) {
+    return loop;
+  }
+  for (const std::string &name : bound.reads) {
+    if (body.writes.count(name)) {
+      return loop;
+    }
+  }
+  for (Node *s : fn->body->statements) {
+    auto *vn = dynamic_cast<VariableNode *>(s);
+    if (vn && vn->is_definition) {
+      auto *assign = dynamic_cast<BinaryNode *>(vn->initializer);
+      auto *declared = dynamic_cast<VariableNode *>(assign ? assign->left : vn->initializer);
+      if (declared && (declared->identifier.value == loop.variable ||
+                       bound.reads.count(declared->identifier.value))) {
+        return loop;
+      }
+    }
+  }
+
+  loop.body_reads = body.reads.count(loop.variable) > 0;
+  loop.eligible = true;
+  return loop;
+}
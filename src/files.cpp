@@ -0,0 +1,212 @@
+#include "../include/files.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+/**
+ * Opens a file, throwing if it cannot be opened.
+ * @return The file descriptor.
+ */
+static int open_file(const std::string &path, int flags) {
+  int fd;
+  do {
+    fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open file: " + path + " (" + strerror(errno) + ")");
+  }
+  return fd;
+}
+
+MappedLines::MappedLines(int fd) : data(), size(), position() {
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    throw std::runtime_error(std::string("Failed to read file: ") + strerror(errno));
+  }
+  size = info.st_size;
+  if (size == 0) {
+    return;
+  }
+
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error(std::string("Failed to map file: ") + strerror(errno));
+  }
+  // Lines are consumed front to back, so the kernel can read ahead aggressively.
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  data = static_cast<const char *>(mapping);
+}
+
+MappedLines::~MappedLines() {
+  if (data) {
+    munmap(const_cast<char *>(data), size);
+  }
+}
+
+bool MappedLines::read_line(std::string_view *line) {
+  if (position >= size) {
+    return false;
+  }
+
+  const char *begin = data + position;
+  const char *newline = static_cast<const char *>(memchr(begin, '\n', size - position));
+  // A last line without a trailing newline still counts.
+  size_t length = newline ? newline - begin : size - position;
+  *line = std::string_view(begin, length);
+  position += length + 1;
+  return true;
+}
+
+bool MappedLines::eof() const {
+  return position >= size;
+}
+
+OutputWriter::OutputWriter(int fd) : fd(fd), buffer() {
+  buffer.reserve(WRITE_BUFFER_SIZE);
+}
+
+void OutputWriter::write(std::string_view text) {
+  if (buffer.size() + text.size() > WRITE_BUFFER_SIZE) {
+    flush();
+  }
+  buffer.insert(buffer.end(), text.begin(), text.end());
+}
+
+void OutputWriter::flush() {
+  const char *next = buffer.data();
+  size_t remaining = buffer.size();
+  while (remaining > 0) {
+    ssize_t n = ::write(fd, next, remaining);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("Failed to write file: ") + strerror(errno));
+    }
+    next += n;
+    remaining -= n;
+  }
+  buffer.clear();
+}
+
+FileTable::~FileTable() {
+  for (size_t i = 0; i < files.size(); i++) {
+    if (files[i].fd >= 0) {
+      try {
+        close(i);
+      } catch (const std::exception &) {
+        // Nothing can be reported while the interpreter shuts down.
+      }
+    }
+  }
+}
+
+FileTable::File &FileTable::find(int handle) {
+  if (handle < 0 || static_cast<size_t>(handle) >= files.size() || files[handle].fd < 0) {
+    throw std::runtime_error("Invalid file handle: " + std::to_string(handle));
+  }
+  return files[handle];
+}
+
+int FileTable::add(File file) {
+  files.push_back(std::move(file));
+  return files.size() - 1;
+}
+
+int FileTable::open_read(const std::string &path) {
+  int fd = open_file(path, O_RDONLY);
+  return add({fd, new InputReader(fd), "", nullptr, nullptr});
+}
+
+int FileTable::open_lines(const std::string &path) {
+  int fd = open_file(path, O_RDONLY);
+  MappedLines *lines;
+  try {
+    lines = new MappedLines(fd);
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  return add({fd, nullptr, "", lines, nullptr});
+}
+
+int FileTable::open_write(const std::string &path) {
+  int fd = open_file(path, O_WRONLY | O_CREAT | O_TRUNC);
+  return add({fd, nullptr, "", nullptr, new OutputWriter(fd)});
+}
+
+bool FileTable::read_line(int handle, std::string_view *line) {
+  File &file = find(handle);
+  if (file.lines) {
+    return file.lines->read_line(line);
+  } else if (file.reader) {
+    bool read = file.reader->read_line(&file.line);
+    *line = file.line;
+    return read;
+  }
+  throw std::runtime_error("File " + std::to_string(handle) + " is not open for reading");
+}
+
+bool FileTable::eof(int handle) {
+  File &file = find(handle);
+  if (file.lines) {
+    return file.lines->eof();
+  } else if (file.reader) {
+    return file.reader->eof();
+  }
+  throw std::runtime_error("File " + std::to_string(handle) + " is not open for reading");
+}
+
+void FileTable::write(int handle, std::string_view text) {
+  File &file = find(handle);
+  if (!file.writer) {
+    throw std::runtime_error("File " + std::to_string(handle) + " is not open for writing");
+  }
+  file.writer->write(text);
+}
+
+void FileTable::close(int handle) {
+  File &file = find(handle);
+  int fd = file.fd;
+  file.fd = -1;
+
+  OutputWriter *writer = file.writer;
+  bool written = writer != nullptr;
+  delete file.reader;
+  delete file.lines;
+  file.reader = nullptr;
+  file.lines = nullptr;
+  file.writer = nullptr;
+  file.line.clear();
+  file.line.shrink_to_fit();
+
+  try {
+    if (writer) {
+      writer->flush();
+    }
+  } catch (...) {
+    delete writer;
+    ::close(fd);
+    throw;
+  }
+  delete writer;
+  // Write errors can surface when closing, read-only files have nothing to lose.
+  if (::close(fd) != 0 && written) {
+    throw std::runtime_error(std::string("Failed to close file: ") + strerror(errno));
+  }
+}
+
+bool FileTable::any_open() const {
+  for (const File &file : files) {
+    if (file.fd >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,152 @@
+#include "../include/format.h"
+#include <stdexcept>
+
+/**
+ * A parsed `{:...}` specifier.
+ */
+struct FormatSpec {
+  char fill = ' ';
+  char align = 0;     ///< '<', '>' or '^', 0 for the default of the value's type.
+  bool zero = false;  ///< Pad numbers with zeros after the sign.
+  size_t width = 0;
+  int precision = -1; ///< -1 when none was given.
+};
+
+/**
+ * Reads a decimal number from a specifier.
+ * @param at Position of the first digit, moved past the last one.
+ */
+static size_t read_number(const std::string &pattern, size_t *at) {
+  size_t number = 0;
+  while (*at < pattern.size() && pattern[*at] >= '0' && pattern[*at] <= '9') {
+    number = number * 10 + (pattern[*at] - '0');
+    if (number > 1000) {
+      throw std::runtime_error("Format width or precision too large: " + pattern);
+    }
+    (*at)++;
+  }
+  return number;
+}
+
+static bool is_align(char c) {
+  return c == '<' || c == '>' || c == '^';
+}
+
+/**
+ * Parses the specifier between a placeholder's ':' and its closing brace.
+ * @param at Position just after the ':', moved to the closing brace.
+ */
+static FormatSpec parse_spec(const std::string &pattern, size_t *at) {
+  FormatSpec spec;
+  size_t i = *at;
+  if (i + 1 < pattern.size() && is_align(pattern[i + 1]) && pattern[i] != '}') {
+    spec.fill = pattern[i];
+    spec.align = pattern[i + 1];
+    i += 2;
+  } else if (i < pattern.size() && is_align(pattern[i])) {
+    spec.align = pattern[i++];
+  }
+  if (i < pattern.size() && pattern[i] == '0') {
+    spec.zero = true;
+    i++;
+  }
+  spec.width = read_number(pattern, &i);
+  if (i < pattern.size() && pattern[i] == '.') {
+    i++;
+    if (i >= pattern.size() || pattern[i] < '0' || pattern[i] > '9') {
+      throw std::runtime_error("Invalid format specifier: " + pattern);
+    }
+    spec.precision = static_cast<int>(read_number(pattern, &i));
+  }
+  if (i >= pattern.size() || pattern[i] != '}') {
+    throw std::runtime_error("Invalid format specifier: " + pattern);
+  }
+  *at = i;
+  return spec;
+}
+
+/**
+ * Appends one value according to its specifier, padding it in place.
+ */
+static void append_value(const FormatSpec &spec, const Value *value, std::string *out) {
+  size_t start = out->size();
+  bool number = value->type == TYPE_INT || value->type == TYPE_FLOAT;
+  if (spec.precision >= 0 && value->type == TYPE_FLOAT) {
+    append_float(out, static_cast<const FloatValue *>(value)->value, spec.precision);
+  } else if (spec.precision >= 0 && value->type == TYPE_STRING) {
+    const std::string &text = static_cast<const StringValue *>(value)->value;
+    out->append(text, 0, spec.precision);
+  } else if (spec.precision >= 0) {
+    throw std::runtime_error("Format precision needs a float or a string, got '" + value->get_type() + "'");
+  } else {
+    append_text(out, value);
+  }
+
+  size_t length = out->size() - start;
+  if (length >= spec.width) {
+    return;
+  }
+  size_t padding = spec.width - length;
+  if (spec.zero && number && !spec.align) {
+    out->insert(start + ((*out)[start] == '-' ? 1 : 0), padding, '0');
+    return;
+  }
+  switch (spec.align ? spec.align : number ? '>' : '<') {
+  case '<':
+    out->append(padding, spec.fill);
+    break;
+  case '>':
+    out->insert(start, padding, spec.fill);
+    break;
+  default:
+    out->insert(start, padding / 2, spec.fill);
+    out->append(padding - padding / 2, spec.fill);
+  }
+}
+
+void format_values(const std::string &pattern, Value *const *values, size_t count, std::string *out) {
+  // Reserving for the template, the strings and a typical number each keeps
+  // the buffer from growing while it is written.
+  size_t estimate = out->size() + pattern.size();
+  for (size_t i = 0; i < count; i++) {
+    estimate += values[i]->type == TYPE_STRING ? static_cast<const StringValue *>(values[i])->value.size() : 24;
+  }
+  out->reserve(estimate);
+
+  size_t used = 0;
+  size_t literal = 0; ///< Start of the text not yet copied.
+  for (size_t i = 0; i < pattern.size(); i++) {
+    char c = pattern[i];
+    if (c != '{' && c != '}') {
+      continue;
+    }
+    out->append(pattern, literal, i - literal);
+    if (i + 1 < pattern.size() && pattern[i + 1] == c) {
+      out->push_back(c);
+      literal = ++i + 1;
+      continue;
+    } else if (c == '}') {
+      throw std::runtime_error("Unmatched '}' in format string: " + pattern);
+    }
+
+    FormatSpec spec;
+    if (i + 1 < pattern.size() && pattern[i + 1] == ':') {
+      i += 2;
+      spec = parse_spec(pattern, &i);
+    } else if (i + 1 < pattern.size() && pattern[i + 1] == '}') {
+      i++;
+    } else {
+      throw std::runtime_error("Unmatched '{' in format string: " + pattern);
+    }
+    if (used == count) {
+      throw std::runtime_error("Too few values for format string: " + pattern);
+    }
+    append_value(spec, values[used++], out);
+    literal = i + 1;
+  }
+  out->append(pattern, literal, std::string::npos);
+
+  if (used != count) {
+    throw std::runtime_error("Too many values for format string: " + pattern);
+  }
+}
@@ -0,0 +1,501 @@
+#include "../include/inference.h"
+
+/**
+ * Finds the innermost entry for a variable.
+ * @return Pointer to its type, or nullptr if no analyzed scope declares it.
+ */
+static VariableType *find(TypeScopes *scopes, const std::string &identifier) {
+  for (size_t i = scopes->size(); i-- > 0;) {
+    auto found = (*scopes)[i].find(identifier);
+    if (found != (*scopes)[i].end()) {
+      return &found->second;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Joins the variable types of two paths that meet. A variable only one path
+ * declared may refer to different variables afterwards, so it is untyped.
+ */
+static TypeScopes join_scopes(const TypeScopes &a, const TypeScopes &b) {
+  TypeScopes joined = a;
+  for (size_t i = 0; i < joined.size() && i < b.size(); i++) {
+    for (auto &entry : joined[i]) {
+      auto other = b[i].find(entry.first);
+      if (other == b[i].end()) {
+        entry.second = {TYPE_ANY, false};
+      } else {
+        entry.second = {TypeInference::join(entry.second.type, other->second.type),
+                        entry.second.declared && other->second == entry.second};
+      }
+    }
+    for (const auto &entry : b[i]) {
+      joined[i].emplace(entry.first, VariableType{TYPE_ANY, false});
+    }
+  }
+  return joined;
+}
+
+/**
+ * Records the type a statement gives a variable, unless the variable's type is
+ * declared: storing a value of another type converts it or fails at run time.
+ */
+static void assign_type(TypeScopes *scopes, const std::string &identifier, ValueType type) {
+  VariableType *found = find(scopes, identifier);
+  if (found && !found->declared) {
+    found->type = type;
+  }
+}
+
+static bool is_number(ValueType type) {
+  return type == TYPE_INT || type == TYPE_FLOAT;
+}
+
+/**
+ * Computes the type a unary operator gives, mirroring apply_operator.
+ */
+static ValueType unary_type(TokenType op, ValueType child) {
+  if (child == TYPE_NONE || child == TYPE_ANY) {
+    return child;
+  }
+  switch (op) {
+  case NOT:
+    return child == TYPE_BOOL ? TYPE_BOOL : TYPE_ANY;
+  case INCREMENT:
+  case DECREMENT:
+    // Incrementing a float gives an int.
+    return is_number(child) ? TYPE_INT : TYPE_ANY;
+  case RETURN:
+    return child == TYPE_INT || child == TYPE_FLOAT || child == TYPE_BOOL ? child : TYPE_ANY;
+  default:
+    return TYPE_ANY;
+  }
+}
+
+TypeInference::TypeInference(Analyzer *analyzer)
+    : analyzer(analyzer), parameters(), returns(), types(), assignments(), changed(false) {}
+
+void TypeInference::assume_call(const std::string &identifier, const std::vector<ValueType> &arguments) {
+  auto defs = analyzer->definitions().find(identifier);
+  if (defs == analyzer->definitions().end()) {
+    return;
+  }
+  for (FunctionNode *def : defs->second) {
+    if (def->parameters.size() == arguments.size()) {
+      parameters[def] = arguments;
+    }
+  }
+}
+
+ValueType TypeInference::join(ValueType a, ValueType b) {
+  if (a == TYPE_NONE) {
+    return b;
+  } else if (b == TYPE_NONE || a == b) {
+    return a;
+  }
+  return TYPE_ANY;
+}
+
+ValueType TypeInference::binary_type(TokenType op, ValueType left, ValueType right) {
+  // Assignment copies the right-hand value, whatever the variable held, except
+  // that void values cannot be copied.
+  if (op == ASSIGN) {
+    return right == TYPE_VOID ? TYPE_ANY : right;
+  } else if (left == TYPE_NONE || right == TYPE_NONE) {
+    return TYPE_NONE;
+  } else if (left == TYPE_ANY || right == TYPE_ANY) {
+    return TYPE_ANY;
+  }
+
+  switch (op) {
+  case ADD:
+  case ASSIGN_ADD:
+    if (left == TYPE_STRING) {
+      return TYPE_STRING;
+    }
+    [[fallthrough]];
+  case SUBTRACT:
+  case MULTIPLY:
+  case DIVIDE:
+  case MODULO:
+  case ASSIGN_SUBTRACT:
+  case ASSIGN_MULTIPLY:
+  case ASSIGN_DIVIDE:
+  case ASSIGN_MODULO:
+    if (!is_number(left) || !is_number(right)) {
+      return TYPE_ANY;
+    } else if (left == TYPE_INT && right == TYPE_INT) {
+      return TYPE_INT;
+    } else if (op == MODULO || op == ASSIGN_MODULO) {
+      return TYPE_ANY;
+    } else if (left == TYPE_FLOAT && right == TYPE_FLOAT && op != ADD && op != ASSIGN_ADD) {
+      // Two floats only stay a float when added, apply_operator makes everything else an int.
+      return TYPE_INT;
+    }
+    return TYPE_FLOAT;
+
+  case LESS_THAN:
+  case GREATER_THAN:
+  case LESS_THAN_OR_EQUAL:
+  case GREATER_THAN_OR_EQUAL:
+    return (is_number(left) && is_number(right)) || (left == TYPE_BOOL && right == TYPE_BOOL) ? TYPE_BOOL : TYPE_ANY;
+
+  case EQUAL:
+  case NOT_EQUAL:
+    return (is_number(left) && is_number(right)) || (left == TYPE_BOOL && right == TYPE_BOOL) || left == TYPE_STRING
+               ? TYPE_BOOL
+               : TYPE_ANY;
+
+  case AND:
+  case OR:
+    return left == TYPE_BOOL && right == TYPE_BOOL ? TYPE_BOOL : TYPE_ANY;
+
+  default:
+    return TYPE_ANY;
+  }
+}
+
+ValueType TypeInference::expression(Node *node, TypeScopes *scopes) {
+  if (!node) {
+    return TYPE_ANY;
+  }
+
+  ValueType type = TYPE_ANY;
+  if (auto *tn = dynamic_cast<TerminalNode *>(node)) {
+    type = tn->v->type;
+
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    // Variables declared outside the analyzed code belong to whoever called it.
+    VariableType *found = vn->is_definition ? nullptr : find(scopes, vn->identifier.value);
+    type = found ? found->type : TYPE_ANY;
+
+  } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    type = unary_type(un->token.type, expression(un->child, scopes));
+
+  } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    ValueType left = expression(bnn->left, scopes);
+    ValueType right = expression(bnn->right, scopes);
+    type = binary_type(bnn->token.type, left, right);
+
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    if (fnn->is_definition) {
+      return TYPE_ANY;
+    }
+    std::vector<ValueType> arguments;
+    for (Node *p : fnn->parameters) {
+      arguments.push_back(expression(p, scopes));
+    }
+
+    const std::string &identifier = fnn->identifier.value;
+    if (analyzer->calls_builtin(identifier)) {
+      if (identifier == "eof" && arguments.size() <= 1) {
+        type = TYPE_BOOL;
+      } else if (identifier == "open_read" || identifier == "lines" || identifier == "open_write") {
+        type = TYPE_INT;
+      } else if (identifier == "write" || identifier == "close" || identifier == "checkpoint") {
+        type = TYPE_VOID;
+      } else if (identifier == "output" && arguments.size() == 1) {
+        type = TYPE_VOID;
+      } else if (identifier == "format" && !arguments.empty()) {
+        type = TYPE_STRING;
+      } else if (identifier == "rand" && arguments.size() == 1 && arguments[0] == TYPE_INT) {
+        type = TYPE_INT;
+      } else if (identifier == "rand_float" && arguments.empty()) {
+        type = TYPE_FLOAT;
+      } else if (identifier == "seed" || identifier == "rand_fill" || identifier == "set" || identifier == "scale" ||
+                 identifier == "add" || identifier == "sort" || identifier == "prefix_sum") {
+        type = TYPE_VOID;
+      } else if (identifier == "len" || identifier == "count_if_gt" || identifier == "fields") {
+        type = TYPE_INT;
+      } else if (identifier == "array") {
+        type = TYPE_ARRAY;
+      }
+    } else {
+      auto defs = analyzer->definitions().find(identifier);
+      if (defs != analyzer->definitions().end()) {
+        for (FunctionNode *def : defs->second) {
+          if (def->parameters.size() != arguments.size()) {
+            continue;
+          }
+          std::vector<ValueType> &joined = parameters[def];
+          joined.resize(arguments.size(), TYPE_NONE);
+          for (size_t i = 0; i < arguments.size(); i++) {
+            ValueType next = join(joined[i], arguments[i]);
+            changed |= next != joined[i];
+            joined[i] = next;
+          }
+        }
+        auto returned = returns.find(identifier);
+        type = returned != returns.end() ? returned->second : TYPE_NONE;
+      }
+
+      // The callee can assign any variable it does not declare itself.
+      for (const std::string &name : analyzer->effects(fnn).writes) {
+        assign_type(scopes, name, TYPE_ANY);
+      }
+    }
+  }
+
+  types[node] = type;
+  return type;
+}
+
+void TypeInference::statement(Node *node, TypeScopes *scopes) {
+  if (!node) {
+    return;
+  }
+
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    for (Node *s : bn->statements) {
+      statement(s, scopes);
+    }
+
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    if (!vn->is_definition) {
+      expression(vn, scopes);
+      return;
+    }
+    VariableNode *variable;
+    ValueType type = TYPE_VOID;
+    if (auto *assign = dynamic_cast<BinaryNode *>(vn->initializer)) {
+      variable = dynamic_cast<VariableNode *>(assign->left);
+      type = expression(assign->right, scopes);
+    } else {
+      variable = dynamic_cast<VariableNode *>(vn->initializer);
+    }
+    if (variable && variable->annotation != TYPE_ANY) {
+      scopes->back()[variable->identifier.value] = {variable->annotation, true};
+    } else if (variable) {
+      scopes->back()[variable->identifier.value] = {type, false};
+    }
+
+  } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    // Returns below the top level of a function body do nothing, and other
+    // unary statements only run when they can store their result.
+    auto *variable = dynamic_cast<VariableNode *>(un->child);
+    if (un->token.type != RETURN && variable) {
+      assign_type(scopes, variable->identifier.value, expression(un, scopes));
+    }
+
+  } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    auto *variable = dynamic_cast<VariableNode *>(bnn->left);
+    if (!is_assign(bnn->token.type) || !variable) {
+      expression(bnn, scopes);
+      return;
+    }
+
+    // The variable is read before the right-hand side runs.
+    VariableType *found = find(scopes, variable->identifier.value);
+    ValueType left = found ? found->type : TYPE_ANY;
+    types[variable] = left;
+    ValueType type = binary_type(bnn->token.type, left, expression(bnn->right, scopes));
+    types[bnn] = type;
+    assignments.insert(bnn);
+    assign_type(scopes, variable->identifier.value, type);
+
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    expression(in->condition, scopes);
+    TypeScopes true_scopes = *scopes;
+    true_scopes.push_back({});
+    statement(in->true_body, &true_scopes);
+    true_scopes.pop_back();
+    // Inlined calls are wrapped in `if (true)`, whose body always runs.
+    auto *constant = dynamic_cast<TerminalNode *>(in->condition);
+    auto *always = constant ? dynamic_cast<BoolValue *>(constant->v) : nullptr;
+    if (always && always->value && !in->false_body) {
+      *scopes = true_scopes;
+      return;
+    }
+    TypeScopes false_scopes = *scopes;
+    false_scopes.push_back({});
+    statement(in->false_body, &false_scopes);
+    false_scopes.pop_back();
+    *scopes = join_scopes(true_scopes, false_scopes);
+
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    scopes->push_back({});
+    loop(wn->condition, wn->body, nullptr, scopes);
+    scopes->pop_back();
+
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    scopes->push_back({});
+    statement(fn->initialization, scopes);
+    loop(fn->condition, fn->body, fn->update, scopes);
+    scopes->pop_back();
+
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    // Definitions are analyzed on their own, with the types they are called with.
+    if (!fnn->is_definition) {
+      expression(fnn, scopes);
+    }
+  }
+}
+
+void TypeInference::loop(Node *condition, Node *body, Node *update, TypeScopes *scopes) {
+  TypeScopes head = *scopes;
+  while (true) {
+    TypeScopes state = head;
+    expression(condition, &state);
+    TypeScopes exit = state;
+    statement(body, &state);
+    statement(update, &state);
+
+    // The types recorded by the last pass hold for every iteration.
+    TypeScopes next = join_scopes(head, state);
+    if (next == head) {
+      *scopes = exit;
+      return;
+    }
+    head = next;
+  }
+}
+
+ValueType TypeInference::function_body(FunctionNode *def) {
+  TypeScopes scopes(1);
+  auto called = parameters.find(def);
+  for (size_t i = 0; i < def->parameters.size(); i++) {
+    auto *parameter = dynamic_cast<VariableNode *>(def->parameters[i]);
+    if (parameter && parameter->annotation != TYPE_ANY) {
+      scopes[0][parameter->identifier.value] = {parameter->annotation, true};
+    } else if (parameter) {
+      bool known = called != parameters.end() && i < called->second.size();
+      scopes[0][parameter->identifier.value] = {known ? called->second[i] : TYPE_NONE, false};
+    }
+  }
+
+  // Only a return at the top level of the body ends the call.
+  ValueType returned = TYPE_VOID;
+  for (Node *s : def->body->statements) {
+    auto *un = dynamic_cast<UnaryNode *>(s);
+    if (un && un->token.type == RETURN) {
+      returned = expression(un, &scopes);
+      break;
+    }
+    statement(s, &scopes);
+  }
+  // Whatever the body returns is checked against a declared return type.
+  return def->return_type != TYPE_ANY ? def->return_type : returned;
+}
+
+void TypeInference::run(BlockNode *root) {
+  // Parameter and return types only ever grow, so this reaches a fixed point.
+  do {
+    changed = false;
+    types.clear();
+    assignments.clear();
+
+    TypeScopes scopes(1);
+    statement(root, &scopes);
+    for (const auto &entry : analyzer->definitions()) {
+      for (FunctionNode *def : entry.second) {
+        ValueType &returned = returns.emplace(entry.first, TYPE_NONE).first->second;
+        ValueType next = join(returned, function_body(def));
+        changed |= next != returned;
+        returned = next;
+      }
+    }
+  } while (changed);
+
+  for (Node *&s : root->statements) {
+    s = rewrite(s, true);
+  }
+}
+
+Node *TypeInference::rewrite(Node *node, bool statement) {
+  if (!node) {
+    return node;
+  }
+
+  auto type_of = [this](Node *n) {
+    auto found = types.find(n);
+    return found != types.end() ? found->second : TYPE_ANY;
+  };
+
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    for (Node *&s : bn->statements) {
+      s = rewrite(s, true);
+    }
+
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    if (vn->is_definition) {
+      if (auto *assign = dynamic_cast<BinaryNode *>(vn->initializer)) {
+        assign->right = rewrite(assign->right, false);
+      }
+      return node;
+    }
+    ValueType type = type_of(vn);
+    if (!vn->initializer && type < TYPE_VOID) {
+      Node *typed = new TypedVariableNode(vn->identifier, type);
+      typed->line = vn->line;
+      delete vn;
+      return typed;
+    }
+
+  } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    un->child = rewrite(un->child, false);
+    // The result of an inlined call is returned as it is when its type is known.
+    if (!statement && un->token.type == RETURN && type_of(un) != TYPE_ANY && type_of(un) != TYPE_NONE) {
+      Node *child = un->child;
+      un->child = nullptr;
+      delete un;
+      return child;
+    }
+
+  } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    TokenType op = bnn->token.type;
+    ValueType left = type_of(bnn->left);
+    ValueType right = type_of(bnn->right);
+    ValueType type = type_of(bnn);
+    bool assignment = statement && assignments.count(bnn);
+
+    // A plain assignment does not read its variable.
+    if (!(assignment && op == ASSIGN)) {
+      bnn->left = rewrite(bnn->left, false);
+    }
+    bnn->right = rewrite(bnn->right, false);
+
+    bool specialize;
+    if (assignment && op == ASSIGN) {
+      specialize = is_number(right);
+    } else if (is_assign(op) && !assignment) {
+      specialize = false;
+    } else {
+      specialize = is_number(left) && is_number(right) && (is_number(type) || type == TYPE_BOOL);
+    }
+    if (specialize) {
+      Node *typed = new TypedBinaryNode(bnn->token, bnn->left, bnn->right, left, right, type);
+      typed->line = bnn->line;
+      bnn->left = nullptr;
+      bnn->right = nullptr;
+      delete bnn;
+      return typed;
+    }
+
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    in->condition = rewrite(in->condition, false);
+    in->true_body = rewrite(in->true_body, true);
+    in->false_body = rewrite(in->false_body, true);
+
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    wn->condition = rewrite(wn->condition, false);
+    rewrite(wn->body, true);
+
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    fn->initialization = rewrite(fn->initialization, true);
+    fn->condition = rewrite(fn->condition, false);
+    fn->update = rewrite(fn->update, true);
+    rewrite(fn->body, true);
+
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    if (fnn->is_definition) {
+      rewrite(fnn->body, true);
+    } else {
+      for (Node *&p : fnn->parameters) {
+        p = rewrite(p, false);
+      }
+    }
+  }
+
+  return node;
+}
@@ -0,0 +1,581 @@
+#include "../include/inliner.h"
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+
+/**
+ * Calls a function for a node and every node under it, including the
+ * parameters and bodies of function definitions.
+ */
+static void for_each_node(Node *node, const std::function<void(Node *)> &f) {
+  if (!node) {
+    return;
+  }
+  f(node);
+
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    for (Node *s : bn->statements) {
+      for_each_node(s, f);
+    }
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    for_each_node(vn->initializer, f);
+  } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    for_each_node(un->child, f);
+  } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    for_each_node(bnn->left, f);
+    for_each_node(bnn->right, f);
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    for (Node *p : fnn->parameters) {
+      for_each_node(p, f);
+    }
+    for_each_node(fnn->body, f);
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    for_each_node(in->condition, f);
+    for_each_node(in->true_body, f);
+    for_each_node(in->false_body, f);
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    for_each_node(wn->condition, f);
+    for_each_node(wn->body, f);
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    for_each_node(fn->initialization, f);
+    for_each_node(fn->condition, f);
+    for_each_node(fn->update, f);
+    for_each_node(fn->body, f);
+  }
+}
+
+/**
+ * Finds the variable a declaration declares.
+ * @return The variable, or nullptr if the node is not a declaration.
+ */
+static VariableNode *declared_variable(Node *node) {
+  auto *vn = dynamic_cast<VariableNode *>(node);
+  if (!vn || !vn->is_definition) {
+    return nullptr;
+  }
+  auto *assign = dynamic_cast<BinaryNode *>(vn->initializer);
+  return dynamic_cast<VariableNode *>(assign ? assign->left : vn->initializer);
+}
+
+static bool is_declared(const std::vector<std::set<std::string>> &declared, const std::string &identifier) {
+  for (const std::set<std::string> &scope : declared) {
+    if (scope.count(identifier)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Makes an identifier token for a name the inliner made up.
+ */
+static Token name_token(const std::string &name, int line) {
+  return {IDENTIFIER, name, line, symbols.intern(name)};
+}
+
+/**
+ * Copies a statement or expression of a function body, renaming its locals.
+ * @param renames New name of each renamed variable.
+ */
+static Node *clone(Node *node, const std::map<std::string, std::string> &renames) {
+  if (!node) {
+    return nullptr;
+  }
+
+  Node *copy;
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    std::vector<Node *> statements;
+    for (Node *s : bn->statements) {
+      statements.push_back(clone(s, renames));
+    }
+    copy = new BlockNode(statements);
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    Token identifier = vn->identifier;
+    auto renamed = renames.find(identifier.value);
+    if (renamed != renames.end()) {
+      identifier = name_token(renamed->second, identifier.line);
+    }
+    auto *variable = new VariableNode(identifier, clone(vn->initializer, renames), vn->is_definition);
+    variable->annotation = vn->annotation;
+    copy = variable;
+  } else if (auto *tn = dynamic_cast<TerminalNode *>(node)) {
+    // Bodies were checked to hold only these kinds of literals.
+    Value *v = tn->v;
+    if (auto *i = dynamic_cast<IntValue *>(v)) {
+      copy = new TerminalNode(new IntValue(i->value));
+    } else if (auto *f = dynamic_cast<FloatValue *>(v)) {
+      copy = new TerminalNode(new FloatValue(f->value));
+    } else if (auto *b = dynamic_cast<BoolValue *>(v)) {
+      copy = new TerminalNode(new BoolValue(b->value));
+    } else {
+      auto *s = static_cast<StringValue *>(v);
+      copy = new TerminalNode(new StringValue(s->value, s->symbol));
+    }
+  } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    copy = new UnaryNode(un->token, clone(un->child, renames));
+  } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    copy = new BinaryNode(bnn->token, clone(bnn->left, renames), clone(bnn->right, renames));
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    std::vector<Node *> parameters;
+    for (Node *p : fnn->parameters) {
+      parameters.push_back(clone(p, renames));
+    }
+    copy = new FunctionNode(fnn->identifier, parameters, nullptr, false);
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    copy = new IfNode(clone(in->condition, renames), clone(in->true_body, renames), clone(in->false_body, renames));
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    copy = new WhileNode(clone(wn->condition, renames), static_cast<BlockNode *>(clone(wn->body, renames)));
+  } else {
+    auto *fn = static_cast<ForNode *>(node);
+    copy = new ForNode(clone(fn->initialization, renames), clone(fn->condition, renames), clone(fn->update, renames),
+                       static_cast<BlockNode *>(clone(fn->body, renames)));
+  }
+  copy->line = node->line;
+  return copy;
+}
+
+Inliner::Inliner(BlockNode *root, std::map<int, uint64_t> profile)
+    : analyzer(root), profile(std::move(profile)), candidates(), sites(), globals(), log() {
+  find_candidates(root);
+}
+
+void Inliner::count_sites(Node *node) {
+  for_each_node(node, [this](Node *n) {
+    auto *fnn = dynamic_cast<FunctionNode *>(n);
+    if (fnn && !fnn->is_definition) {
+      sites[fnn->identifier.value]++;
+    }
+  });
+}
+
+void Inliner::find_candidates(BlockNode *root) {
+  count_sites(root);
+
+  // A function can only be inlined where its definition is certainly the one
+  // a call finds, so it must be defined before the program calls anything.
+  bool calling = false;
+  for (Node *s : root->statements) {
+    auto *def = dynamic_cast<FunctionNode *>(s);
+    if ((!def || !def->is_definition) && !calling) {
+      for (const std::string &callee : analyzer.effects(s).calls) {
+        calling |= !analyzer.calls_builtin(callee);
+      }
+      if (VariableNode *variable = declared_variable(s); variable && !calling) {
+        globals.insert(variable->identifier.value);
+      }
+      continue;
+    } else if (!def || !def->is_definition) {
+      continue;
+    } else if (!def->body || !sites.count(def->identifier.value)) {
+      continue;
+    }
+
+    const std::string &name = def->identifier.value;
+    const Effects &effects = analyzer.call_effects(name);
+    std::string reason;
+    if (calling) {
+      reason = "it is defined after the program starts calling functions";
+    } else if (analyzer.definitions().at(name).size() > 1) {
+      reason = "it is defined more than once";
+    } else if (def->is_pure) {
+      reason = "it is pure, so its results are cached";
+    } else if (def->return_type != TYPE_ANY) {
+      reason = "its return type is declared";
+    } else if (effects.calls.count(name)) {
+      reason = "it is recursive";
+    } else if (effects.unknown_calls) {
+      reason = "it calls a function that is not defined";
+    } else {
+      Candidate candidate;
+      reason = check_body(def, &candidate);
+      if (reason.empty()) {
+        candidates.emplace(name, candidate);
+        continue;
+      }
+    }
+    log.push_back("Not inlining '" + name + "': " + reason);
+  }
+}
+
+std::string Inliner::check_body(FunctionNode *def, Candidate *candidate) {
+  candidate->def = def;
+  candidate->size = 0;
+  candidate->returns = false;
+
+  std::set<std::string> seen;
+  for (Node *p : def->parameters) {
+    auto *parameter = dynamic_cast<VariableNode *>(p);
+    if (!parameter) {
+      return "a parameter is not a name";
+    } else if (parameter->annotation != TYPE_ANY) {
+      return "parameter '" + parameter->identifier.value + "' is annotated";
+    }
+    seen.insert(parameter->identifier.value);
+  }
+  candidate->locals = seen;
+  const std::vector<Node *> &statements = def->body->statements;
+  for (Node *s : statements) {
+    if (VariableNode *variable = declared_variable(s)) {
+      candidate->locals.insert(variable->identifier.value);
+    }
+  }
+
+  std::string reason;
+  for (size_t k = 0; k < statements.size() && reason.empty(); k++) {
+    Node *s = statements[k];
+    auto *un = dynamic_cast<UnaryNode *>(s);
+    if (un && un->token.type == RETURN) {
+      auto *assign = dynamic_cast<BinaryNode *>(un->child);
+      if (k + 1 < statements.size()) {
+        return "it returns before its last statement";
+      } else if (assign && is_assign(assign->token.type)) {
+        return "it returns an assignment";
+      }
+      candidate->returns = true;
+    }
+
+    // A local read before its declaration is the caller's variable, which
+    // the renamed copy could not see.
+    VariableNode *declared = declared_variable(s);
+    auto *assign = declared ? dynamic_cast<BinaryNode *>(static_cast<VariableNode *>(s)->initializer) : nullptr;
+    for_each_node(declared ? (assign ? assign->right : nullptr) : s, [&](Node *n) {
+      VariableNode *variable = declared_variable(n);
+      auto *vn = dynamic_cast<VariableNode *>(n);
+      variable = variable ? variable : vn;
+      if (reason.empty() && variable && candidate->locals.count(variable->identifier.value) &&
+          !seen.count(variable->identifier.value)) {
+        reason = "it uses '" + variable->identifier.value + "' before declaring it";
+      }
+    });
+    if (declared) {
+      seen.insert(declared->identifier.value);
+    }
+  }
+
+  for_each_node(def->body, [&](Node *n) {
+    candidate->size++;
+    if (!reason.empty()) {
+      return;
+    }
+    auto *fnn = dynamic_cast<FunctionNode *>(n);
+    auto *tn = dynamic_cast<TerminalNode *>(n);
+    if (fnn && fnn->is_definition) {
+      reason = "it defines function '" + fnn->identifier.value + "'";
+    } else if (fnn && fnn->identifier.value == "checkpoint") {
+      reason = "it calls checkpoint()";
+    } else if (fnn && !analyzer.calls_builtin(fnn->identifier.value)) {
+      // A callee sees the variables of the function through dynamic scoping.
+      const Effects &callee = analyzer.call_effects(fnn->identifier.value);
+      for (const std::string &local : candidate->locals) {
+        if (callee.reads.count(local) || callee.writes.count(local)) {
+          reason = "it calls '" + fnn->identifier.value + "', which uses its variable '" + local + "'";
+          break;
+        }
+      }
+    } else if (tn && tn->v->type != TYPE_INT && tn->v->type != TYPE_FLOAT && tn->v->type != TYPE_BOOL &&
+               tn->v->type != TYPE_STRING) {
+      reason = "it uses a " + tn->v->get_type() + " literal";
+    }
+  });
+  return reason;
+}
+
+void Inliner::inline_calls(BlockNode *root) {
+  if (candidates.empty()) {
+    return;
+  }
+  std::vector<std::set<std::string>> declared(1);
+  inline_block(root, &declared, 0, false);
+}
+
+void Inliner::inline_block(BlockNode *block, std::vector<std::set<std::string>> *declared, int loops,
+                           bool function_body) {
+  std::vector<Node *> statements;
+  for (Node *s : block->statements) {
+    VariableNode *variable = declared_variable(s);
+    std::string name = variable ? variable->identifier.value : "";
+    inline_nested(s, declared, loops);
+    inline_statement(s, *declared, loops, function_body, &statements);
+    if (variable) {
+      declared->back().insert(name);
+    }
+  }
+  block->statements = std::move(statements);
+}
+
+void Inliner::inline_nested(Node *node, std::vector<std::set<std::string>> *declared, int loops) {
+  if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    // Pure functions must keep calling only pure functions, which are never inlined.
+    if (!fnn->is_definition || !fnn->body || fnn->is_pure) {
+      return;
+    }
+    // A body only runs once the program calls something, after the globals
+    // declared before that.
+    std::vector<std::set<std::string>> scopes = {globals, {}};
+    for (Node *p : fnn->parameters) {
+      if (auto *parameter = dynamic_cast<VariableNode *>(p)) {
+        scopes.back().insert(parameter->identifier.value);
+      }
+    }
+    inline_block(fnn->body, &scopes, 0, true);
+
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    declared->push_back({});
+    if (auto *bn = dynamic_cast<BlockNode *>(in->true_body)) {
+      inline_block(bn, declared, loops, false);
+    }
+    declared->back().clear();
+    if (auto *bn = dynamic_cast<BlockNode *>(in->false_body)) {
+      inline_block(bn, declared, loops, false);
+    } else if (auto *else_if = dynamic_cast<IfNode *>(in->false_body)) {
+      inline_nested(else_if, declared, loops);
+      std::vector<Node *> replacement;
+      inline_statement(else_if, *declared, loops, false, &replacement);
+      in->false_body = replacement[0];
+    }
+    declared->pop_back();
+
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    declared->push_back({});
+    inline_block(wn->body, declared, loops + 1, false);
+    declared->pop_back();
+
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    declared->push_back({});
+    if (VariableNode *variable = declared_variable(fn->initialization)) {
+      declared->back().insert(variable->identifier.value);
+    }
+    inline_block(fn->body, declared, loops + 1, false);
+    declared->pop_back();
+  }
+}
+
+void Inliner::inline_statement(Node *statement, const std::vector<std::set<std::string>> &declared, int loops,
+                               bool function_body, std::vector<Node *> *out) {
+  int line = statement->line;
+  auto *fnn = dynamic_cast<FunctionNode *>(statement);
+  if (fnn && !fnn->is_definition && worth_inlining(fnn, line, loops)) {
+    out->push_back(expand(fnn, nullptr, nullptr, line));
+    return;
+  }
+
+  // Find the call and the variable, if any, the statement stores its result in.
+  auto *vn = dynamic_cast<VariableNode *>(statement);
+  auto *un = dynamic_cast<UnaryNode *>(statement);
+  auto *bnn = dynamic_cast<BinaryNode *>(statement);
+  auto *assign = vn && vn->is_definition ? dynamic_cast<BinaryNode *>(vn->initializer) : nullptr;
+  auto *target = bnn && is_assign(bnn->token.type) ? dynamic_cast<VariableNode *>(bnn->left) : nullptr;
+  std::vector<VariableNode *> reads;
+  bool blocked = false;
+  Node **slot = nullptr;
+  Node *expression = statement;
+  if (assign) {
+    slot = first_call(&assign->right, line, loops, &reads, &blocked);
+  } else if (target) {
+    slot = first_call(&bnn->right, line, loops, &reads, &blocked);
+  } else if (un && un->token.type == RETURN) {
+    // Returns below the top level of a body never evaluate their expression.
+    slot = function_body ? first_call(&un->child, line, loops, &reads, &blocked) : nullptr;
+  } else if (auto *in = dynamic_cast<IfNode *>(statement)) {
+    slot = first_call(&in->condition, line, loops, &reads, &blocked);
+  } else if ((bnn && !is_assign(bnn->token.type)) || (fnn && !fnn->is_definition)) {
+    slot = first_call(&expression, line, loops, &reads, &blocked);
+  }
+  if (!slot) {
+    out->push_back(statement);
+    return;
+  }
+
+  // Whatever the statement evaluated before the call now runs after the body,
+  // so the body must not change it, and it must not fail before the body runs.
+  auto *call = static_cast<FunctionNode *>(*slot);
+  const Effects &effects = analyzer.call_effects(call->identifier.value);
+  for (VariableNode *read : reads) {
+    if (!is_declared(declared, read->identifier.value) || effects.writes.count(read->identifier.value)) {
+      out->push_back(statement);
+      return;
+    }
+  }
+
+  if (assign) {
+    // The variable is declared before the body, so nothing the statement
+    // evaluates may refer to it.
+    const std::string &name = declared_variable(vn)->identifier.value;
+    Effects initializer = analyzer.effects(assign->right);
+    if (initializer.reads.count(name) || initializer.writes.count(name)) {
+      out->push_back(statement);
+      return;
+    }
+    auto *rest = new BinaryNode(assign->token, new VariableNode(name_token(name, line), nullptr, false), assign->right);
+    rest->line = line;
+    slot = slot == &assign->right ? &rest->right : slot;
+    vn->initializer = assign->left;
+    assign->left = nullptr;
+    assign->right = nullptr;
+    delete assign;
+    out->push_back(vn);
+    out->push_back(expand(call, rest, slot, line));
+
+  } else if (target) {
+    // The variable is read before the right-hand side runs.
+    const std::string &name = target->identifier.value;
+    if (!is_declared(declared, name) || effects.writes.count(name)) {
+      out->push_back(statement);
+      return;
+    }
+    out->push_back(expand(call, statement, slot, line));
+
+  } else if (un) {
+    // The result is kept in a variable of the body until the return.
+    std::string name = call->identifier.value + "@" + std::to_string(inlined_calls + 1) + ".return";
+    auto *result = new VariableNode({VAR, "var", line}, new VariableNode(name_token(name, line), nullptr, false), true);
+    result->line = line;
+    auto *rest = new BinaryNode({ASSIGN, "=", line}, new VariableNode(name_token(name, line), nullptr, false), un->child);
+    rest->line = line;
+    slot = slot == &un->child ? &rest->right : slot;
+    un->child = new VariableNode(name_token(name, line), nullptr, false);
+    out->push_back(result);
+    out->push_back(expand(call, rest, slot, line));
+    out->push_back(un);
+
+  } else {
+    out->push_back(expand(call, statement, slot, line));
+  }
+}
+
+Node **Inliner::first_call(Node **slot, int line, int loops, std::vector<VariableNode *> *reads, bool *blocked) {
+  Node *node = *slot;
+  if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    if (vn->is_definition) {
+      *blocked = true;
+    } else {
+      reads->push_back(vn);
+    }
+    return nullptr;
+  } else if (dynamic_cast<TerminalNode *>(node)) {
+    return nullptr;
+  }
+
+  Node **found = nullptr;
+  if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    auto candidate = candidates.find(fnn->identifier.value);
+    if (!fnn->is_definition && candidate != candidates.end() && candidate->second.returns &&
+        worth_inlining(fnn, line, loops)) {
+      return slot;
+    }
+    for (size_t k = 0; k < fnn->parameters.size() && !found && !*blocked; k++) {
+      found = first_call(&fnn->parameters[k], line, loops, reads, blocked);
+    }
+  } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    found = first_call(&un->child, line, loops, reads, blocked);
+  } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    // Only the left-hand side of && and || is certain to run.
+    if (!is_assign(bnn->token.type)) {
+      found = first_call(&bnn->left, line, loops, reads, blocked);
+    }
+    if (!found && !*blocked && bnn->token.type != AND && bnn->token.type != OR && !is_assign(bnn->token.type)) {
+      found = first_call(&bnn->right, line, loops, reads, blocked);
+    }
+  }
+  // Anything else completes, and may fail, before a later call.
+  *blocked |= !found;
+  return found;
+}
+
+bool Inliner::worth_inlining(FunctionNode *call, int line, int loops) {
+  auto candidate = candidates.find(call->identifier.value);
+  if (candidate == candidates.end() || call->parameters.size() != candidate->second.def->parameters.size()) {
+    return false;
+  }
+
+  bool hot = false;
+  if (!profile.empty()) {
+    auto runs = profile.find(line);
+    if (runs != profile.end() && runs->second == 0) {
+      return false;
+    }
+    hot = runs != profile.end() && runs->second >= HOT_RUNS;
+  }
+  if (candidate->second.size > (hot ? HOT_BODY_SIZE : BODY_SIZE)) {
+    return false;
+  }
+  return loops > 0 || hot || sites[call->identifier.value] <= MAX_SITES;
+}
+
+Node *Inliner::expand(FunctionNode *call, Node *rest, Node **result, int line) {
+  const std::string name = call->identifier.value;
+  const Candidate &candidate = candidates.at(name);
+  std::string prefix = name + "@" + std::to_string(++inlined_calls) + ".";
+  std::map<std::string, std::string> renames;
+  for (const std::string &local : candidate.locals) {
+    renames[local] = prefix + local;
+  }
+
+  // The arguments are evaluated in order into the renamed parameters.
+  std::vector<Node *> statements;
+  for (size_t k = 0; k < call->parameters.size(); k++) {
+    auto *parameter = static_cast<VariableNode *>(candidate.def->parameters[k]);
+    Token identifier = name_token(renames[parameter->identifier.value], line);
+    auto *declaration = new VariableNode(
+        {VAR, "var", line},
+        new BinaryNode({ASSIGN, "=", line}, new VariableNode(identifier, nullptr, false), call->parameters[k]), true);
+    declaration->line = line;
+    statements.push_back(declaration);
+  }
+  call->parameters.clear();
+
+  const std::vector<Node *> &body = candidate.def->body->statements;
+  for (size_t k = 0; k < body.size() - candidate.returns; k++) {
+    statements.push_back(clone(body[k], renames));
+  }
+  if (candidate.returns) {
+    auto *returned = static_cast<UnaryNode *>(body.back());
+    Node *value = clone(returned->child, renames);
+    if (rest) {
+      *result = new UnaryNode(returned->token, value);
+    } else {
+      // An unused result is still evaluated, like the return would.
+      Token identifier = name_token(prefix + "return", line);
+      auto *declaration = new VariableNode(
+          {VAR, "var", line}, new BinaryNode({ASSIGN, "=", line}, new VariableNode(identifier, nullptr, false), value),
+          true);
+      declaration->line = line;
+      statements.push_back(declaration);
+    }
+  }
+  if (rest) {
+    statements.push_back(rest);
+  }
+  delete call;
+
+  log.push_back("Inlined '" + name + "'" + (line ? " on line " + std::to_string(line) : ""));
+  auto *block = new IfNode(new TerminalNode(new BoolValue(true)), new BlockNode(statements), nullptr);
+  block->line = line;
+  return block;
+}
+
+const std::vector<std::string> &Inliner::decisions() const {
+  return log;
+}
+
+unsigned Inliner::inlined() const {
+  return inlined_calls;
+}
+
+std::map<int, uint64_t> Inliner::read_profile(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error("Failed to open profile: " + path);
+  }
+
+  std::map<int, uint64_t> runs;
+  std::string record;
+  while (std::getline(file, record)) {
+    int line;
+    unsigned long long count;
+    if (sscanf(record.c_str(), "DA:%d,%llu", &line, &count) == 2) {
+      runs[line] = count;
+    }
+  }
+  return runs;
+}
@@ -0,0 +1,130 @@
+#include "../include/input.h"
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+
+static const size_t BUFFER_SIZE = 1 << 16;
+
+InputReader::InputReader(int fd) : fd(fd), buffer(BUFFER_SIZE), start(), end(), at_eof() {}
+
+bool InputReader::fill() {
+  if (at_eof) {
+    return false;
+  }
+
+  ssize_t n;
+  do {
+    n = ::read(fd, buffer.data(), buffer.size());
+  } while (n < 0 && errno == EINTR);
+
+  if (n <= 0) {
+    at_eof = true;
+    return false;
+  }
+  start = 0;
+  end = n;
+  return true;
+}
+
+bool InputReader::extend() {
+  if (at_eof) {
+    return false;
+  }
+
+  if (start > 0) {
+    memmove(buffer.data(), buffer.data() + start, end - start);
+    end -= start;
+    start = 0;
+  }
+  // A line longer than the buffer needs a larger one to be returned whole.
+  if (end == buffer.size()) {
+    buffer.resize(2 * buffer.size());
+  }
+
+  ssize_t n;
+  do {
+    n = ::read(fd, buffer.data() + end, buffer.size() - end);
+  } while (n < 0 && errno == EINTR);
+
+  if (n <= 0) {
+    at_eof = true;
+    return false;
+  }
+  end += n;
+  return true;
+}
+
+/**
+ * Drops the '\r' a CRLF line ends with, so numbers typed on Windows still parse as numbers.
+ */
+static std::string_view without_carriage_return(std::string_view line) {
+  if (!line.empty() && line.back() == '\r') {
+    line.remove_suffix(1);
+  }
+  return line;
+}
+
+bool InputReader::read_line(std::string *line) {
+  std::string_view record;
+  bool read = read_record(&record);
+  line->assign(record);
+  return read;
+}
+
+bool InputReader::read_record(std::string_view *line) {
+  // Bytes already searched for a newline are not searched again after more are read.
+  size_t searched = 0;
+  while (true) {
+    const char *begin = buffer.data() + start;
+    const char *newline = static_cast<const char *>(memchr(begin + searched, '\n', end - start - searched));
+    if (newline) {
+      *line = without_carriage_return(std::string_view(begin, newline - begin));
+      start += newline - begin + 1;
+      return true;
+    }
+    searched = end - start;
+    if (!extend()) {
+      // A last line without a trailing newline still counts.
+      std::string_view last(buffer.data() + start, end - start);
+      *line = without_carriage_return(last);
+      start = end;
+      return !last.empty();
+    }
+  }
+}
+
+bool InputReader::eof() {
+  return start == end && !fill();
+}
+
+Value *parse_value(std::string_view text) {
+  const char *first = text.data();
+  const char *last = first + text.size();
+
+  // Only text that starts like a number is considered one, so words such as
+  // "inf" or "nan" stay strings.
+  const char *digits = first < last && *first == '-' ? first + 1 : first;
+  if (digits < last && (std::isdigit(static_cast<unsigned char>(*digits)) || *digits == '.')) {
+    int int_value;
+    auto int_result = std::from_chars(first, last, int_value);
+    if (int_result.ec == std::errc() && int_result.ptr == last) {
+      return new IntValue(int_value);
+    }
+
+    // Integers too large for an int fall through to a float.
+    double float_value;
+    auto float_result = std::from_chars(first, last, float_value);
+    if (float_result.ec == std::errc() && float_result.ptr == last) {
+      return new FloatValue(float_value);
+    }
+  }
+
+  if (text == "true") {
+    return new BoolValue(true);
+  } else if (text == "false") {
+    return new BoolValue(false);
+  }
+  return new StringValue(std::string(text));
+}
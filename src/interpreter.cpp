@@ -1,17 +1,33 @@
 #include "../include/interpreter.h"
+#include "../include/format.h"
+#include "../include/stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <stdexcept>
+#include <unistd.h>
 
 // TODO:
 //  - Break statement
 //  - Handle comments
 //  - Better error handling with line numbers
 
-Interpreter::Interpreter(std::string code, bool debug_mode)
-    : ast(), debug_mode(debug_mode), scope(), scope_index() {
+/// Functions run_lines calls, in the order it calls them.
+static const std::vector<std::string> line_hooks = {"on_begin", "on_line", "on_end"};
 
-  scope.push_back(std::vector<Node *>()); // Global Scope
+Interpreter::Interpreter(std::string code, const InterpreterOptions &options)
+    : ast(), next_statement(0), snapshot_path(options.snapshot_path), debug_mode(options.debug_mode),
+      per_line(options.per_line), stack(), frames(), scope_index(), input_reader(STDIN_FILENO), trace(), files(),
+      split_line(), split_fields(), analyzer(),
+      counted_loops(), jit(options.jit && Jit::supported() ? new Jit() : nullptr), ir(), memo(options.memo_size),
+      random(0), kernels(options.simd ? &best_kernels() : &scalar_kernels()), coverage(), statement_lines(), coverage_counts() {
+
+  stack.reserve(STACK_SIZE);
+  frames.push_back(0); // Global Scope
   Lexer lexer(code);
 
   if (debug_mode) {
@@ -28,145 +44,539 @@ Interpreter::Interpreter(std::string code, bool debug_mode)
     std::cout << std::endl;
   }
 
-  Parser parser(tokens, debug_mode);
+  // The line hooks are called by the interpreter rather than the script.
+  std::vector<std::string> entry_points = per_line ? line_hooks : std::vector<std::string>();
+  Parser parser(std::move(tokens), debug_mode, options.lazy_parsing, entry_points);
   ast = parser.parse();
+  if (options.dead_code) {
+    Optimizer optimizer(entry_points);
+    optimizer.eliminate_dead_code(ast);
+    if (debug_mode) {
+      std::cout << "Dead code: " << optimizer.removed().size() << " removals" << std::endl;
+      for (const std::string &removal : optimizer.removed()) {
+        std::cout << "  " << removal << std::endl;
+      }
+    }
+  }
+  if (options.inlining) {
+    Inliner inliner(ast, options.inline_profile.empty() ? std::map<int, uint64_t>()
+                                                        : Inliner::read_profile(options.inline_profile));
+    inliner.inline_calls(ast);
+    if (debug_mode) {
+      std::cout << "Inlining: " << inliner.inlined() << " calls" << std::endl;
+      for (const std::string &decision : inliner.decisions()) {
+        std::cout << "  " << decision << std::endl;
+      }
+    }
+  }
+  analyzer = new Analyzer(ast);
+  if (options.ir && !options.coverage) {
+    ir = new IrCompiler(analyzer, jit, options.dump_ir);
+  }
+
+  for (const auto &entry : analyzer->definitions()) {
+    for (FunctionNode *def : entry.second) {
+      std::string reason = def->is_pure ? analyzer->impurity(def) : "";
+      if (!reason.empty()) {
+        throw std::runtime_error("Function '" + entry.first + "' is declared pure but " + reason);
+      }
+    }
+  }
+
+  TypeInference inference(analyzer);
+  if (per_line) {
+    inference.assume_call("on_begin", {});
+    inference.assume_call("on_line", {TYPE_STRING});
+    inference.assume_call("on_end", {});
+  }
+  inference.run(ast);
+  if (options.coverage) {
+    enable_coverage();
+  }
 
   if (debug_mode) {
     std::cout << "AST:" << std::endl << Parser::draw_tree(ast) << std::endl;
   }
 };
 
+Interpreter::Interpreter(const Snapshot &snapshot, const InterpreterOptions &options)
+    : ast(snapshot.ast), next_statement(snapshot.next_statement), snapshot_path(options.snapshot_path),
+      debug_mode(options.debug_mode), per_line(options.per_line), stack(), frames(), scope_index(),
+      input_reader(STDIN_FILENO), trace(), files(), split_line(), split_fields(), analyzer(),
+      counted_loops(), jit(options.jit && Jit::supported() ? new Jit() : nullptr), ir(), memo(options.memo_size),
+      random(snapshot.random), kernels(options.simd ? &best_kernels() : &scalar_kernels()), coverage(), statement_lines(), coverage_counts() {
+
+  // The program was checked and typed before it was saved.
+  stack.reserve(STACK_SIZE);
+  frames.push_back(0); // Global Scope
+  for (const Binding &b : snapshot.globals) {
+    push_binding(b);
+  }
+  analyzer = new Analyzer(ast);
+  if (options.ir && !options.coverage) {
+    ir = new IrCompiler(analyzer, jit, options.dump_ir);
+  }
+  if (options.coverage) {
+    enable_coverage();
+  }
+
+  if (debug_mode) {
+    std::cout << "Restored " << snapshot.globals.size() << " globals, continuing at statement " << next_statement
+              << std::endl;
+  }
+}
+
+void Interpreter::number_statements(Node *node) {
+  if (!node) {
+    return;
+  }
+  if (node->line > 0) {
+    node->statement = statement_lines.size();
+    statement_lines.push_back(node->line);
+  }
+
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    for (Node *s : bn->statements) {
+      number_statements(s);
+    }
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    if (fnn->is_definition) {
+      number_statements(fnn->body);
+    }
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    number_statements(in->true_body);
+    number_statements(in->false_body);
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    number_statements(wn->body);
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    number_statements(fn->initialization);
+    number_statements(fn->body);
+  }
+}
+
+void Interpreter::enable_coverage() {
+  number_statements(ast);
+  coverage.assign(statement_lines.size(), 0);
+  coverage_counts = coverage.data();
+  if (jit) {
+    jit->count_statements(coverage_counts);
+  }
+}
+
+void Interpreter::write_coverage(const std::string &path, const std::string &source) const {
+  std::map<int, uint64_t> lines;
+  for (size_t i = 0; i < coverage.size(); i++) {
+    uint64_t &count = lines[statement_lines[i]];
+    count = std::max(count, coverage[i]);
+  }
+
+  std::ofstream file(path, std::ios::trunc);
+  file << "TN:\nSF:" << source << "\n";
+  size_t hit = 0;
+  for (const auto &[line, count] : lines) {
+    file << "DA:" << line << "," << count << "\n";
+    hit += count > 0;
+  }
+  file << "LF:" << lines.size() << "\nLH:" << hit << "\nend_of_record\n";
+  file.close();
+  if (!file) {
+    throw std::runtime_error("Failed to write coverage: " + path);
+  }
+}
+
 Interpreter::~Interpreter() {
+  delete ir;
+  delete jit;
+  delete analyzer;
   delete ast;
 };
 
-void Interpreter::scope_increase() {
-  scope.push_back(std::vector<Node *>());
+void Interpreter::scope_increase(size_t arguments) {
+  frames.push_back(stack.size() - arguments);
   scope_index++;
+  stats.scope_pushes++;
+  if (frames.size() > stats.peak_scope_depth) {
+    stats.peak_scope_depth = frames.size();
+  }
 }
 
 void Interpreter::scope_decrease() {
-  scope.pop_back();
+  stack.resize(frames.back());
+  frames.pop_back();
   scope_index--;
+  stats.scope_pops++;
+}
+
+void Interpreter::push_binding(const Binding &binding) {
+  // Growing past the reserved storage would move every value slot.
+  if (stack.size() == STACK_SIZE) {
+    throw std::runtime_error("Stack overflow: too many variables and functions alive at once");
+  }
+  stack.push_back(binding);
 }
 
 void Interpreter::print_scope() {
-  int level = 0;
-  for (std::vector<Node *> s : scope) {
+  for (size_t level = 0; level < frames.size(); level++) {
+    size_t end = level + 1 < frames.size() ? frames[level + 1] : stack.size();
     std::cout << "Level " << level << ": ";
-    if (s.size() == 0) {
+    if (frames[level] == end) {
       std::cout << "Empty";
     }
-    for (size_t i = 0; i < s.size(); i++) {
-      Node *n = s[i];
-      std::cout << "{ " << n->to_string();
-      if (auto *variable = dynamic_cast<VariableNode *>(n)) {
-        std::cout << ": " << dynamic_cast<TerminalNode *>(variable->initializer)->to_string();
+    for (size_t i = frames[level]; i < end; i++) {
+      const Binding &b = stack[i];
+      if (b.function) {
+        std::cout << "{ " << b.function->to_string() << " }";
+      } else {
+        std::cout << "{ " << (b.name ? symbols.name(b.name) : "<argument>") << ": " << b.value->to_string() << " }";
       }
 
-      std::cout << " }";
-
-      if (i + 1 < s.size()) {
+      if (i + 1 < end) {
         std::cout << ", ";
       }
     }
-    level++;
     std::cout << std::endl;
   }
 }
 
-FunctionNode *Interpreter::get_function_from_scope(std::string identifier) {
+Binding *Interpreter::find_binding(Symbol identifier, bool function) {
+  if (identifier == NO_SYMBOL) {
+    return nullptr; // Unnamed arguments must not match
+  }
   // Iterate from the current scope back to the global scope
-  for (size_t i = scope_index; i >= 0; i--) {
-    for (Node *n : scope[i]) {
-      if (auto *func_node = dynamic_cast<FunctionNode *>(n)) {
-        if (func_node->identifier.value == identifier) {
-          return func_node;
-        }
+  size_t end = stack.size();
+  for (size_t level = frames.size(); level-- > 0;) {
+    for (size_t i = frames[level]; i < end; i++) {
+      Binding &b = stack[i];
+      if (!function) {
+        stats.lookup_entries_scanned++;
+      }
+      if (b.name == identifier && (b.function != nullptr) == function) {
+        return &b;
       }
     }
+    end = frames[level];
   }
-  return nullptr; // Return nullptr if the function is not found in any scope
+  return nullptr;
 }
 
-Value *Interpreter::get_variable_value(std::string identifier) {
-  // Find's variable value in scope. Local variables get precedence over global
+FunctionNode *Interpreter::get_function_from_scope(Symbol identifier) {
+  Binding *b = find_binding(identifier, true);
+  return b ? b->function : nullptr; // Return nullptr if the function is not found in any scope
+}
+
+Binding *Interpreter::get_variable_binding(Symbol identifier) {
+  // Find's variable in scope. Local variables get precedence over global
   // variables.
-  for (size_t i = scope_index; i >= 0; i--) {
-    for (Node *n : scope[i]) {
-      if (auto *vn = dynamic_cast<VariableNode *>(n)) {
-        if (vn->identifier.value == identifier) {
-          return evaluate(vn->initializer);
-        }
-      }
-    }
+  stats.variable_lookups++;
+  return find_binding(identifier, false);
+}
+
+Value **Interpreter::get_variable_slot(Symbol identifier) {
+  Binding *b = get_variable_binding(identifier);
+  return b ? &b->value : nullptr;
+}
+
+/**
+ * Checks a value stored where a type was declared. An int is converted to a
+ * declared float, the same way assigning it to a float variable would.
+ * @param declared The declared type, TYPE_ANY if there is none.
+ * @param place What holds the value, e.g. "Variable", for the error message.
+ * @param name Name of the variable, parameter or function.
+ * @return The value to store.
+ */
+static Value *check_declared(ValueType declared, Value *value, const char *place, const std::string &name) {
+  if (declared == TYPE_ANY || value->type == declared) {
+    return value;
+  } else if (declared == TYPE_FLOAT && value->type == TYPE_INT) {
+    return new FloatValue(static_cast<IntValue *>(value)->value);
+  }
+  throw std::runtime_error(std::string(place) + " '" + name + "' is declared " + type_name(declared) + ", not " +
+                           type_name(value->type));
+}
+
+/**
+ * Builds the value a variable declared with a type but no initializer starts with.
+ */
+static Value *default_value(ValueType type) {
+  switch (type) {
+  case TYPE_INT: return new IntValue(0);
+  case TYPE_FLOAT: return new FloatValue(0.0);
+  case TYPE_STRING: return new StringValue("");
+  case TYPE_BOOL: return new BoolValue(false);
+  case TYPE_ARRAY: return new ArrayValue(TYPE_INT, 0);
+  default: return new VoidValue();
+  }
+}
+
+Value *Interpreter::get_variable_value(Symbol identifier) {
+  if (Value **slot = get_variable_slot(identifier)) {
+    return *slot;
   }
 
   // Runtime error thrown if the variable is not defined
   std::ostringstream msg;
-  msg << "Variable " << identifier << " is not defined in this scope";
+  msg << "Variable " << symbols.name(identifier) << " is not defined in this scope";
   throw std::runtime_error(msg.str());
 }
 
-void Interpreter::set_variable_value(std::string identifier, Value *new_value) {
-  // Find's variable in scope and assigns new value. Local variables get
-  // precedence over global variables.
-  for (size_t i = scope_index; i >= 0; i--) {
-    for (Node *n : scope[i]) {
-      if (auto *vn = dynamic_cast<VariableNode *>(n)) {
-        if (vn->identifier.value == identifier) {
-          vn->initializer = new TerminalNode(new_value);
-          return;
-        }
-      }
-    }
+void Interpreter::set_variable_value(Symbol identifier, Value *new_value) {
+  if (Binding *b = get_variable_binding(identifier)) {
+    b->value = b->type == TYPE_ANY ? new_value : check_declared(b->type, new_value, "Variable", symbols.name(identifier));
+    return;
   }
 
   // Runtime error thrown if the variable is not defined
   std::ostringstream msg;
-  msg << "Variable " << identifier << " is not defined in this scope";
+  msg << "Variable " << symbols.name(identifier) << " is not defined in this scope";
   throw std::runtime_error(msg.str());
 }
 
-Value *Interpreter::evaluate_function(std::string identifier,
-                                      std::vector<Value *> parameters) {
+/**
+ * Checks that a builtin was passed the number of parameters it takes.
+ */
+static void expect_parameters(const std::vector<Value *> &parameters, size_t expected) {
+  if (parameters.size() != expected) {
+    std::ostringstream msg;
+    msg << "Too " << (parameters.size() > expected ? "many " : "few ")
+        << "parameters. Expected: " << expected << ", Actual: " << parameters.size();
+    throw std::runtime_error(msg.str());
+  }
+}
+
+/**
+ * Checks that a builtin parameter has the given type.
+ */
+static void expect_type(Value *parameter, ValueType expected) {
+  if (parameter->type != expected) {
+    std::ostringstream msg;
+    msg << "Invalid parameter type. Expected: '" << type_name(expected) << "', Actual: '"
+        << parameter->get_type() << "'";
+    throw std::runtime_error(msg.str());
+  }
+}
+
+/**
+ * Extracts the file handle passed to a file builtin.
+ */
+static int handle_parameter(Value *parameter) {
+  expect_type(parameter, TYPE_INT);
+  return static_cast<IntValue *>(parameter)->value;
+}
+
+/**
+ * Extracts an int passed to a builtin.
+ */
+static int int_parameter(Value *parameter) {
+  expect_type(parameter, TYPE_INT);
+  return static_cast<IntValue *>(parameter)->value;
+}
+
+/**
+ * Extracts the array passed to an array builtin.
+ */
+static ArrayValue *array_parameter(Value *parameter) {
+  expect_type(parameter, TYPE_ARRAY);
+  return static_cast<ArrayValue *>(parameter);
+}
+
+/**
+ * Extracts an int or a float passed to a builtin as a double.
+ */
+static double number_parameter(Value *parameter) {
+  if (parameter->type == TYPE_INT) {
+    return static_cast<IntValue *>(parameter)->value;
+  }
+  expect_type(parameter, TYPE_FLOAT);
+  return static_cast<FloatValue *>(parameter)->value;
+}
+
+/**
+ * Extracts an array that must have the same element type and length as another.
+ */
+static ArrayValue *matching_array_parameter(ArrayValue *first, Value *parameter) {
+  ArrayValue *array = array_parameter(parameter);
+  if (array->element_type != first->element_type || array->size() != first->size()) {
+    throw std::runtime_error("Arrays must have the same element type and length, got " +
+                             std::string(type_name(first->element_type)) + "[" + std::to_string(first->size()) +
+                             "] and " + type_name(array->element_type) + "[" + std::to_string(array->size()) + "]");
+  }
+  return array;
+}
+
+/**
+ * Extracts an array index and checks that it is in bounds.
+ */
+static size_t index_parameter(ArrayValue *array, Value *parameter) {
+  int index = int_parameter(parameter);
+  if (index < 0 || static_cast<size_t>(index) >= array->size()) {
+    throw std::runtime_error("Index " + std::to_string(index) + " out of bounds for array of length " +
+                             std::to_string(array->size()));
+  }
+  return static_cast<size_t>(index);
+}
+
+/**
+ * Extracts the path passed to a file builtin.
+ */
+static const std::string &path_parameter(Value *parameter) {
+  expect_type(parameter, TYPE_STRING);
+  return static_cast<StringValue *>(parameter)->value;
+}
+
+/**
+ * Splits a line into fields. A single space splits on runs of spaces and tabs
+ * and ignores them at either end, like awk; any other separator splits on each
+ * occurrence, so empty fields are kept.
+ * @param line The text to split.
+ * @param separator A non-empty separator.
+ * @param fields Where views of the fields are added.
+ */
+static void split(std::string_view line, const std::string &separator, std::vector<std::string_view> *fields) {
+  if (separator == " ") {
+    size_t i = 0;
+    while (true) {
+      while (i < line.size() && (line[i] == ' ' || line[i] == '\t')) {
+        i++;
+      }
+      if (i == line.size()) {
+        return;
+      }
+      size_t start = i;
+      while (i < line.size() && line[i] != ' ' && line[i] != '\t') {
+        i++;
+      }
+      fields->push_back(line.substr(start, i - start));
+    }
+  }
+
+  const char *next = line.data();
+  const char *last = next + line.size();
+  while (true) {
+    // memchr searches many bytes at a time for the separator's first character.
+    const char *found = next;
+    while ((found = static_cast<const char *>(memchr(found, separator[0], last - found))) &&
+           std::string_view(found, std::min<size_t>(separator.size(), last - found)) != separator) {
+      found++;
+    }
+    if (!found) {
+      fields->emplace_back(next, last - next);
+      return;
+    }
+    fields->emplace_back(next, found - next);
+    next = found + separator.size();
+  }
+}
+
+bool Interpreter::read_input(std::string_view *line) {
+  if (trace && trace->replaying()) {
+    return trace->replay_line(line);
+  }
+  bool read = input_reader.read_record(line);
+  if (trace) {
+    trace->record_line(read ? line : nullptr);
+  }
+  return read;
+}
+
+bool Interpreter::input_eof() {
+  if (trace && trace->replaying()) {
+    return trace->replay_eof();
+  }
+  bool eof = input_reader.eof();
+  if (trace) {
+    trace->record_eof(eof);
+  }
+  return eof;
+}
+
+Value *Interpreter::evaluate_builtin(const std::string &identifier, const std::vector<Value *> &parameters) {
   // TODO: Modulize to include libraries with standard functions
   if (identifier == "input") {
     if (parameters.size() != 0) {
       std::ostringstream msg;
       msg << "Too many parameters. Expected: 0, Actual: " << parameters.size();
-      std::runtime_error(msg.str());
+      throw std::runtime_error(msg.str());
     } else {
-      std::string input;
-      std::getline(std::cin, input);
-      bool is_int = false;
-      bool is_float = false;
-
-      for (char c : input) {
-        if (std::isdigit(c)) {
-          is_int = true;
-        } else if (c == '.' && is_int) {
-          is_float = true;
-        }
-      }
-
-      Value *input_value;
-      if (is_int && !is_float) {
-        input_value = new IntValue(stoi(input));
-      } else if (is_float) {
-        input_value = new FloatValue(stof(input));
-      } else {
-        if (input == "true") {
-          input_value = new BoolValue(true);
-        } else if (input == "false") {
-          input_value = new BoolValue(false);
-        } else {
-          input_value = new StringValue(input);
-        }
-      }
-
-      return input_value;
+      stats.builtin_calls++;
+      std::string_view input;
+      read_input(&input);
+      return parse_value(input);
+    }
+  } else if (identifier == "eof") {
+    if (parameters.size() > 1) {
+      std::ostringstream msg;
+      msg << "Too many parameters. Expected: 0 or 1, Actual: " << parameters.size();
+      throw std::runtime_error(msg.str());
+    } else if (parameters.empty()) {
+      stats.builtin_calls++;
+      return new BoolValue(input_eof());
+    } else {
+      stats.builtin_calls++;
+      return new BoolValue(files.eof(handle_parameter(parameters[0])));
     }
+  } else if (identifier == "open_read") {
+    expect_parameters(parameters, 1);
+    stats.builtin_calls++;
+    return new IntValue(files.open_read(path_parameter(parameters[0])));
+  } else if (identifier == "lines") {
+    expect_parameters(parameters, 1);
+    stats.builtin_calls++;
+    return new IntValue(files.open_lines(path_parameter(parameters[0])));
+  } else if (identifier == "open_write") {
+    expect_parameters(parameters, 1);
+    stats.builtin_calls++;
+    return new IntValue(files.open_write(path_parameter(parameters[0])));
+  } else if (identifier == "read_line") {
+    expect_parameters(parameters, 1);
+    stats.builtin_calls++;
+    std::string_view line;
+    files.read_line(handle_parameter(parameters[0]), &line);
+    return parse_value(line);
+  } else if (identifier == "write") {
+    expect_parameters(parameters, 2);
+    stats.builtin_calls++;
+    int handle = handle_parameter(parameters[0]);
+    files.write(handle, parameters[1]->to_string());
+    files.write(handle, "\n");
+    return new VoidValue();
+  } else if (identifier == "close") {
+    expect_parameters(parameters, 1);
+    stats.builtin_calls++;
+    files.close(handle_parameter(parameters[0]));
+    return new VoidValue();
+  } else if (identifier == "fields") {
+    expect_parameters(parameters, 2);
+    expect_type(parameters[0], TYPE_STRING);
+    expect_type(parameters[1], TYPE_STRING);
+    const std::string &separator = static_cast<StringValue *>(parameters[1])->value;
+    if (separator.empty()) {
+      throw std::runtime_error("fields() needs a non-empty separator");
+    }
+    stats.builtin_calls++;
+    // The fields point into the line, so it must never be changed in place.
+    split_line = static_cast<StringValue *>(parameters[0]);
+    split_line->shared = true;
+    split_fields.clear();
+    split(split_line->value, separator, &split_fields);
+    return new IntValue(static_cast<int>(split_fields.size()));
+  } else if (identifier == "field") {
+    expect_parameters(parameters, 1);
+    int index = int_parameter(parameters[0]);
+    if (!split_line) {
+      throw std::runtime_error("field() called before fields() split a line");
+    } else if (index < 0 || static_cast<size_t>(index) >= split_fields.size()) {
+      throw std::runtime_error("Field " + std::to_string(index) + " out of bounds for line with " +
+                               std::to_string(split_fields.size()) + " fields");
+    }
+    stats.builtin_calls++;
+    return parse_value(split_fields[index]);
+  } else if (identifier == "checkpoint") {
+    expect_parameters(parameters, 0);
+    stats.builtin_calls++;
+    if (!snapshot_path.empty()) {
+      save_checkpoint();
+    }
+    return new VoidValue();
   } else if (identifier == "output") {
     if (parameters.size() > 1 || parameters.size() < 1) {
       std::ostringstream msg;
@@ -174,70 +584,317 @@ Value *Interpreter::evaluate_function(std::string identifier,
           << "parameters. Expected: 1, Actual: " << parameters.size();
       std::runtime_error(msg.str());
     } else {
+      stats.builtin_calls++;
       std::string output_value = parameters[0]->to_string();
       std::cout << output_value << std::endl;
       return new VoidValue();
     }
 
+  } else if (identifier == "format") {
+    format_parameters(parameters);
+    stats.builtin_calls++;
+    return new StringValue(format_buffer);
   } else if (identifier == "rand") {
-    if (parameters.size() > 1 || parameters.size() < 1) {
+    expect_parameters(parameters, 1);
+    int bound = int_parameter(parameters[0]);
+    if (bound <= 0) {
+      throw std::runtime_error("rand() needs a positive bound, got " + std::to_string(bound));
+    }
+    stats.builtin_calls++;
+    int drawn = static_cast<int>(random.below(static_cast<uint32_t>(bound)));
+    return new IntValue(trace ? trace->random_int(drawn) : drawn);
+  } else if (identifier == "rand_float") {
+    expect_parameters(parameters, 0);
+    stats.builtin_calls++;
+    double drawn = random.uniform();
+    return new FloatValue(trace ? trace->random_float(drawn) : drawn);
+  } else if (identifier == "seed") {
+    expect_parameters(parameters, 1);
+    stats.builtin_calls++;
+    random.reseed(static_cast<uint64_t>(int_parameter(parameters[0])));
+    return new VoidValue();
+  } else if (identifier == "rand_fill") {
+    if (parameters.size() < 1 || parameters.size() > 2) {
       std::ostringstream msg;
-      msg << "Too " << (parameters.size() > 1 ? "many " : "few ")
-          << "parameters. Expected: 1, Actual: " << parameters.size();
-      std::runtime_error(msg.str());
+      msg << "Too " << (parameters.size() > 2 ? "many " : "few ")
+          << "parameters. Expected: 1 or 2, Actual: " << parameters.size();
+      throw std::runtime_error(msg.str());
+    }
+    ArrayValue *array = array_parameter(parameters[0]);
+    stats.builtin_calls++;
+    if (array->element_type == TYPE_FLOAT) {
+      if (parameters.size() == 2) {
+        throw std::runtime_error("rand_fill() on a float array takes no bound");
+      }
+      random.fill(array->floats.data(), array->floats.size());
     } else {
-      if (auto *rand_ciel = dynamic_cast<IntValue *>(parameters[0])) {
-        return new IntValue(rand() % rand_ciel->value);
-      } else {
-        std::ostringstream msg;
-        msg << "Invalid parameter type. Expected: 'int', Actual: '"
-            << parameters[0]->to_string() << "'" << std::endl;
-        std::runtime_error(msg.str());
+      int bound = parameters.size() == 2 ? int_parameter(parameters[1]) : INT32_MAX;
+      if (bound <= 0) {
+        throw std::runtime_error("rand_fill() needs a positive bound, got " + std::to_string(bound));
+      }
+      random.fill(array->ints.data(), array->ints.size(), static_cast<uint32_t>(bound));
+    }
+    return new VoidValue();
+  } else if (identifier == "array") {
+    if (parameters.size() < 1 || parameters.size() > 2) {
+      std::ostringstream msg;
+      msg << "Too " << (parameters.size() > 2 ? "many " : "few ")
+          << "parameters. Expected: 1 or 2, Actual: " << parameters.size();
+      throw std::runtime_error(msg.str());
+    }
+    int size = int_parameter(parameters[0]);
+    if (size < 0) {
+      throw std::runtime_error("array() needs a size of at least 0, got " + std::to_string(size));
+    }
+    stats.builtin_calls++;
+    if (parameters.size() == 1) {
+      return new ArrayValue(TYPE_INT, size);
+    } else if (parameters[1]->type == TYPE_INT) {
+      auto *array = new ArrayValue(TYPE_INT, size);
+      array->ints.assign(size, static_cast<IntValue *>(parameters[1])->value);
+      return array;
+    }
+    expect_type(parameters[1], TYPE_FLOAT);
+    auto *array = new ArrayValue(TYPE_FLOAT, size);
+    array->floats.assign(size, static_cast<FloatValue *>(parameters[1])->value);
+    return array;
+  } else if (identifier == "len") {
+    expect_parameters(parameters, 1);
+    stats.builtin_calls++;
+    return new IntValue(static_cast<int>(array_parameter(parameters[0])->size()));
+  } else if (identifier == "get") {
+    expect_parameters(parameters, 2);
+    ArrayValue *array = array_parameter(parameters[0]);
+    size_t index = index_parameter(array, parameters[1]);
+    stats.builtin_calls++;
+    if (array->element_type == TYPE_INT) {
+      return new IntValue(array->ints[index]);
+    }
+    return new FloatValue(array->floats[index]);
+  } else if (identifier == "set") {
+    expect_parameters(parameters, 3);
+    ArrayValue *array = array_parameter(parameters[0]);
+    size_t index = index_parameter(array, parameters[1]);
+    stats.builtin_calls++;
+    if (array->element_type == TYPE_INT) {
+      array->ints[index] = int_parameter(parameters[2]);
+    } else if (parameters[2]->type == TYPE_INT) {
+      array->floats[index] = static_cast<IntValue *>(parameters[2])->value;
+    } else {
+      expect_type(parameters[2], TYPE_FLOAT);
+      array->floats[index] = static_cast<FloatValue *>(parameters[2])->value;
+    }
+    return new VoidValue();
+  } else if (identifier == "sum") {
+    expect_parameters(parameters, 1);
+    ArrayValue *array = array_parameter(parameters[0]);
+    stats.builtin_calls++;
+    if (array->element_type == TYPE_INT) {
+      return new IntValue(kernels->sum_int(array->ints.data(), array->size()));
+    }
+    return new FloatValue(kernels->sum_float(array->floats.data(), array->size()));
+  } else if (identifier == "min" || identifier == "max") {
+    expect_parameters(parameters, 1);
+    ArrayValue *array = array_parameter(parameters[0]);
+    if (array->size() == 0) {
+      throw std::runtime_error(identifier + "() of an empty array");
+    }
+    stats.builtin_calls++;
+    bool least = identifier == "min";
+    if (array->element_type == TYPE_INT) {
+      const int *data = array->ints.data();
+      return new IntValue(least ? kernels->min_int(data, array->size()) : kernels->max_int(data, array->size()));
+    }
+    const double *data = array->floats.data();
+    return new FloatValue(least ? kernels->min_float(data, array->size()) : kernels->max_float(data, array->size()));
+  } else if (identifier == "dot") {
+    expect_parameters(parameters, 2);
+    ArrayValue *a = array_parameter(parameters[0]);
+    ArrayValue *b = matching_array_parameter(a, parameters[1]);
+    stats.builtin_calls++;
+    if (a->element_type == TYPE_INT) {
+      return new IntValue(kernels->dot_int(a->ints.data(), b->ints.data(), a->size()));
+    }
+    return new FloatValue(kernels->dot_float(a->floats.data(), b->floats.data(), a->size()));
+  } else if (identifier == "scale") {
+    expect_parameters(parameters, 2);
+    ArrayValue *array = array_parameter(parameters[0]);
+    stats.builtin_calls++;
+    if (array->element_type == TYPE_INT) {
+      kernels->scale_int(array->ints.data(), array->size(), int_parameter(parameters[1]));
+    } else {
+      kernels->scale_float(array->floats.data(), array->size(), number_parameter(parameters[1]));
+    }
+    return new VoidValue();
+  } else if (identifier == "add") {
+    expect_parameters(parameters, 2);
+    ArrayValue *a = array_parameter(parameters[0]);
+    ArrayValue *b = matching_array_parameter(a, parameters[1]);
+    stats.builtin_calls++;
+    if (a->element_type == TYPE_INT) {
+      kernels->add_int(a->ints.data(), b->ints.data(), a->size());
+    } else {
+      kernels->add_float(a->floats.data(), b->floats.data(), a->size());
+    }
+    return new VoidValue();
+  } else if (identifier == "count_if_gt") {
+    expect_parameters(parameters, 2);
+    ArrayValue *array = array_parameter(parameters[0]);
+    double limit = number_parameter(parameters[1]);
+    stats.builtin_calls++;
+    size_t count;
+    if (array->element_type == TYPE_FLOAT) {
+      count = kernels->count_gt_float(array->floats.data(), array->size(), limit);
+    } else if (limit >= INT32_MAX) {
+      count = 0;
+    } else if (limit < INT32_MIN) {
+      count = array->size();
+    } else {
+      // An int is greater than the limit exactly when it is greater than the limit rounded down.
+      count = kernels->count_gt_int(array->ints.data(), array->size(), static_cast<int>(std::floor(limit)));
+    }
+    return new IntValue(static_cast<int>(count));
+  } else if (identifier == "sort") {
+    expect_parameters(parameters, 1);
+    ArrayValue *array = array_parameter(parameters[0]);
+    stats.builtin_calls++;
+    if (array->element_type == TYPE_INT) {
+      std::sort(array->ints.begin(), array->ints.end());
+    } else {
+      std::sort(array->floats.begin(), array->floats.end());
+    }
+    return new VoidValue();
+  } else if (identifier == "prefix_sum") {
+    expect_parameters(parameters, 1);
+    ArrayValue *array = array_parameter(parameters[0]);
+    stats.builtin_calls++;
+    if (array->element_type == TYPE_INT) {
+      kernels->prefix_sum_int(array->ints.data(), array->size());
+    } else {
+      kernels->prefix_sum_float(array->floats.data(), array->size());
+    }
+    return new VoidValue();
+  }
+
+  return nullptr;
+}
+
+void Interpreter::format_parameters(const std::vector<Value *> &parameters) {
+  if (parameters.empty()) {
+    throw std::runtime_error("Too few parameters. Expected: at least 1, Actual: 0");
+  }
+  expect_type(parameters[0], TYPE_STRING);
+  format_buffer.clear();
+  format_values(static_cast<StringValue *>(parameters[0])->value, parameters.data() + 1, parameters.size() - 1,
+                &format_buffer);
+}
+
+Value *Interpreter::evaluate_function(FunctionNode *call) {
+  const std::string &identifier = call->identifier.value;
+  size_t base = stack.size();
+  if (analyzer->calls_builtin(identifier)) {
+    auto *text = call->parameters.size() == 1 ? dynamic_cast<FunctionNode *>(call->parameters[0]) : nullptr;
+    if (identifier == "output" && text && text->identifier.value == "format" && analyzer->calls_builtin("format")) {
+      // output(format(...)) writes the formatted text straight from the buffer.
+      stats.nodes[NODE_FUNCTION]++;
+      std::vector<Value *> parameters;
+      for (Node *p : text->parameters) {
+        parameters.push_back(evaluate(p));
       }
+      format_parameters(parameters);
+      stats.builtin_calls += 2;
+      std::cout << format_buffer << std::endl;
+      return new VoidValue();
+    }
+
+    std::vector<Value *> parameters;
+    for (Node *p : call->parameters) {
+      parameters.push_back(evaluate(p));
+    }
+    if (Value *result = evaluate_builtin(identifier, parameters)) {
+      return result;
+    }
+    for (Value *v : parameters) {
+      push_binding({NO_SYMBOL, v, nullptr});
+    }
+  } else {
+    // Each argument is evaluated straight into its slot in the callee's scope.
+    // It stays unnamed until the call starts, so it cannot hide a variable the
+    // remaining arguments read.
+    for (Node *p : call->parameters) {
+      Value *v = evaluate(p);
+      push_binding({NO_SYMBOL, v, nullptr});
     }
   }
+  return call_function(call, base);
+}
+
+Value *Interpreter::call_function(FunctionNode *call, size_t base) {
+  const std::string &identifier = call->identifier.value;
+  size_t arguments = stack.size() - base;
 
-  FunctionNode *func = get_function_from_scope(identifier);
+  FunctionNode *func = get_function_from_scope(call->identifier.symbol);
 
   // Runtime error thrown if the function is not defined
   if (!func) {
     std::ostringstream msg;
     msg << "Function " << identifier << " is not defined in this scope";
     throw std::runtime_error(msg.str());
+  } else if (!func->body) {
+    throw std::runtime_error("Function " + identifier + " was called but its body was never parsed");
   }
 
   // Number of parameters must be equal.
-  if (func->parameters.size() != parameters.size()) {
+  if (func->parameters.size() != arguments) {
     std::ostringstream msg;
-    if (func->parameters.size() > parameters.size()) {
+    if (func->parameters.size() > arguments) {
       msg << "Too few arguments to function '";
     } else {
       msg << "Too many arguments to function '";
     }
     msg << identifier << "'. Expected: " << func->parameters.size() << " "
-        << "Actual: " << parameters.size();
+        << "Actual: " << arguments;
     throw std::runtime_error(msg.str());
   }
 
-  // Create a new scope for the function call.
-  scope_increase();
+  // Arguments to annotated parameters are checked before anything depends on them.
+  for (size_t i = 0; i < arguments; i++) {
+    auto *parameter = static_cast<VariableNode *>(func->parameters[i]);
+    if (parameter->annotation != TYPE_ANY) {
+      Binding &argument = stack[base + i];
+      argument.value = check_declared(parameter->annotation, argument.value, "Parameter", parameter->identifier.value);
+      argument.type = parameter->annotation;
+    }
+  }
+
+  // A pure function gives the same result for the same arguments.
+  std::string memo_key;
+  bool memoize = false;
+  if (func->is_pure) {
+    std::vector<Value *> values;
+    for (size_t i = base; i < stack.size(); i++) {
+      values.push_back(stack[i].value);
+    }
+    memoize = MemoCache::make_key(func, values, &memo_key);
+  }
+  if (memoize) {
+    if (Value *cached = memo.find(memo_key)) {
+      stack.resize(base);
+      return cached;
+    }
+  }
+
+  // Create a new scope for the function call, starting with the arguments.
+  stats.function_calls++;
+  scope_increase(arguments);
 
   if (debug_mode) {
     std::cout << "Defining parameters..." << std::endl;
   }
 
-  // Define temporary parameter variables in new scope
-  for (size_t i = 0; i < parameters.size(); i++) {
-    Node *p = func->parameters[i];
-    if (auto *parameter = dynamic_cast<VariableNode *>(p)) {
-      // Assign each parameter's respective values being passed
-      TerminalNode *value = new TerminalNode(parameters[i]);
-      VariableNode *parameter_variable =
-          new VariableNode(parameter->identifier, value, false);
-      scope[scope_index].push_back(parameter_variable);
-    } else {
-      throw std::runtime_error("Function parameter must be an identifier");
-    }
+  // Parameter names were checked to be identifiers when the function was defined.
+  for (size_t i = 0; i < arguments; i++) {
+    stack[base + i].name = static_cast<VariableNode *>(func->parameters[i])->identifier.symbol;
   }
 
   if (debug_mode) {
@@ -246,11 +903,28 @@ Value *Interpreter::evaluate_function(std::string identifier,
   }
 
   Value *ret = evaluate(func->body);
+  if (func->return_type != TYPE_ANY) {
+    ret = check_declared(func->return_type, ret, "Return value of", identifier);
+  }
 
   scope_decrease();
+  if (memoize) {
+    memo.insert(memo_key, ret);
+  }
   return ret;
 }
 
+/**
+ * Marks a string as reachable from more than one place, so it is never changed
+ * in place again. Used for values read from variables and literals.
+ */
+static Value *share(Value *value) {
+  if (value->type == TYPE_STRING) {
+    static_cast<StringValue *>(value)->shared = true;
+  }
+  return value;
+}
+
 Value *Interpreter::evaluate(Node *node) {
   if (!node) {
     throw std::runtime_error(
@@ -263,10 +937,14 @@ Value *Interpreter::evaluate(Node *node) {
 
   // Function Body
   if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    stats.nodes[NODE_BLOCK]++;
     Value *ret = new VoidValue();
     for (Node *s : bn->statements) {
       if (auto *is_return = dynamic_cast<UnaryNode *>(s)) {
         if (is_return->token.type == RETURN) {
+          if (coverage_counts && s->statement >= 0) {
+            coverage_counts[s->statement]++;
+          }
           ret = evaluate(is_return);
           break;
         } else {
@@ -279,59 +957,349 @@ Value *Interpreter::evaluate(Node *node) {
     return ret;
 
   } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    stats.nodes[NODE_VARIABLE]++;
     if (debug_mode) {
       std::cout << "Scope: " << std::endl;
       print_scope();
     }
-    return get_variable_value(vn->identifier.value);
+    return share(get_variable_value(vn->identifier.symbol));
 
   } else if (auto *tn = dynamic_cast<TerminalNode *>(node)) {
-    return tn->v;
+    stats.nodes[NODE_TERMINAL]++;
+    return share(tn->v);
 
   } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    stats.nodes[NODE_UNARY]++;
     Value *child = evaluate(un->child);
+    count_operator(un->token.type, child, nullptr);
     return child->apply_operator(un->token,
                                  nullptr); // Unary operation applies to child,
                                            // therefore no need for 2nd node.
 
   } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    if (auto *typed = dynamic_cast<TypedBinaryNode *>(bnn)) {
+      return evaluate_typed(typed);
+    }
+    stats.nodes[NODE_BINARY]++;
+    // && and || only evaluate their right-hand side when it decides the result.
+    if (bnn->token.type == AND || bnn->token.type == OR) {
+      bool result;
+      Value *other = evaluate_condition(bnn, &result);
+      return other ? other : new BoolValue(result);
+    }
+
     Value *left = evaluate(bnn->left);
     Value *right = evaluate(bnn->right);
+    count_operator(bnn->token.type, left, right);
+
+    // The string built so far by a chain like "a" + b + "c" belongs to this
+    // expression alone, so the rest of the chain is appended to it.
+    if (bnn->token.type == ADD && left->type == TYPE_STRING && left != right &&
+        !static_cast<StringValue *>(left)->shared) {
+      static_cast<StringValue *>(left)->append(right);
+      stats.strings_appended++;
+      return left;
+    }
     return left->apply_operator(bnn->token, right);
 
   } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    stats.nodes[NODE_FUNCTION]++;
     if (debug_mode) {
       std::cout << "Scope: " << std::endl;
       print_scope();
     }
-    std::vector<Value *> parameters;
-    for (Node *p : fnn->parameters) {
-      parameters.push_back(evaluate(p));
-    }
+    return evaluate_function(fnn);
+
+  } else {
+    return nullptr;
+  }
+}
 
-    return evaluate_function(fnn->identifier.value, parameters);
+/**
+ * Compares two numbers or two strings directly, the same way apply_operator would.
+ * @return true if the operands could be compared without apply_operator.
+ */
+static bool compare_values(TokenType op, Value *left, Value *right, bool *result) {
+  auto *left_string = dynamic_cast<StringValue *>(left);
+  auto *right_string = dynamic_cast<StringValue *>(right);
+  if (left_string && right_string) {
+    if (op == EQUAL || op == NOT_EQUAL) {
+      *result = left_string->equals(right_string) == (op == EQUAL);
+      return true;
+    }
+    return false;
+  }
 
+  // Mixed int and float comparisons are carried out as doubles.
+  double a, b;
+  if (auto *i = dynamic_cast<IntValue *>(left)) {
+    a = i->value;
+  } else if (auto *f = dynamic_cast<FloatValue *>(left)) {
+    a = f->value;
   } else {
+    return false;
+  }
+  if (auto *i = dynamic_cast<IntValue *>(right)) {
+    b = i->value;
+  } else if (auto *f = dynamic_cast<FloatValue *>(right)) {
+    b = f->value;
+  } else {
+    return false;
+  }
+
+  switch (op) {
+  case EQUAL: *result = a == b; return true;
+  case NOT_EQUAL: *result = a != b; return true;
+  case LESS_THAN: *result = a < b; return true;
+  case GREATER_THAN: *result = a > b; return true;
+  case LESS_THAN_OR_EQUAL: *result = a <= b; return true;
+  case GREATER_THAN_OR_EQUAL: *result = a >= b; return true;
+  default: return false;
+  }
+}
+
+Value *Interpreter::evaluate_condition(Node *node, bool *result) {
+  if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    auto *typed = dynamic_cast<TypedBinaryNode *>(bnn);
+    if (typed && typed->type == TYPE_BOOL) {
+      *result = compare_typed(typed);
+      return nullptr;
+    }
+    switch (bnn->token.type) {
+    case AND:
+    case OR: {
+      bool left;
+      if (Value *other = evaluate_condition(bnn->left, &left)) {
+        // Non-boolean operand, apply_operator reports the error.
+        Value *right = evaluate(bnn->right);
+        count_operator(bnn->token.type, other, right);
+        return other->apply_operator(bnn->token, right);
+      }
+      if (left == (bnn->token.type == OR)) {
+        *result = left;
+        return nullptr;
+      }
+
+      bool right;
+      if (Value *other = evaluate_condition(bnn->right, &right)) {
+        return BoolValue(left).apply_operator(bnn->token, other);
+      }
+      *result = right;
+      return nullptr;
+    }
+    case EQUAL:
+    case NOT_EQUAL:
+    case LESS_THAN:
+    case GREATER_THAN:
+    case LESS_THAN_OR_EQUAL:
+    case GREATER_THAN_OR_EQUAL: {
+      Value *left = evaluate(bnn->left);
+      Value *right = evaluate(bnn->right);
+      if (compare_values(bnn->token.type, left, right, result)) {
+        return nullptr;
+      }
+      count_operator(bnn->token.type, left, right);
+      Value *value = left->apply_operator(bnn->token, right);
+      if (auto *b = dynamic_cast<BoolValue *>(value)) {
+        *result = b->value;
+        return nullptr;
+      }
+      return value;
+    }
+    default:
+      break;
+    }
+
+  } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    if (un->token.type == NOT) {
+      bool child;
+      if (Value *other = evaluate_condition(un->child, &child)) {
+        count_operator(un->token.type, other, nullptr);
+        return other->apply_operator(un->token, nullptr);
+      }
+      *result = !child;
+      return nullptr;
+    }
+  }
+
+  Value *value = evaluate(node);
+  if (auto *b = dynamic_cast<BoolValue *>(value)) {
+    *result = b->value;
     return nullptr;
   }
+  return value;
+}
+
+/**
+ * Applies an arithmetic operator to two doubles.
+ */
+static double apply_number(TokenType op, double a, double b) {
+  switch (op) {
+  case ADD: case ASSIGN_ADD: return a + b;
+  case SUBTRACT: case ASSIGN_SUBTRACT: return a - b;
+  case MULTIPLY: case ASSIGN_MULTIPLY: return a * b;
+  case DIVIDE: case ASSIGN_DIVIDE: return a / b;
+  default: throw std::runtime_error("Invalid operator for typed expression");
+  }
+}
+
+/**
+ * Applies an arithmetic operator to two ints.
+ */
+static int apply_int(const Token &op, int a, int b) {
+  switch (op.type) {
+  case ADD: case ASSIGN_ADD: return a + b;
+  case SUBTRACT: case ASSIGN_SUBTRACT: return a - b;
+  case MULTIPLY: case ASSIGN_MULTIPLY: return a * b;
+  case DIVIDE: case ASSIGN_DIVIDE: return a / b;
+  case MODULO: case ASSIGN_MODULO: return a % b;
+  default: throw std::runtime_error("Invalid operator for typed expression: " + op.value);
+  }
+}
+
+/**
+ * Applies a comparison operator to two numbers of the same type.
+ */
+template <typename T>
+static bool compare_numbers(const Token &op, T a, T b) {
+  switch (op.type) {
+  case EQUAL: return a == b;
+  case NOT_EQUAL: return a != b;
+  case LESS_THAN: return a < b;
+  case GREATER_THAN: return a > b;
+  case LESS_THAN_OR_EQUAL: return a <= b;
+  case GREATER_THAN_OR_EQUAL: return a >= b;
+  default: throw std::runtime_error("Invalid operator for typed comparison: " + op.value);
+  }
+}
+
+/**
+ * Unboxes a value type inference proved to be an int.
+ */
+static int int_value(Value *value) {
+  if (value->type != TYPE_INT) {
+    throw std::runtime_error("Inferred type 'int' does not match value of type '" + value->get_type() + "'");
+  }
+  return static_cast<IntValue *>(value)->value;
+}
+
+/**
+ * Unboxes a value type inference proved to be an int or a float.
+ */
+static double number_value(Value *value) {
+  if (value->type == TYPE_INT) {
+    return static_cast<IntValue *>(value)->value;
+  } else if (value->type != TYPE_FLOAT) {
+    throw std::runtime_error("Inferred type 'float' does not match value of type '" + value->get_type() + "'");
+  }
+  return static_cast<FloatValue *>(value)->value;
+}
+
+int Interpreter::evaluate_int(Node *node) {
+  if (auto *typed = dynamic_cast<TypedBinaryNode *>(node)) {
+    stats.nodes[NODE_BINARY]++;
+    stats.typed_operations++;
+    TokenType op = typed->token.type;
+    if (op == ASSIGN) {
+      return evaluate_int(typed->right);
+    } else if (typed->left_type == TYPE_FLOAT || typed->right_type == TYPE_FLOAT) {
+      // Subtracting, multiplying or dividing two floats gives an int.
+      return static_cast<int>(apply_number(op, evaluate_number(typed->left), evaluate_number(typed->right)));
+    }
+
+    int a = evaluate_int(typed->left);
+    int b = evaluate_int(typed->right);
+    return apply_int(typed->token, a, b);
+  }
+
+  return int_value(evaluate(node));
+}
+
+double Interpreter::evaluate_number(Node *node) {
+  if (auto *typed = dynamic_cast<TypedBinaryNode *>(node)) {
+    if (typed->type == TYPE_INT) {
+      return evaluate_int(typed);
+    }
+    stats.nodes[NODE_BINARY]++;
+    stats.typed_operations++;
+    if (typed->token.type == ASSIGN) {
+      return evaluate_number(typed->right);
+    }
+    return apply_number(typed->token.type, evaluate_number(typed->left), evaluate_number(typed->right));
+  }
+
+  return number_value(evaluate(node));
+}
+
+bool Interpreter::compare_typed(TypedBinaryNode *node) {
+  stats.nodes[NODE_BINARY]++;
+  stats.typed_operations++;
+  if (node->left_type == TYPE_INT && node->right_type == TYPE_INT) {
+    int a = evaluate_int(node->left);
+    int b = evaluate_int(node->right);
+    return compare_numbers(node->token, a, b);
+  }
+  double a = evaluate_number(node->left);
+  double b = evaluate_number(node->right);
+  return compare_numbers(node->token, a, b);
+}
+
+Value *Interpreter::evaluate_typed(TypedBinaryNode *node) {
+  switch (node->type) {
+  case TYPE_INT: return new IntValue(evaluate_int(node));
+  case TYPE_FLOAT: return new FloatValue(evaluate_number(node));
+  case TYPE_BOOL: return new BoolValue(compare_typed(node));
+  default: throw std::runtime_error("Invalid type for typed expression: " + node->token.value);
+  }
+}
+
+Value *Interpreter::apply_typed(TypedBinaryNode *node, Value *left, Value *right) {
+  stats.typed_operations++;
+  TokenType op = node->token.type;
+  switch (node->type) {
+  case TYPE_INT:
+    if (op == ASSIGN) {
+      return new IntValue(int_value(right));
+    } else if (node->left_type == TYPE_FLOAT || node->right_type == TYPE_FLOAT) {
+      return new IntValue(static_cast<int>(apply_number(op, number_value(left), number_value(right))));
+    }
+    return new IntValue(apply_int(node->token, int_value(left), int_value(right)));
+  case TYPE_FLOAT:
+    if (op == ASSIGN) {
+      return new FloatValue(number_value(right));
+    }
+    return new FloatValue(apply_number(op, number_value(left), number_value(right)));
+  case TYPE_BOOL:
+    if (node->left_type == TYPE_INT && node->right_type == TYPE_INT) {
+      return new BoolValue(compare_numbers(node->token, int_value(left), int_value(right)));
+    }
+    return new BoolValue(compare_numbers(node->token, number_value(left), number_value(right)));
+  default:
+    throw std::runtime_error("Invalid type for typed expression: " + node->token.value);
+  }
 }
 
 void Interpreter::visit(Node *node) {
   if (!node) {
     return;
   }
+  if (coverage_counts && node->statement >= 0) {
+    coverage_counts[node->statement]++;
+  }
 
   if (debug_mode) {
     std::cout << "Visiting: " << node->to_string() << std::endl;
   }
 
   if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    stats.nodes[NODE_BLOCK]++;
     for (Node *s : bn->statements) {
       visit(s);
     }
 
   } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
     if (vn->is_definition) {
+      stats.nodes[NODE_VARIABLE]++;
       VariableNode *variable;
       Value *stored_value;
       if (auto *assign = dynamic_cast<BinaryNode *>(vn->initializer)) {
@@ -339,17 +1307,29 @@ void Interpreter::visit(Node *node) {
         stored_value = evaluate(assign->right);
       } else {
         variable = dynamic_cast<VariableNode *>(vn->initializer);
-        stored_value = new VoidValue();
+        stored_value = default_value(variable->annotation);
       }
-      VariableNode *stored_variable = new VariableNode(
-          variable->identifier, new TerminalNode(stored_value), false);
-      scope[scope_index].push_back(stored_variable);
+      stored_value = check_declared(variable->annotation, stored_value, "Variable", variable->identifier.value);
+
+      // Redeclaring a variable in the same scope, such as in a loop body,
+      // reuses its slot instead of piling up shadowed copies.
+      for (size_t i = frames.back(); i < stack.size(); i++) {
+        Binding &existing = stack[i];
+        if (existing.name == variable->identifier.symbol && !existing.function) {
+          existing.value = stored_value;
+          existing.type = variable->annotation;
+          return;
+        }
+      }
+
+      push_binding({variable->identifier.symbol, stored_value, nullptr, variable->annotation});
     } else {
       evaluate(vn);
     }
 
   } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
     if (un->token.type == RETURN) {
+      stats.nodes[NODE_UNARY]++;
       if (scope_index == 0) {
         throw std::runtime_error("Return is not allowed here.");
       }
@@ -358,26 +1338,58 @@ void Interpreter::visit(Node *node) {
 
     if (auto *variable = dynamic_cast<VariableNode *>(un->child)) {
       Value *stored_value = evaluate(un);
-      set_variable_value(variable->identifier.value, stored_value);
+      set_variable_value(variable->identifier.symbol, stored_value);
     } else {
     }
 
   } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
-    if (is_assign(bnn->token.type)) {
+    if (auto *typed = dynamic_cast<TypedBinaryNode *>(bnn)) {
+      // The variable must exist before the right-hand side is evaluated.
+      Symbol identifier = dynamic_cast<VariableNode *>(bnn->left)->identifier.symbol;
+      Binding *b = get_variable_binding(identifier);
+      if (!b) {
+        get_variable_value(identifier); // Throws the undefined variable error
+      }
+      Value *stored_value = evaluate_typed(typed);
+      b->value = b->type == TYPE_ANY ? stored_value : check_declared(b->type, stored_value, "Variable", symbols.name(identifier));
+    } else if (is_assign(bnn->token.type)) {
+      stats.nodes[NODE_BINARY]++;
       Token assign_operator = bnn->token;
       VariableNode *variable = dynamic_cast<VariableNode *>(bnn->left);
-      Value *variable_value = get_variable_value(variable->identifier.value);
-      Value *stored_value =
-          variable_value->apply_operator(assign_operator, evaluate(bnn->right));
-      set_variable_value(variable->identifier.value, stored_value);
+      Value *variable_value = get_variable_value(variable->identifier.symbol);
+      Value *right = evaluate(bnn->right);
+      count_operator(assign_operator.type, variable_value, right);
+
+      // A string only this variable holds can grow in place, as long as
+      // evaluating the right-hand side did not replace or read it.
+      if (assign_operator.type == ASSIGN_ADD && variable_value->type == TYPE_STRING &&
+          !static_cast<StringValue *>(variable_value)->shared && variable_value != right &&
+          get_variable_value(variable->identifier.symbol) == variable_value) {
+        static_cast<StringValue *>(variable_value)->append(right);
+        stats.strings_appended++;
+        return;
+      }
+
+      Value *stored_value;
+      if (assign_operator.type == ASSIGN && right->type == TYPE_STRING && !static_cast<StringValue *>(right)->shared) {
+        // A freshly built string needs no copy.
+        stored_value = right;
+      } else if (assign_operator.type == ASSIGN && right->type == TYPE_ARRAY) {
+        // Arrays are shared, not copied.
+        stored_value = right;
+      } else {
+        stored_value = variable_value->apply_operator(assign_operator, right);
+      }
+      set_variable_value(variable->identifier.symbol, stored_value);
     } else {
       evaluate(bnn);
     }
   } else if (auto *in = dynamic_cast<IfNode *>(node)) {
-    Value *condition_value = evaluate(in->condition);
-    if (auto *bool_condition = dynamic_cast<BoolValue *>(condition_value)) {
+    stats.nodes[NODE_IF]++;
+    bool condition;
+    if (!evaluate_condition(in->condition, &condition)) {
       scope_increase();
-      if (bool_condition->value) {
+      if (condition) {
         visit(in->true_body);
       } else {
         visit(in->false_body);
@@ -387,34 +1399,415 @@ void Interpreter::visit(Node *node) {
       throw std::runtime_error("If condition must be a boolean expression");
     }
   } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    stats.nodes[NODE_WHILE]++;
     scope_increase();
+    bool try_compiled = jit != nullptr;
+    bool try_ir = ir != nullptr;
     while (true) {
-      BoolValue *condition = dynamic_cast<BoolValue *>(evaluate(wn->condition));
-      if (!condition || !condition->value) {
+      if (try_compiled && jit->is_hot(wn) && run_compiled_loop(wn, &try_compiled)) {
+        break;
+      }
+      if (!try_compiled && try_ir && ir->is_hot(wn) && run_ir_loop(wn, &try_ir)) {
+        break;
+      }
+      bool condition;
+      if (evaluate_condition(wn->condition, &condition) || !condition) {
         break;
       }
       visit(wn->body);
     }
     scope_decrease();
   } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    stats.nodes[NODE_FOR]++;
     scope_increase();
     visit(fn->initialization);
-    while (true) {
-      BoolValue *condition = dynamic_cast<BoolValue *>(evaluate(fn->condition));
-      if (!condition || !condition->value) {
-        break;
+    if (!run_counted_loop(fn)) {
+      bool try_compiled = jit != nullptr;
+      bool try_ir = ir != nullptr;
+      while (true) {
+        if (try_compiled && jit->is_hot(fn) && run_compiled_loop(fn, &try_compiled)) {
+          break;
+        }
+        if (!try_compiled && try_ir && ir->is_hot(fn) && run_ir_loop(fn, &try_ir)) {
+          break;
+        }
+        bool condition;
+        if (evaluate_condition(fn->condition, &condition) || !condition) {
+          break;
+        }
+        visit(fn->body);
+        visit(fn->update);
       }
-      visit(fn->body);
-      visit(fn->update);
     }
     scope_decrease();
   } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
     if (fnn->is_definition) {
-      scope[scope_index].push_back(fnn);
+      stats.nodes[NODE_FUNCTION]++;
+      for (Node *p : fnn->parameters) {
+        if (!dynamic_cast<VariableNode *>(p)) {
+          throw std::runtime_error("Function parameter must be an identifier");
+        }
+      }
+      push_binding({fnn->identifier.symbol, nullptr, fnn});
     } else {
       evaluate(fnn);
     }
   }
 }
 
-void Interpreter::execute() { visit(ast); }
+bool Interpreter::run_counted_loop(ForNode *fn) {
+  auto cached = counted_loops.find(fn);
+  if (cached == counted_loops.end()) {
+    cached = counted_loops.emplace(fn, analyzer->counted_loop(fn)).first;
+  }
+  const CountedLoop &loop = cached->second;
+  if (!loop.eligible) {
+    return false;
+  }
+
+  // Only integer loops are specialized; anything else takes the generic path.
+  Value **slot = get_variable_slot(symbols.find(loop.variable));
+  auto *start = slot ? dynamic_cast<IntValue *>(*slot) : nullptr;
+  auto *bound = start ? dynamic_cast<IntValue *>(evaluate(loop.bound)) : nullptr;
+  if (!bound) {
+    return false;
+  }
+
+  const int limit = bound->value;
+  const int step = loop.step;
+  int counter = start->value;
+  bool try_compiled = jit != nullptr;
+  bool try_ir = ir != nullptr;
+  while (true) {
+    bool running;
+    switch (loop.comparison) {
+    case LESS_THAN: running = counter < limit; break;
+    case GREATER_THAN: running = counter > limit; break;
+    case LESS_THAN_OR_EQUAL: running = counter <= limit; break;
+    case GREATER_THAN_OR_EQUAL: running = counter >= limit; break;
+    default: running = counter != limit; break;
+    }
+    if (!running) {
+      break;
+    }
+
+    // The counter only needs to be visible when something looks at it.
+    if (loop.body_reads) {
+      *slot = new IntValue(counter);
+    }
+    if (try_compiled && jit->is_hot(fn)) {
+      // Compiled code reads the counter from its variable, so it must be current.
+      *slot = new IntValue(counter);
+      if (run_compiled_loop(fn, &try_compiled)) {
+        return true;
+      }
+    }
+    if (!try_compiled && try_ir && ir->is_hot(fn)) {
+      // The IR runs the condition and update itself, starting from the variable.
+      *slot = new IntValue(counter);
+      if (run_ir_loop(fn, &try_ir)) {
+        return true;
+      }
+    }
+    visit(fn->body);
+    counter += step;
+  }
+
+  return true;
+}
+
+bool Interpreter::run_compiled_loop(Node *loop, bool *retry) {
+  CompiledLoop *compiled = jit->compile(loop, [this](const std::string &identifier) -> Value * {
+    Value **slot = get_variable_slot(symbols.find(identifier));
+    return slot ? *slot : nullptr;
+  });
+  if (!compiled) {
+    *retry = false;
+    return false;
+  }
+  if (debug_mode) {
+    std::cout << "Running compiled loop: " << loop->to_string() << std::endl;
+  }
+
+  // Variables declared by the loop body live in the loop's own scope; on the
+  // first iteration they do not exist yet and the loop keeps being interpreted.
+  std::vector<Value **> slots(compiled->variables.size());
+  for (size_t i = 0; i < compiled->variables.size(); i++) {
+    Symbol name = symbols.find(compiled->variables[i]);
+    if (compiled->declared[i]) {
+      for (size_t j = frames.back(); j < stack.size(); j++) {
+        Binding &existing = stack[j];
+        if (existing.name == name && !existing.function) {
+          slots[i] = &existing.value;
+        }
+      }
+    } else {
+      slots[i] = get_variable_slot(name);
+    }
+    if (!slots[i]) {
+      return false;
+    }
+    if ((*slots[i])->type != compiled->types[i]) {
+      stats.jit_guard_exits++;
+      *retry = false;
+      return false;
+    }
+  }
+
+  std::vector<int32_t> frame(compiled->frame_size);
+  for (size_t i = 0; i < slots.size(); i++) {
+    Value *value = *slots[i];
+    frame[compiled->slots[i]] = value->type == TYPE_INT ? dynamic_cast<IntValue *>(value)->value
+                                                        : dynamic_cast<BoolValue *>(value)->value;
+  }
+
+  stats.jit_entries++;
+  compiled->code(frame.data());
+
+  for (size_t i = 0; i < slots.size(); i++) {
+    if (compiled->written[i]) {
+      int32_t result = frame[compiled->slots[i]];
+      *slots[i] = compiled->types[i] == TYPE_INT ? static_cast<Value *>(new IntValue(result))
+                                                 : new BoolValue(result != 0);
+    }
+  }
+  return true;
+}
+
+Value *Interpreter::run_ir_call(IrInstruction *instruction, const std::vector<Value *> &values) {
+  auto *call = static_cast<FunctionNode *>(instruction->node);
+  const std::string &identifier = call->identifier.value;
+  stats.nodes[NODE_FUNCTION]++;
+  size_t base = stack.size();
+  if (analyzer->calls_builtin(identifier)) {
+    std::vector<Value *> parameters;
+    for (IrInstruction *argument : instruction->operands) {
+      parameters.push_back(share(values[argument->id]));
+    }
+    if (Value *result = evaluate_builtin(identifier, parameters)) {
+      return result;
+    }
+  }
+  for (IrInstruction *argument : instruction->operands) {
+    push_binding({NO_SYMBOL, share(values[argument->id]), nullptr});
+  }
+  return call_function(call, base);
+}
+
+bool Interpreter::run_ir_loop(Node *loop, bool *retry) {
+  IrRegion *region = ir->compile(loop, [this](const std::string &identifier) -> Value * {
+    Value **slot = get_variable_slot(symbols.find(identifier));
+    return slot ? *slot : nullptr;
+  });
+  if (!region) {
+    *retry = false;
+    return false;
+  }
+
+  // As for compiled loops, variables the loop declares exist only after its first iteration.
+  std::vector<Value **> slots(region->variables.size());
+  for (size_t v = 0; v < region->variables.size(); v++) {
+    const IrVariable &variable = region->variables[v];
+    if (variable.local) {
+      continue;
+    }
+    Symbol name = symbols.find(variable.name);
+    if (variable.declared) {
+      for (size_t j = frames.back(); j < stack.size(); j++) {
+        Binding &existing = stack[j];
+        if (existing.name == name && !existing.function) {
+          slots[v] = &existing.value;
+        }
+      }
+      if (!slots[v]) {
+        return false;
+      }
+    } else if (!(slots[v] = get_variable_slot(name))) {
+      *retry = false;
+      return false;
+    }
+    if (variable.type != TYPE_NONE && (*slots[v])->type != variable.type) {
+      stats.ir_guard_exits++;
+      *retry = false;
+      return false;
+    }
+  }
+  if (debug_mode) {
+    std::cout << "Running IR loop: " << loop->to_string() << std::endl;
+  }
+  stats.ir_entries++;
+
+  std::vector<Value *> values(region->registers);
+  std::vector<Value *> merged;
+  IrBlock *from = nullptr;
+  IrBlock *block = region->blocks[0];
+  while (true) {
+    // Phis read their operands before any of them is written.
+    size_t edge = from ? std::find(block->predecessors.begin(), block->predecessors.end(), from) -
+                             block->predecessors.begin()
+                       : 0;
+    merged.clear();
+    size_t phis = 0;
+    while (block->instructions[phis]->op == IR_PHI) {
+      merged.push_back(values[block->instructions[phis]->operands[edge]->id]);
+      phis++;
+    }
+    for (size_t p = 0; p < phis; p++) {
+      values[block->instructions[p]->id] = merged[p];
+    }
+
+    IrBlock *next = nullptr;
+    for (size_t n = phis; !next; n++) {
+      IrInstruction *i = block->instructions[n];
+      switch (i->op) {
+      case IR_CONST:
+        values[i->id] = i->constant;
+        break;
+      case IR_LOAD:
+        values[i->id] = *slots[i->variable];
+        break;
+      case IR_STORE:
+        *slots[i->variable] = share(values[i->operands[0]->id]);
+        break;
+      case IR_UNARY: {
+        Value *operand = values[i->operands[0]->id];
+        count_operator(i->token.type, operand, nullptr);
+        values[i->id] = operand->apply_operator(i->token, nullptr);
+        break;
+      }
+      case IR_BINARY: {
+        Value *left = values[i->operands[0]->id];
+        Value *right = values[i->operands[1]->id];
+        if (i->node) {
+          values[i->id] = apply_typed(static_cast<TypedBinaryNode *>(i->node), left, right);
+          break;
+        }
+        count_operator(i->token.type, left, right);
+        if (i->in_place && left->type == TYPE_STRING && left != right && !static_cast<StringValue *>(left)->shared) {
+          static_cast<StringValue *>(left)->append(right);
+          stats.strings_appended++;
+          values[i->id] = left;
+        } else {
+          values[i->id] = left->apply_operator(i->token, right);
+        }
+        break;
+      }
+      case IR_ASSIGN: {
+        Value *old = values[i->operands[0]->id];
+        Value *right = values[i->operands[1]->id];
+        if (i->node) {
+          values[i->id] = apply_typed(static_cast<TypedBinaryNode *>(i->node), old, right);
+          break;
+        }
+        count_operator(i->token.type, old, right);
+        TokenType op = i->token.type;
+        if (i->in_place && op == ASSIGN_ADD && old->type == TYPE_STRING && old != right &&
+            !static_cast<StringValue *>(old)->shared) {
+          static_cast<StringValue *>(old)->append(right);
+          stats.strings_appended++;
+          values[i->id] = old;
+        } else if (op == ASSIGN && ((i->in_place && right->type == TYPE_STRING &&
+                                     !static_cast<StringValue *>(right)->shared) ||
+                                    right->type == TYPE_ARRAY)) {
+          values[i->id] = right;
+        } else {
+          values[i->id] = old->apply_operator(i->token, right);
+        }
+        break;
+      }
+      case IR_CALL:
+        values[i->id] = run_ir_call(i, values);
+        break;
+      case IR_LOOP:
+        visit(i->node);
+        break;
+      case IR_PHI:
+        break;
+      case IR_JUMP:
+        next = i->targets[0];
+        break;
+      case IR_BRANCH: {
+        if (auto *condition = dynamic_cast<BoolValue *>(values[i->operands[0]->id])) {
+          next = condition->value ? i->targets[0] : i->targets[1];
+        } else if (i->branch == BRANCH_IF) {
+          throw std::runtime_error("If condition must be a boolean expression");
+        } else {
+          next = i->branch == BRANCH_LOOP ? i->targets[1] : i->targets[2];
+        }
+        break;
+      }
+      case IR_EXIT:
+        return true;
+      }
+    }
+    from = block;
+    block = next;
+  }
+}
+
+void Interpreter::save_checkpoint() {
+  // Only the global scope is saved, so the program must be between two top-level statements.
+  auto *statement = next_statement ? dynamic_cast<FunctionNode *>(ast->statements[next_statement - 1]) : nullptr;
+  if (scope_index != 0 || !statement || statement->identifier.value != "checkpoint") {
+    throw std::runtime_error("checkpoint() must be a statement of its own at the top level");
+  }
+  if (files.any_open()) {
+    throw std::runtime_error("checkpoint() cannot save the program while files are open");
+  }
+
+  save_snapshot(snapshot_path, {ast, next_statement, stack, random});
+  if (debug_mode) {
+    std::cout << "Saved snapshot to " << snapshot_path << std::endl;
+  }
+}
+
+void Interpreter::execute() {
+  if (debug_mode) {
+    std::cout << "Visiting: " << ast->to_string() << std::endl;
+  }
+  stats.nodes[NODE_BLOCK]++;
+
+  // Top-level statements run one at a time so a checkpoint knows where to continue.
+  while (next_statement < ast->statements.size()) {
+    visit(ast->statements[next_statement++]);
+  }
+  if (per_line) {
+    run_lines();
+  }
+}
+
+void Interpreter::set_trace(Trace *trace) {
+  this->trace = trace;
+}
+
+void Interpreter::call_hook(FunctionNode *call, Value *argument) {
+  if (!get_function_from_scope(call->identifier.symbol)) {
+    return;
+  }
+  size_t base = stack.size();
+  if (argument) {
+    push_binding({NO_SYMBOL, argument, nullptr});
+  }
+  call_function(call, base);
+}
+
+void Interpreter::run_lines() {
+  auto hook = [](const std::string &identifier) {
+    return FunctionNode({IDENTIFIER, identifier, 0, symbols.intern(identifier)}, {}, nullptr, false);
+  };
+  FunctionNode on_begin = hook(line_hooks[0]);
+  FunctionNode on_line = hook(line_hooks[1]);
+  FunctionNode on_end = hook(line_hooks[2]);
+  if (!get_function_from_scope(on_line.identifier.symbol)) {
+    throw std::runtime_error("Function on_line(line) must be defined to run with -n");
+  }
+
+  call_hook(&on_begin, nullptr);
+  // Lines are read straight out of the input buffer; only the string handed
+  // to on_line is copied.
+  std::string_view line;
+  while (read_input(&line)) {
+    call_hook(&on_line, new StringValue(std::string(line)));
+  }
+  call_hook(&on_end, nullptr);
+}
@@ -0,0 +1,1365 @@
+#include "../include/ir.h"
+#include "../include/stats.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <set>
+#include <sstream>
+
+IrBlock::~IrBlock() {
+  for (IrInstruction *i : instructions) {
+    delete i;
+  }
+}
+
+IrRegion::~IrRegion() {
+  for (IrBlock *b : blocks) {
+    delete b;
+  }
+}
+
+namespace {
+
+/// Thrown while a loop is translated when it uses something the IR cannot express.
+struct Unsupported {
+  std::string reason;
+};
+
+/**
+ * Finds the variable a declaration introduces.
+ */
+VariableNode *declared_variable(VariableNode *vn) {
+  auto *assign = dynamic_cast<BinaryNode *>(vn->initializer);
+  return dynamic_cast<VariableNode *>(assign ? assign->left : vn->initializer);
+}
+
+/**
+ * Finds the type an expression is known to have before the loop runs.
+ * @return The type of a literal or of a node typed by inference, TYPE_ANY otherwise.
+ */
+ValueType static_type(Node *node) {
+  if (auto *tn = dynamic_cast<TerminalNode *>(node)) {
+    return tn->v->type;
+  } else if (auto *typed = dynamic_cast<TypedBinaryNode *>(node)) {
+    return typed->type;
+  } else if (auto *typed = dynamic_cast<TypedVariableNode *>(node)) {
+    return typed->type;
+  }
+  return TYPE_ANY;
+}
+
+/**
+ * Collects the names a statement declares in the scope it runs in, without
+ * looking into the scopes it opens itself.
+ */
+void collect_declarations(Node *node, std::set<std::string> *names) {
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    for (Node *s : bn->statements) {
+      collect_declarations(s, names);
+    }
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    VariableNode *variable = vn->is_definition ? declared_variable(vn) : nullptr;
+    if (variable) {
+      names->insert(variable->identifier.value);
+    }
+  }
+}
+
+/**
+ * Collects every variable name under a node, and separately the names that
+ * are declared inside a scope nested in the loop being translated.
+ * @param depth Number of scopes opened inside the loop so far.
+ */
+void collect_names(Node *node, int depth, std::set<std::string> *mentioned, std::set<std::string> *nested) {
+  if (!node) {
+    return;
+  }
+
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    for (Node *s : bn->statements) {
+      collect_names(s, depth, mentioned, nested);
+    }
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    if (vn->is_definition) {
+      auto *assign = dynamic_cast<BinaryNode *>(vn->initializer);
+      collect_names(assign ? assign->right : nullptr, depth, mentioned, nested);
+      if (VariableNode *variable = declared_variable(vn)) {
+        mentioned->insert(variable->identifier.value);
+        if (depth > 0) {
+          nested->insert(variable->identifier.value);
+        }
+      }
+    } else {
+      mentioned->insert(vn->identifier.value);
+    }
+  } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    collect_names(un->child, depth, mentioned, nested);
+  } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    collect_names(bnn->left, depth, mentioned, nested);
+    collect_names(bnn->right, depth, mentioned, nested);
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    collect_names(in->condition, depth, mentioned, nested);
+    collect_names(in->true_body, depth + 1, mentioned, nested);
+    collect_names(in->false_body, depth + 1, mentioned, nested);
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    collect_names(wn->condition, depth + 1, mentioned, nested);
+    collect_names(wn->body, depth + 1, mentioned, nested);
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    collect_names(fn->initialization, depth + 1, mentioned, nested);
+    collect_names(fn->condition, depth + 1, mentioned, nested);
+    collect_names(fn->body, depth + 1, mentioned, nested);
+    collect_names(fn->update, depth + 1, mentioned, nested);
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    if (!fnn->is_definition) {
+      for (Node *p : fnn->parameters) {
+        collect_names(p, depth, mentioned, nested);
+      }
+    }
+  }
+}
+
+/**
+ * Translates one loop into SSA form while walking its AST, placing phis with
+ * the on-the-fly construction of Braun et al.: a variable read looks for a
+ * definition in the current block, then in its predecessors, and blocks whose
+ * predecessors are not all known yet get placeholder phis that are filled in
+ * once the block is sealed.
+ */
+class Builder {
+public:
+  Builder(Node *loop, Analyzer *analyzer, const Jit *jit)
+      : region(new IrRegion()), analyzer(analyzer), jit(jit), entry(), current() {
+    region->loop = loop;
+  }
+
+  /**
+   * Translates the loop.
+   * @return The region, owned by the caller.
+   * @throws Unsupported if the loop uses something the IR cannot express.
+   */
+  IrRegion *build() {
+    entry = new_block();
+    sealed.insert(entry);
+    current = entry;
+
+    collect_names(region->loop, -1, &mentioned, &nested);
+    loop(region->loop, true);
+
+    // Everything the loop changed is written back for the code after it.
+    for (const auto &named : slots) {
+      IrInstruction *value = read(named.second, current);
+      if (value->op != IR_LOAD || value->variable != named.second) {
+        store(named.second, value);
+      }
+    }
+    emit(make(IR_EXIT, {}));
+    region->registers = next_id;
+    return region;
+  }
+
+  IrRegion *region;
+
+private:
+  /**
+   * Names visible in one scope of the loop.
+   */
+  struct Scope {
+    std::map<std::string, int> variables; ///< Variables declared so far, by name.
+    std::set<std::string> declarations;   ///< Every name the scope declares.
+    bool loop = false; ///< Whether the scope lasts for every iteration of a loop.
+  };
+
+  Analyzer *analyzer;
+  const Jit *jit;
+  IrBlock *entry;   ///< Block that runs once when the region is entered.
+  IrBlock *current; ///< Block instructions are appended to.
+  int next_id = 0;
+
+  std::vector<Scope> scopes;       ///< Open scopes; the first one is the loop's own.
+  std::map<std::string, int> slots; ///< Slot variables by name.
+  std::set<std::string> mentioned;  ///< Every name the loop refers to.
+  std::set<std::string> nested;     ///< Names declared by scopes nested in the loop.
+
+  std::vector<std::map<IrBlock *, IrInstruction *>> definitions; ///< Current value of each variable in each block.
+  std::set<IrBlock *> sealed; ///< Blocks whose predecessors are all known.
+  std::map<IrBlock *, std::vector<IrInstruction *>> incomplete; ///< Phis waiting for their block to be sealed.
+
+  IrBlock *new_block() {
+    auto *b = new IrBlock();
+    b->id = static_cast<int>(region->blocks.size());
+    region->blocks.push_back(b);
+    return b;
+  }
+
+  IrInstruction *make(IrOp op, std::vector<IrInstruction *> operands) {
+    auto *i = new IrInstruction();
+    i->op = op;
+    i->id = next_id++;
+    i->operands = std::move(operands);
+    return i;
+  }
+
+  IrInstruction *emit(IrInstruction *i) {
+    i->block = current;
+    current->instructions.push_back(i);
+    return i;
+  }
+
+  /**
+   * Adds an instruction to the entry block, ahead of its jump into the loop.
+   */
+  IrInstruction *emit_entry(IrInstruction *i) {
+    i->block = entry;
+    entry->instructions.insert(entry->instructions.end() - 1, i);
+    return i;
+  }
+
+  void add_edge(IrBlock *to) {
+    if (std::find(to->predecessors.begin(), to->predecessors.end(), current) == to->predecessors.end()) {
+      to->predecessors.push_back(current);
+    }
+  }
+
+  void jump(IrBlock *target) {
+    IrInstruction *i = make(IR_JUMP, {});
+    i->targets[0] = target;
+    emit(i);
+    add_edge(target);
+  }
+
+  void branch(IrInstruction *condition, IrBranch kind, IrBlock *on_true, IrBlock *on_false, IrBlock *other = nullptr) {
+    IrInstruction *i = make(IR_BRANCH, {condition});
+    i->branch = kind;
+    i->targets[0] = on_true;
+    i->targets[1] = on_false;
+    i->targets[2] = other;
+    emit(i);
+    add_edge(on_true);
+    add_edge(on_false);
+    if (other) {
+      add_edge(other);
+    }
+  }
+
+  void store(int variable, IrInstruction *value) {
+    IrInstruction *i = make(IR_STORE, {value});
+    i->variable = variable;
+    emit(i);
+  }
+
+  IrInstruction *load(int variable, bool at_entry) {
+    IrInstruction *i = make(IR_LOAD, {});
+    i->variable = variable;
+    return at_entry ? emit_entry(i) : emit(i);
+  }
+
+  IrInstruction *constant(Value *value) {
+    if (value->type == TYPE_STRING) {
+      static_cast<StringValue *>(value)->shared = true;
+    }
+    IrInstruction *i = make(IR_CONST, {});
+    i->constant = value;
+    i->type = value->type;
+    return emit_entry(i);
+  }
+
+  int add_variable(const std::string &name, bool local, bool declared) {
+    region->variables.push_back({name, local, declared});
+    definitions.emplace_back();
+    return static_cast<int>(region->variables.size() - 1);
+  }
+
+  /**
+   * Finds the slot variable for a name, creating it on first use.
+   */
+  int slot(const std::string &name) {
+    auto found = slots.find(name);
+    if (found != slots.end()) {
+      return found->second;
+    }
+    int variable = add_variable(name, false, scopes[0].declarations.count(name) > 0);
+    slots[name] = variable;
+    return variable;
+  }
+
+  /**
+   * Finds the variable a name refers to at this point of the loop.
+   */
+  int resolve(const std::string &name) {
+    for (size_t s = scopes.size(); s-- > 1;) {
+      auto found = scopes[s].variables.find(name);
+      if (found != scopes[s].variables.end()) {
+        return found->second;
+      }
+      // A later iteration of a nested loop would see the declaration.
+      if (scopes[s].loop && scopes[s].declarations.count(name)) {
+        throw Unsupported{"'" + name + "' is used before it is declared in a nested loop"};
+      }
+    }
+    return slot(name);
+  }
+
+  void write(int variable, IrBlock *block, IrInstruction *value) {
+    definitions[variable][block] = value;
+  }
+
+  IrInstruction *read(int variable, IrBlock *block) {
+    auto found = definitions[variable].find(block);
+    if (found != definitions[variable].end()) {
+      return found->second;
+    }
+
+    IrInstruction *value;
+    if (!sealed.count(block)) {
+      value = phi(variable, block);
+      incomplete[block].push_back(value);
+    } else if (block->predecessors.size() == 1) {
+      value = read(variable, block->predecessors[0]);
+    } else if (block->predecessors.empty()) {
+      if (region->variables[variable].local) {
+        throw Unsupported{"'" + region->variables[variable].name + "' may be read before it is declared"};
+      }
+      value = load(variable, true);
+    } else {
+      // Breaks cycles through loops before looking at the predecessors.
+      value = phi(variable, block);
+      write(variable, block, value);
+      fill_phi(value);
+    }
+    write(variable, block, value);
+    return value;
+  }
+
+  IrInstruction *phi(int variable, IrBlock *block) {
+    IrInstruction *i = make(IR_PHI, {});
+    i->variable = variable;
+    i->block = block;
+    auto position = block->instructions.begin();
+    while (position != block->instructions.end() && (*position)->op == IR_PHI) {
+      ++position;
+    }
+    block->instructions.insert(position, i);
+    return i;
+  }
+
+  void fill_phi(IrInstruction *phi) {
+    for (IrBlock *predecessor : phi->block->predecessors) {
+      phi->operands.push_back(read(phi->variable, predecessor));
+    }
+  }
+
+  void seal(IrBlock *block) {
+    // Filling a phi can add more placeholders to the same block.
+    for (size_t i = 0; i < incomplete[block].size(); i++) {
+      fill_phi(incomplete[block][i]);
+    }
+    incomplete.erase(block);
+    sealed.insert(block);
+  }
+
+  Scope open_scope(Node *body, bool is_loop) {
+    Scope scope;
+    scope.loop = is_loop;
+    collect_declarations(body, &scope.declarations);
+    return scope;
+  }
+
+  /**
+   * Writes the variables a function or nested loop reads back to their slots
+   * before it runs.
+   */
+  void spill(const Effects &effects) {
+    for (const std::set<std::string> *names : {&effects.reads, &effects.writes}) {
+      for (const std::string &name : *names) {
+        if (nested.count(name)) {
+          throw Unsupported{"'" + name + "' is declared inside the loop and used by code it calls"};
+        }
+      }
+    }
+    for (const std::string &name : effects.reads) {
+      auto found = slots.find(name);
+      if (found != slots.end()) {
+        IrInstruction *value = read(found->second, current);
+        if (value->op != IR_LOAD || value->variable != found->second) {
+          store(found->second, value);
+        }
+      }
+    }
+  }
+
+  /**
+   * Loads the variables a function or nested loop may have changed.
+   */
+  void reload(const Effects &effects) {
+    for (const std::string &name : effects.writes) {
+      if (mentioned.count(name)) {
+        int variable = slot(name);
+        write(variable, current, load(variable, false));
+      }
+    }
+  }
+
+  void loop(Node *node, bool root) {
+    auto *wn = dynamic_cast<WhileNode *>(node);
+    auto *fn = dynamic_cast<ForNode *>(node);
+    Node *condition = wn ? wn->condition : fn->condition;
+    BlockNode *body = wn ? wn->body : fn->body;
+    if (!condition) {
+      throw Unsupported{"loop without a condition"};
+    }
+
+    // Nested loops already compiled to native code keep running natively.
+    if (!root && jit && jit->compiled(node)) {
+      Effects effects = analyzer->effects(node);
+      if (effects.unknown_calls) {
+        throw Unsupported{"nested loop calls an undefined function"};
+      }
+      spill(effects);
+      IrInstruction *i = make(IR_LOOP, {});
+      i->node = node;
+      emit(i);
+      reload(effects);
+      return;
+    }
+
+    Scope scope = open_scope(body, true);
+    if (fn) {
+      collect_declarations(fn->initialization, &scope.declarations);
+    }
+    scopes.push_back(scope);
+    if (fn && !root) {
+      statement(fn->initialization);
+    }
+
+    IrLoop info;
+    info.preheader = current;
+    IrBlock *header = new_block();
+    size_t first = region->blocks.size() - 1;
+    jump(header);
+
+    current = header;
+    IrInstruction *test = expression(condition);
+    IrBlock *inside = new_block();
+    IrBlock *exit = new_block();
+    branch(test, BRANCH_LOOP, inside, exit);
+    seal(inside);
+
+    current = inside;
+    statement(body);
+    if (fn) {
+      statement(fn->update);
+    }
+    jump(header);
+    seal(header);
+    seal(exit);
+
+    info.header = header;
+    for (size_t b = first; b < region->blocks.size(); b++) {
+      if (region->blocks[b] != exit) {
+        info.blocks.push_back(region->blocks[b]);
+      }
+    }
+    region->loops.push_back(info);
+    if (!root) {
+      scopes.pop_back();
+    }
+    current = exit;
+  }
+
+  void if_statement(IfNode *in) {
+    IrInstruction *test = expression(in->condition);
+    IrBlock *on_true = new_block();
+    IrBlock *on_false = new_block();
+    IrBlock *join = new_block();
+    branch(test, BRANCH_IF, on_true, on_false);
+    seal(on_true);
+    seal(on_false);
+
+    for (Node *body : {in->true_body, in->false_body}) {
+      current = body == in->true_body ? on_true : on_false;
+      scopes.push_back(open_scope(body, false));
+      statement(body);
+      scopes.pop_back();
+      jump(join);
+    }
+    seal(join);
+    current = join;
+  }
+
+  /**
+   * Makes sure a value stored in a variable declared with a type already has
+   * that type: the interpreter would convert or reject it, while the IR would
+   * store it as it is.
+   * @param declared The annotation of the name, TYPE_NONE if it has none.
+   * @param type Type of the stored value, as far as it is known.
+   */
+  void check_annotation(const std::string &name, ValueType declared, ValueType type) {
+    if (declared != TYPE_NONE && (declared == TYPE_ANY || declared != type)) {
+      throw Unsupported{"'" + name + "' is declared with a type a value stored in it may not have"};
+    }
+  }
+
+  void declare(VariableNode *vn) {
+    auto *assign = dynamic_cast<BinaryNode *>(vn->initializer);
+    VariableNode *variable = declared_variable(vn);
+    if (!variable) {
+      throw Unsupported{"malformed declaration"};
+    } else if (variable->annotation != TYPE_ANY) {
+      check_annotation(variable->identifier.value, variable->annotation,
+                       assign ? static_type(assign->right) : TYPE_VOID);
+    }
+    IrInstruction *value = assign ? expression(assign->right) : constant(new VoidValue());
+
+    const std::string &name = variable->identifier.value;
+    int index;
+    if (scopes.size() == 1) {
+      index = slot(name);
+    } else {
+      Scope &scope = scopes.back();
+      auto found = scope.variables.find(name);
+      index = found != scope.variables.end() ? found->second : add_variable(name, true, false);
+      scope.variables[name] = index;
+    }
+    write(index, current, value);
+  }
+
+  void statement(Node *node) {
+    if (!node) {
+      return;
+    }
+
+    if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+      for (Node *s : bn->statements) {
+        statement(s);
+      }
+    } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+      if (vn->is_definition) {
+        declare(vn);
+      } else {
+        expression(vn);
+      }
+    } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+      if (un->token.type == RETURN) {
+        throw Unsupported{"return"};
+      }
+      // Unary statements only have an effect on variables.
+      if (auto *variable = dynamic_cast<VariableNode *>(un->child)) {
+        bool counts = un->token.type == INCREMENT || un->token.type == DECREMENT;
+        check_annotation(variable->identifier.value, analyzer->annotation(variable->identifier.value),
+                         counts ? TYPE_INT : TYPE_ANY);
+        int index = resolve(variable->identifier.value);
+        write(index, current, unary(un->token, read(index, current)));
+      }
+    } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+      auto *typed = dynamic_cast<TypedBinaryNode *>(bnn);
+      if (!is_assign(bnn->token.type)) {
+        if (typed) {
+          throw Unsupported{"typed expression statement"};
+        }
+        expression(bnn);
+        return;
+      }
+      auto *variable = dynamic_cast<VariableNode *>(bnn->left);
+      if (!variable) {
+        throw Unsupported{"assignment to something other than a variable"};
+      }
+      // The variable holds its declared type before the assignment.
+      ValueType declared = analyzer->annotation(variable->identifier.value);
+      check_annotation(variable->identifier.value, declared,
+                       typed ? typed->type : TypeInference::binary_type(bnn->token.type, declared, static_type(bnn->right)));
+      int index = resolve(variable->identifier.value);
+      IrInstruction *old = read(index, current);
+      IrInstruction *right = expression(bnn->right);
+      IrInstruction *i = make(IR_ASSIGN, {old, right});
+      i->token = bnn->token;
+      i->node = typed;
+      i->variable = index;
+      write(index, current, emit(i));
+    } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+      if_statement(in);
+    } else if (dynamic_cast<WhileNode *>(node) || dynamic_cast<ForNode *>(node)) {
+      loop(node, false);
+    } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+      if (fnn->is_definition) {
+        throw Unsupported{"function definition"};
+      }
+      call(fnn);
+    }
+  }
+
+  IrInstruction *unary(const Token &token, IrInstruction *operand) {
+    IrInstruction *i = make(IR_UNARY, {operand});
+    i->token = token;
+    return emit(i);
+  }
+
+  /**
+   * Translates && and ||. The right-hand side only runs when the left-hand
+   * side does not decide the result, or is not a bool and apply_operator has
+   * to report the error.
+   */
+  IrInstruction *logic(BinaryNode *bnn) {
+    IrInstruction *left = expression(bnn->left);
+    IrBlock *from = current;
+    IrBlock *rest = new_block();
+    IrBlock *join = new_block();
+    if (bnn->token.type == AND) {
+      branch(left, BRANCH_LOGIC, rest, join, rest);
+    } else {
+      branch(left, BRANCH_LOGIC, join, rest, rest);
+    }
+    seal(rest);
+
+    current = rest;
+    IrInstruction *right = expression(bnn->right);
+    IrInstruction *combined = make(IR_BINARY, {left, right});
+    combined->token = bnn->token;
+    emit(combined);
+    jump(join);
+    seal(join);
+
+    current = join;
+    IrInstruction *result = phi(-1, join);
+    for (IrBlock *predecessor : join->predecessors) {
+      result->operands.push_back(predecessor == from ? left : combined);
+    }
+    return result;
+  }
+
+  IrInstruction *call(FunctionNode *fnn) {
+    const std::string &name = fnn->identifier.value;
+    if (name == "checkpoint") {
+      throw Unsupported{"checkpoint()"};
+    }
+
+    std::vector<IrInstruction *> arguments;
+    for (Node *p : fnn->parameters) {
+      arguments.push_back(expression(p));
+    }
+
+    // Builtins never touch variables, user functions may use any the loop can see.
+    Effects effects;
+    if (!analyzer->calls_builtin(name)) {
+      effects = analyzer->call_effects(name);
+      if (effects.unknown_calls) {
+        throw Unsupported{"call to undefined function '" + name + "'"};
+      }
+      spill(effects);
+    }
+    IrInstruction *i = make(IR_CALL, arguments);
+    i->node = fnn;
+    emit(i);
+    reload(effects);
+    return i;
+  }
+
+  IrInstruction *expression(Node *node) {
+    if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+      if (vn->is_definition) {
+        throw Unsupported{"declaration inside an expression"};
+      }
+      IrInstruction *value = read(resolve(vn->identifier.value), current);
+      auto *typed = dynamic_cast<TypedVariableNode *>(vn);
+      if (typed && value->op == IR_LOAD) {
+        value->type = typed->type;
+      }
+      return value;
+    } else if (auto *tn = dynamic_cast<TerminalNode *>(node)) {
+      return constant(tn->v);
+    } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+      // A return inside an expression is the result of an inlined call.
+      return unary(un->token, expression(un->child));
+    } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+      auto *typed = dynamic_cast<TypedBinaryNode *>(bnn);
+      if (typed && is_assign(typed->token.type)) {
+        throw Unsupported{"typed assignment inside an expression"};
+      } else if (!typed && (bnn->token.type == AND || bnn->token.type == OR)) {
+        return logic(bnn);
+      }
+      IrInstruction *left = expression(bnn->left);
+      IrInstruction *right = expression(bnn->right);
+      IrInstruction *i = make(IR_BINARY, {left, right});
+      i->token = bnn->token;
+      i->node = typed;
+      return emit(i);
+    } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+      if (fnn->is_definition) {
+        throw Unsupported{"function definition"};
+      }
+      return call(fnn);
+    }
+    throw Unsupported{"unsupported expression"};
+  }
+};
+
+/**
+ * Checks whether a value of one type can be used where a typed operation
+ * expects another; ints are widened where a float is expected.
+ */
+bool fits(ValueType expected, ValueType actual) {
+  return actual == expected || (expected == TYPE_FLOAT && actual == TYPE_INT);
+}
+
+/**
+ * Checks whether an instruction always succeeds and has no effect besides
+ * producing its result, so it may be moved or dropped.
+ */
+bool is_safe(const IrInstruction *i) {
+  switch (i->op) {
+  case IR_CONST:
+  case IR_LOAD:
+  case IR_PHI:
+    return true;
+
+  case IR_UNARY: {
+    ValueType operand = i->operands[0]->type;
+    switch (i->token.type) {
+    case NEGATIVE:
+    case INCREMENT:
+    case DECREMENT:
+      return operand == TYPE_INT || operand == TYPE_FLOAT;
+    case NOT:
+      return operand == TYPE_BOOL;
+    case RETURN:
+      return operand == TYPE_INT || operand == TYPE_FLOAT || operand == TYPE_BOOL || operand == TYPE_ARRAY;
+    default:
+      return false;
+    }
+  }
+
+  case IR_BINARY:
+  case IR_ASSIGN: {
+    TokenType op = i->token.type;
+    ValueType left = i->operands[0]->type;
+    ValueType right = i->operands[1]->type;
+    if (op == DIVIDE || op == MODULO || op == ASSIGN_DIVIDE || op == ASSIGN_MODULO) {
+      return false;
+    } else if (auto *typed = static_cast<TypedBinaryNode *>(i->node)) {
+      return (op == ASSIGN || fits(typed->left_type, left)) && fits(typed->right_type, right);
+    } else if ((op == ADD || op == ASSIGN_ADD) && left == TYPE_STRING) {
+      return true; // Anything can be appended to a string
+    } else if (op == ASSIGN) {
+      return right != TYPE_VOID && right < VALUE_TYPE_COUNT;
+    }
+    ValueType result = TypeInference::binary_type(op, left, right);
+    return result != TYPE_ANY && result != TYPE_NONE;
+  }
+
+  default:
+    return false;
+  }
+}
+
+/**
+ * Computes the type of an instruction's result from its operands.
+ */
+ValueType result_type(const IrInstruction *i) {
+  switch (i->op) {
+  case IR_CONST:
+    return i->constant->type;
+  case IR_PHI: {
+    ValueType type = TYPE_NONE;
+    for (IrInstruction *operand : i->operands) {
+      type = TypeInference::join(type, operand->type);
+    }
+    return type;
+  }
+  case IR_UNARY: {
+    // Negating or stepping a float gives an int, like apply_operator does.
+    ValueType operand = i->operands[0]->type;
+    if (operand == TYPE_NONE) {
+      return TYPE_NONE;
+    } else if (i->token.type == NOT) {
+      return operand == TYPE_BOOL ? TYPE_BOOL : TYPE_ANY;
+    } else if (i->token.type == RETURN) {
+      // Returning a value gives the value itself.
+      return operand == TYPE_INT || operand == TYPE_FLOAT || operand == TYPE_BOOL || operand == TYPE_ARRAY ? operand
+                                                                                                             : TYPE_ANY;
+    }
+    return operand == TYPE_INT || operand == TYPE_FLOAT ? TYPE_INT : TYPE_ANY;
+  }
+  case IR_BINARY:
+  case IR_ASSIGN:
+    if (auto *typed = static_cast<TypedBinaryNode *>(i->node)) {
+      return typed->type;
+    } else if ((i->token.type == ADD || i->token.type == ASSIGN_ADD) && i->operands[0]->type == TYPE_STRING) {
+      return TYPE_STRING;
+    }
+    return TypeInference::binary_type(i->token.type, i->operands[0]->type, i->operands[1]->type);
+  default:
+    return i->type;
+  }
+}
+
+/**
+ * Calls a function for every instruction in a region.
+ */
+void for_each_instruction(IrRegion *region, const std::function<void(IrInstruction *)> &f) {
+  for (IrBlock *b : region->blocks) {
+    for (IrInstruction *i : b->instructions) {
+      f(i);
+    }
+  }
+}
+
+/**
+ * Makes every use of one instruction use another instead, then deletes it.
+ */
+void replace(IrRegion *region, IrInstruction *old, IrInstruction *with) {
+  for_each_instruction(region, [&](IrInstruction *i) {
+    std::replace(i->operands.begin(), i->operands.end(), old, with);
+  });
+  auto &code = old->block->instructions;
+  code.erase(std::find(code.begin(), code.end(), old));
+  delete old;
+}
+
+/**
+ * Finds the value an instruction merely copies.
+ * @return The copied value, or nullptr if the instruction computes something.
+ */
+IrInstruction *copied_value(IrInstruction *i) {
+  if (i->op == IR_PHI) {
+    IrInstruction *unique = nullptr;
+    for (IrInstruction *operand : i->operands) {
+      if (operand != i && operand != unique) {
+        if (unique) {
+          return nullptr;
+        }
+        unique = operand;
+      }
+    }
+    return unique;
+  } else if (i->op == IR_ASSIGN && i->token.type == ASSIGN) {
+    ValueType right = i->operands[1]->type;
+    auto *typed = static_cast<TypedBinaryNode *>(i->node);
+    if (typed ? typed->type == right : right != TYPE_VOID && right < VALUE_TYPE_COUNT) {
+      return i->operands[1];
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Lists the blocks control can continue at after a block.
+ */
+std::vector<IrBlock *> successors(const IrBlock *block) {
+  std::vector<IrBlock *> result;
+  for (IrBlock *target : block->terminator()->targets) {
+    if (target && std::find(result.begin(), result.end(), target) == result.end()) {
+      result.push_back(target);
+    }
+  }
+  return result;
+}
+
+/**
+ * Orders the blocks so each comes before its successors, except along back edges.
+ */
+std::vector<IrBlock *> reverse_postorder(IrRegion *region) {
+  std::vector<IrBlock *> order;
+  std::set<IrBlock *> visited;
+  std::function<void(IrBlock *)> visit = [&](IrBlock *b) {
+    visited.insert(b);
+    for (IrBlock *s : successors(b)) {
+      if (!visited.count(s)) {
+        visit(s);
+      }
+    }
+    order.push_back(b);
+  };
+  visit(region->blocks[0]);
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+/**
+ * Computes the immediate dominator of every reachable block, using the
+ * iterative algorithm of Cooper, Harvey and Kennedy.
+ * @return Immediate dominators by block id; the entry block dominates itself.
+ */
+std::vector<IrBlock *> dominators(IrRegion *region, const std::vector<IrBlock *> &order) {
+  std::vector<int> position(region->blocks.size(), -1);
+  for (size_t i = 0; i < order.size(); i++) {
+    position[order[i]->id] = static_cast<int>(i);
+  }
+
+  std::vector<IrBlock *> idom(region->blocks.size(), nullptr);
+  idom[order[0]->id] = order[0];
+  auto intersect = [&](IrBlock *a, IrBlock *b) {
+    while (a != b) {
+      while (position[a->id] > position[b->id]) {
+        a = idom[a->id];
+      }
+      while (position[b->id] > position[a->id]) {
+        b = idom[b->id];
+      }
+    }
+    return a;
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 1; i < order.size(); i++) {
+      IrBlock *b = order[i];
+      IrBlock *dominator = nullptr;
+      for (IrBlock *p : b->predecessors) {
+        if (idom[p->id]) {
+          dominator = dominator ? intersect(p, dominator) : p;
+        }
+      }
+      if (dominator != idom[b->id]) {
+        idom[b->id] = dominator;
+        changed = true;
+      }
+    }
+  }
+  return idom;
+}
+
+/**
+ * Describes what a pure instruction computes, so that two instructions with
+ * the same key compute the same value.
+ * @return The key, or an empty string if the instruction is not pure.
+ */
+std::string value_key(const IrInstruction *i) {
+  std::ostringstream key;
+  switch (i->op) {
+  case IR_CONST: {
+    Value *v = i->constant;
+    key << "const " << v->type << " ";
+    if (auto *f = dynamic_cast<FloatValue *>(v)) {
+      uint64_t bits;
+      memcpy(&bits, &f->value, sizeof(bits));
+      key << bits;
+    } else {
+      key << v->to_string();
+    }
+    return key.str();
+  }
+  case IR_UNARY:
+  case IR_BINARY:
+    key << i->op << " " << i->token.type << " " << i->node;
+    for (IrInstruction *operand : i->operands) {
+      key << " " << operand->id;
+    }
+    return key.str();
+  default:
+    return "";
+  }
+}
+
+/**
+ * Spells out one instruction for the listing.
+ */
+std::string format(const IrRegion *region, const IrInstruction *i) {
+  std::ostringstream out;
+  auto name = [&](int variable) { return variable < 0 ? std::string("logic") : region->variables[variable].name; };
+  auto value = [](const IrInstruction *operand) { return "%" + std::to_string(operand->id); };
+
+  switch (i->op) {
+  case IR_CONST:
+    out << value(i) << " = const ";
+    if (i->constant->type == TYPE_STRING) {
+      out << "\"" << i->constant->to_string() << "\"";
+    } else {
+      out << i->constant->to_string();
+    }
+    break;
+  case IR_LOAD:
+    out << value(i) << " = load " << name(i->variable);
+    break;
+  case IR_STORE:
+    out << "store " << name(i->variable) << ", " << value(i->operands[0]);
+    break;
+  case IR_UNARY:
+    out << value(i) << " = " << i->token.value << " " << value(i->operands[0]);
+    break;
+  case IR_BINARY:
+    out << value(i) << " = " << value(i->operands[0]) << " " << i->token.value << " " << value(i->operands[1]);
+    break;
+  case IR_ASSIGN:
+    out << value(i) << " = " << name(i->variable) << " " << value(i->operands[0]) << " " << i->token.value << " "
+        << value(i->operands[1]);
+    break;
+  case IR_CALL: {
+    out << value(i) << " = call " << static_cast<FunctionNode *>(i->node)->identifier.value << "(";
+    for (size_t k = 0; k < i->operands.size(); k++) {
+      out << (k ? ", " : "") << value(i->operands[k]);
+    }
+    out << ")";
+    break;
+  }
+  case IR_LOOP:
+    out << "native " << i->node->to_string() << " loop at line " << i->node->line;
+    break;
+  case IR_PHI:
+    out << value(i) << " = phi " << name(i->variable);
+    for (size_t k = 0; k < i->operands.size(); k++) {
+      out << (k ? ", " : " ") << "[" << value(i->operands[k]) << ", b" << i->block->predecessors[k]->id << "]";
+    }
+    break;
+  case IR_JUMP:
+    out << "jump b" << i->targets[0]->id;
+    break;
+  case IR_BRANCH: {
+    static const char *kinds[] = {"if", "loop", "logic"};
+    out << "branch " << kinds[i->branch] << " " << value(i->operands[0]) << ", b" << i->targets[0]->id << ", b"
+        << i->targets[1]->id;
+    if (i->targets[2]) {
+      out << ", otherwise b" << i->targets[2]->id;
+    }
+    break;
+  }
+  case IR_EXIT:
+    out << "exit";
+    break;
+  }
+
+  if (i->node && (i->op == IR_BINARY || i->op == IR_ASSIGN)) {
+    out << " typed";
+  }
+  if (i->in_place) {
+    out << " in place";
+  }
+  if (i->type < VALUE_TYPE_COUNT && i->op != IR_STORE && i->op != IR_LOOP && i->op < IR_JUMP) {
+    out << " : " << type_name(i->type);
+  }
+  return out.str();
+}
+
+} // namespace
+
+std::string IrRegion::to_string() const {
+  std::ostringstream out;
+  out << loop->to_string() << " loop at line " << loop->line << ": " << copies << " copies propagated, " << common
+      << " common subexpressions eliminated, " << hoisted << " instructions hoisted" << std::endl;
+  for (IrBlock *b : blocks) {
+    out << "b" << b->id << ":";
+    for (size_t k = 0; k < b->predecessors.size(); k++) {
+      out << (k ? ", b" : " <- b") << b->predecessors[k]->id;
+    }
+    out << std::endl;
+    for (IrInstruction *i : b->instructions) {
+      out << "  " << format(this, i) << std::endl;
+    }
+  }
+  return out.str();
+}
+
+int propagate_copies(IrRegion *region) {
+  int removed = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (IrBlock *b : region->blocks) {
+      for (size_t k = 0; k < b->instructions.size(); k++) {
+        IrInstruction *i = b->instructions[k];
+        if (IrInstruction *copy = copied_value(i)) {
+          replace(region, i, copy);
+        } else if (i->op == IR_STORE && i->operands[0]->op == IR_LOAD && i->operands[0]->variable == i->variable) {
+          // The variable still holds the value, nothing has changed it since it was loaded.
+          b->instructions.erase(b->instructions.begin() + k);
+          delete i;
+        } else {
+          continue;
+        }
+        k--;
+        removed++;
+        changed = true;
+      }
+    }
+
+    // Drop results nothing uses, as long as computing them could not fail.
+    std::map<IrInstruction *, int> uses;
+    for_each_instruction(region, [&](IrInstruction *i) {
+      for (IrInstruction *operand : i->operands) {
+        if (operand != i) {
+          uses[operand]++;
+        }
+      }
+    });
+    for (IrBlock *b : region->blocks) {
+      for (size_t k = 0; k < b->instructions.size(); k++) {
+        IrInstruction *i = b->instructions[k];
+        if (!uses[i] && is_safe(i)) {
+          b->instructions.erase(b->instructions.begin() + k);
+          delete i;
+          k--;
+          changed = true;
+        }
+      }
+    }
+  }
+  return removed;
+}
+
+void infer_types(IrRegion *region) {
+  // Loads and calls keep the type inference proved for the variable read, if any.
+  for_each_instruction(region, [](IrInstruction *i) {
+    if (i->op != IR_LOAD && i->op != IR_CALL) {
+      i->type = TYPE_NONE;
+    }
+  });
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for_each_instruction(region, [&](IrInstruction *i) {
+      ValueType type = result_type(i);
+      if (type != i->type) {
+        i->type = type;
+        changed = true;
+      }
+    });
+  }
+
+  for_each_instruction(region, [](IrInstruction *i) {
+    if (i->type == TYPE_NONE) {
+      i->type = TYPE_ANY;
+    }
+  });
+}
+
+int eliminate_common_subexpressions(IrRegion *region) {
+  std::vector<IrBlock *> order = reverse_postorder(region);
+  std::vector<IrBlock *> idom = dominators(region, order);
+  std::vector<std::vector<IrBlock *>> children(region->blocks.size());
+  for (IrBlock *b : order) {
+    if (idom[b->id] != b) {
+      children[idom[b->id]->id].push_back(b);
+    }
+  }
+
+  // Walk the dominator tree; a value computed in a block is available in every block it dominates.
+  int removed = 0;
+  std::map<std::string, IrInstruction *> available;
+  std::function<void(IrBlock *)> walk = [&](IrBlock *b) {
+    std::vector<std::string> added;
+    for (size_t k = 0; k < b->instructions.size(); k++) {
+      IrInstruction *i = b->instructions[k];
+      std::string key = value_key(i);
+      if (key.empty()) {
+        continue;
+      }
+      auto found = available.find(key);
+      if (found != available.end()) {
+        replace(region, i, found->second);
+        k--;
+        removed++;
+      } else {
+        available[key] = i;
+        added.push_back(key);
+      }
+    }
+    for (IrBlock *child : children[b->id]) {
+      walk(child);
+    }
+    for (const std::string &key : added) {
+      available.erase(key);
+    }
+  };
+  walk(order[0]);
+  return removed;
+}
+
+int hoist_loop_invariants(IrRegion *region) {
+  int hoisted = 0;
+  for (IrLoop &loop : region->loops) {
+    std::set<IrBlock *> inside(loop.blocks.begin(), loop.blocks.end());
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (IrBlock *b : loop.blocks) {
+        for (size_t k = 0; k < b->instructions.size(); k++) {
+          IrInstruction *i = b->instructions[k];
+          if ((i->op != IR_UNARY && i->op != IR_BINARY) || !is_safe(i)) {
+            continue;
+          }
+          bool invariant = std::none_of(i->operands.begin(), i->operands.end(),
+                                        [&](IrInstruction *operand) { return inside.count(operand->block) > 0; });
+          if (!invariant) {
+            continue;
+          }
+          b->instructions.erase(b->instructions.begin() + k);
+          auto &code = loop.preheader->instructions;
+          code.insert(code.end() - 1, i);
+          i->block = loop.preheader;
+          k--;
+          hoisted++;
+          changed = true;
+        }
+      }
+    }
+  }
+  return hoisted;
+}
+
+void plan_in_place(IrRegion *region) {
+  // Values that may be the same object at run time: a phi and its operands, an
+  // assignment or concatenation and the operand it may return, and every load
+  // of the same variable. Constants are shared, so nothing ever returns them in place.
+  std::vector<int> parent(region->registers);
+  std::iota(parent.begin(), parent.end(), 0);
+  std::function<int(int)> find = [&](int x) { return parent[x] == x ? x : parent[x] = find(parent[x]); };
+  auto unite = [&](IrInstruction *a, IrInstruction *b) { parent[find(a->id)] = find(b->id); };
+
+  std::map<int, IrInstruction *> loads;
+  std::vector<IrInstruction *> all;
+  for_each_instruction(region, [&](IrInstruction *i) {
+    all.push_back(i);
+    if (i->op == IR_PHI) {
+      for (IrInstruction *operand : i->operands) {
+        unite(i, operand);
+      }
+    } else if (i->op == IR_ASSIGN && !i->node && i->token.type == ASSIGN) {
+      unite(i, i->operands[1]);
+    } else if ((i->op == IR_ASSIGN && !i->node && i->token.type == ASSIGN_ADD) ||
+               (i->op == IR_BINARY && !i->node && i->token.type == ADD)) {
+      if (i->operands[0]->op != IR_CONST) {
+        unite(i, i->operands[0]);
+      }
+    } else if (i->op == IR_LOAD) {
+      auto first = loads.emplace(i->variable, i).first;
+      unite(i, first->second);
+    }
+  });
+  std::map<int, std::vector<IrInstruction *>> aliases;
+  for (IrInstruction *i : all) {
+    aliases[find(i->id)].push_back(i);
+  }
+
+  // Liveness of every value at the end of each block. A phi operand is used at
+  // the end of the predecessor it comes from.
+  size_t count = region->blocks.size();
+  std::vector<std::set<int>> live_in(count), live_out(count);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t n = count; n-- > 0;) {
+      IrBlock *b = region->blocks[n];
+      std::set<int> live;
+      for (IrBlock *s : successors(b)) {
+        live.insert(live_in[s->id].begin(), live_in[s->id].end());
+        size_t edge = std::find(s->predecessors.begin(), s->predecessors.end(), b) - s->predecessors.begin();
+        for (IrInstruction *i : s->instructions) {
+          if (i->op == IR_PHI) {
+            live.insert(i->operands[edge]->id);
+          }
+        }
+      }
+      live_out[n] = live;
+      for (size_t k = b->instructions.size(); k-- > 0;) {
+        IrInstruction *i = b->instructions[k];
+        live.erase(i->id);
+        if (i->op != IR_PHI) {
+          for (IrInstruction *operand : i->operands) {
+            live.insert(operand->id);
+          }
+        }
+      }
+      if (live != live_in[n]) {
+        live_in[n] = live;
+        changed = true;
+      }
+    }
+  }
+
+  for (IrBlock *b : region->blocks) {
+    std::set<int> live = live_out[b->id];
+    for (size_t k = b->instructions.size(); k-- > 0;) {
+      IrInstruction *i = b->instructions[k];
+      // The operand may be reused when nothing that could be the same object is needed later.
+      auto unused = [&](IrInstruction *operand, int variable) {
+        for (IrInstruction *alias : aliases[find(operand->id)]) {
+          if (alias == i) {
+            continue;
+          } else if (live.count(alias->id) || (alias->op == IR_LOAD && alias->variable != variable)) {
+            return false;
+          }
+        }
+        return true;
+      };
+      if (!i->node && i->op == IR_BINARY && i->token.type == ADD) {
+        i->in_place = unused(i->operands[0], -1);
+      } else if (!i->node && i->op == IR_ASSIGN && i->token.type == ASSIGN_ADD) {
+        i->in_place = unused(i->operands[0], i->variable);
+      } else if (!i->node && i->op == IR_ASSIGN && i->token.type == ASSIGN) {
+        i->in_place = unused(i->operands[1], -1);
+      }
+
+      live.erase(i->id);
+      if (i->op != IR_PHI) {
+        for (IrInstruction *operand : i->operands) {
+          live.insert(operand->id);
+        }
+      }
+    }
+  }
+}
+
+IrCompiler::IrCompiler(Analyzer *analyzer, const Jit *jit, bool dump)
+    : iterations(), regions(), analyzer(analyzer), jit(jit), dump(dump) {}
+
+IrCompiler::~IrCompiler() {
+  for (auto &entry : regions) {
+    delete entry.second;
+  }
+}
+
+bool IrCompiler::is_hot(Node *loop) {
+  return ++iterations[loop] >= THRESHOLD;
+}
+
+IrRegion *IrCompiler::compile(Node *loop, const std::function<Value *(const std::string &)> &lookup) {
+  auto cached = regions.find(loop);
+  if (cached != regions.end()) {
+    return cached->second;
+  }
+
+  Builder builder(loop, analyzer, jit);
+  IrRegion *region = nullptr;
+  std::string reason;
+  try {
+    region = builder.build();
+  } catch (const Unsupported &unsupported) {
+    delete builder.region;
+    reason = unsupported.reason;
+  }
+
+  if (region) {
+    // Values loaded on entry keep their current types; the interpreter checks
+    // them each time the region is entered.
+    for (IrInstruction *i : region->blocks[0]->instructions) {
+      if (i->op != IR_LOAD || i->type != TYPE_ANY) {
+        continue;
+      }
+      IrVariable &variable = region->variables[i->variable];
+      if (Value *value = lookup(variable.name)) {
+        i->type = variable.type = value->type;
+      }
+    }
+    infer_types(region);
+    region->copies = propagate_copies(region);
+    infer_types(region);
+    region->common = eliminate_common_subexpressions(region);
+    region->hoisted = hoist_loop_invariants(region);
+    plan_in_place(region);
+    stats.ir_compiled++;
+  } else {
+    stats.ir_failed++;
+  }
+  if (dump) {
+    if (region) {
+      std::cerr << region->to_string();
+    } else {
+      std::cerr << loop->to_string() << " loop at line " << loop->line << ": not compiled, " << reason << std::endl;
+    }
+  }
+
+  regions[loop] = region;
+  return region;
+}
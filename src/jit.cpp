@@ -0,0 +1,506 @@
+#include "../include/jit.h"
+#include "../include/stats.h"
+#include <cstring>
+#include <map>
+#include <set>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+namespace {
+
+const ValueType UNSUPPORTED = VALUE_TYPE_COUNT; ///< Marks an expression the JIT cannot compile.
+
+/**
+ * Appends x86-64 instructions to a buffer. Generated code keeps the frame
+ * pointer in rdi and computes every expression into eax, using ecx and the
+ * machine stack for the other operand of binary operators.
+ */
+class Assembler {
+public:
+  std::vector<uint8_t> code;
+
+  void emit(std::initializer_list<uint8_t> bytes) { code.insert(code.end(), bytes); }
+
+  void emit32(int32_t value) {
+    uint8_t bytes[4];
+    memcpy(bytes, &value, 4);
+    code.insert(code.end(), bytes, bytes + 4);
+  }
+
+  size_t position() const { return code.size(); }
+
+  // mov eax, imm32
+  void constant(int32_t value) { emit({0xB8}); emit32(value); }
+  // mov eax, [rdi + slot * 4]
+  void load(int slot) { emit({0x8B, 0x87}); emit32(slot * 4); }
+  // mov [rdi + slot * 4], eax
+  void store(int slot) { emit({0x89, 0x87}); emit32(slot * 4); }
+  // push rax
+  void push() { emit({0x50}); }
+  // mov ecx, eax; pop rax
+  void pop_operands() { emit({0x89, 0xC1, 0x58}); }
+  // test eax, eax
+  void test() { emit({0x85, 0xC0}); }
+  // ret
+  void ret() { emit({0xC3}); }
+  // mov rax, imm64; inc qword [rax]
+  void increment(uint64_t *counter) {
+    emit({0x48, 0xB8});
+    uint64_t address = reinterpret_cast<uint64_t>(counter);
+    uint8_t bytes[8];
+    memcpy(bytes, &address, 8);
+    code.insert(code.end(), bytes, bytes + 8);
+    emit({0x48, 0xFF, 0x00});
+  }
+
+  // jz/jnz/jmp rel32 with the target patched in later
+  size_t jump_if_zero() { emit({0x0F, 0x84}); emit32(0); return position() - 4; }
+  size_t jump_if_not_zero() { emit({0x0F, 0x85}); emit32(0); return position() - 4; }
+  size_t jump() { emit({0xE9}); emit32(0); return position() - 4; }
+
+  void jump_to(size_t target) {
+    emit({0xE9});
+    emit32(static_cast<int32_t>(target - (position() + 4)));
+  }
+
+  void patch(size_t at) {
+    int32_t relative = static_cast<int32_t>(position() - (at + 4));
+    memcpy(&code[at], &relative, 4);
+  }
+
+  /**
+   * Emits eax = eax <op> ecx for an integer operator.
+   * @return false if the operator is not supported.
+   */
+  bool arithmetic(TokenType op) {
+    switch (op) {
+    case ADD: case ASSIGN_ADD: emit({0x01, 0xC8}); return true;              // add eax, ecx
+    case SUBTRACT: case ASSIGN_SUBTRACT: emit({0x29, 0xC8}); return true;    // sub eax, ecx
+    case MULTIPLY: case ASSIGN_MULTIPLY: emit({0x0F, 0xAF, 0xC1}); return true; // imul eax, ecx
+    case DIVIDE: case ASSIGN_DIVIDE: emit({0x99, 0xF7, 0xF9}); return true;  // cdq; idiv ecx
+    case MODULO: case ASSIGN_MODULO: emit({0x99, 0xF7, 0xF9, 0x89, 0xD0}); return true; // cdq; idiv ecx; mov eax, edx
+    default: return false;
+    }
+  }
+
+  /**
+   * Emits eax = (eax <op> ecx) for a comparison operator.
+   * @return false if the operator is not a comparison.
+   */
+  bool compare(TokenType op) {
+    uint8_t condition;
+    switch (op) {
+    case EQUAL: condition = 0x94; break;                 // sete
+    case NOT_EQUAL: condition = 0x95; break;             // setne
+    case LESS_THAN: condition = 0x9C; break;             // setl
+    case GREATER_THAN_OR_EQUAL: condition = 0x9D; break; // setge
+    case LESS_THAN_OR_EQUAL: condition = 0x9E; break;    // setle
+    case GREATER_THAN: condition = 0x9F; break;          // setg
+    default: return false;
+    }
+    emit({0x39, 0xC8});            // cmp eax, ecx
+    emit({0x0F, condition, 0xC0}); // setcc al
+    emit({0x0F, 0xB6, 0xC0});      // movzx eax, al
+    return true;
+  }
+};
+
+/**
+ * Names declared by one scope inside the compiled loop, mirroring the scopes
+ * the interpreter would push for if statements and nested loops.
+ */
+struct CompilerScope {
+  std::map<std::string, int> locals; ///< Frame slot of each declared name.
+  std::set<std::string> referenced;  ///< Names resolved past this scope while it was open.
+};
+
+/**
+ * Translates one loop into machine code, or gives up as soon as it meets
+ * anything outside the supported subset.
+ */
+class LoopCompiler {
+public:
+  Assembler as;
+  CompiledLoop *loop;
+  const std::function<Value *(const std::string &)> &lookup;
+  std::vector<CompilerScope> scopes;
+  std::map<std::string, size_t> externals; ///< Index into loop->variables by name.
+  std::vector<ValueType> slot_types;
+  uint64_t *coverage; ///< Statement counters to increment, or nullptr.
+
+  LoopCompiler(CompiledLoop *loop, const std::function<Value *(const std::string &)> &lookup, uint64_t *coverage)
+      : as(), loop(loop), lookup(lookup), scopes(), externals(), slot_types(), coverage(coverage) {}
+
+  int new_slot(ValueType type) {
+    slot_types.push_back(type);
+    return slot_types.size() - 1;
+  }
+
+  /**
+   * Returns the frame slot of an interpreter variable, loading it on entry.
+   */
+  int external(const std::string &identifier, bool declared) {
+    auto found = externals.find(identifier);
+    if (found != externals.end()) {
+      loop->declared[found->second] = loop->declared[found->second] || declared;
+      return loop->slots[found->second];
+    }
+
+    Value *value = lookup(identifier);
+    if (!value || (value->type != TYPE_INT && value->type != TYPE_BOOL)) {
+      return -1;
+    }
+    int slot = new_slot(value->type);
+    externals[identifier] = loop->variables.size();
+    loop->variables.push_back(identifier);
+    loop->slots.push_back(slot);
+    loop->types.push_back(value->type);
+    loop->written.push_back(false);
+    loop->declared.push_back(declared);
+    return slot;
+  }
+
+  int resolve(const std::string &identifier) {
+    for (size_t i = scopes.size(); i-- > 0;) {
+      auto found = scopes[i].locals.find(identifier);
+      if (found != scopes[i].locals.end()) {
+        return found->second;
+      }
+      scopes[i].referenced.insert(identifier);
+    }
+    return external(identifier, false);
+  }
+
+  void mark_written(int slot) {
+    for (size_t i = 0; i < loop->slots.size(); i++) {
+      if (loop->slots[i] == slot) {
+        loop->written[i] = true;
+      }
+    }
+  }
+
+  ValueType expression(Node *node) {
+    if (auto *tn = dynamic_cast<TerminalNode *>(node)) {
+      if (auto *i = dynamic_cast<IntValue *>(tn->v)) {
+        as.constant(i->value);
+        return TYPE_INT;
+      } else if (auto *b = dynamic_cast<BoolValue *>(tn->v)) {
+        as.constant(b->value);
+        return TYPE_BOOL;
+      }
+      return UNSUPPORTED;
+
+    } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+      int slot = vn->is_definition ? -1 : resolve(vn->identifier.value);
+      if (slot < 0) {
+        return UNSUPPORTED;
+      }
+      as.load(slot);
+      return slot_types[slot];
+
+    } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+      ValueType type = expression(un->child);
+      if (un->token.type == NOT && type == TYPE_BOOL) {
+        as.emit({0x83, 0xF0, 0x01}); // xor eax, 1
+        return TYPE_BOOL;
+      } else if (un->token.type == INCREMENT && type == TYPE_INT) {
+        as.emit({0x83, 0xC0, 0x01}); // add eax, 1
+        return TYPE_INT;
+      } else if (un->token.type == DECREMENT && type == TYPE_INT) {
+        as.emit({0x83, 0xE8, 0x01}); // sub eax, 1
+        return TYPE_INT;
+      }
+      return UNSUPPORTED;
+
+    } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+      TokenType op = bnn->token.type;
+      if (op == AND || op == OR) {
+        if (expression(bnn->left) != TYPE_BOOL) {
+          return UNSUPPORTED;
+        }
+        as.test();
+        size_t done = op == AND ? as.jump_if_zero() : as.jump_if_not_zero();
+        if (expression(bnn->right) != TYPE_BOOL) {
+          return UNSUPPORTED;
+        }
+        as.patch(done);
+        return TYPE_BOOL;
+      }
+
+      // Assignments used as values do not store anything, leave them to the interpreter.
+      if (is_assign(op)) {
+        return UNSUPPORTED;
+      }
+
+      ValueType left = expression(bnn->left);
+      as.push();
+      ValueType right = expression(bnn->right);
+      as.pop_operands();
+      if (left == TYPE_INT && right == TYPE_INT) {
+        if (as.arithmetic(op)) {
+          return TYPE_INT;
+        }
+        return as.compare(op) ? TYPE_BOOL : UNSUPPORTED;
+      } else if (left == TYPE_BOOL && right == TYPE_BOOL && (op == EQUAL || op == NOT_EQUAL)) {
+        as.compare(op);
+        return TYPE_BOOL;
+      }
+      return UNSUPPORTED;
+    }
+
+    return UNSUPPORTED;
+  }
+
+  bool declaration(VariableNode *vn) {
+    auto *assign = dynamic_cast<BinaryNode *>(vn->initializer);
+    auto *variable = assign ? dynamic_cast<VariableNode *>(assign->left) : nullptr;
+    if (!variable || assign->token.type != ASSIGN) {
+      return false;
+    }
+    const std::string &identifier = variable->identifier.value;
+    ValueType type = expression(assign->right);
+    // The interpreter would convert or reject a value of another type than the annotation.
+    if (type == UNSUPPORTED || (variable->annotation != TYPE_ANY && variable->annotation != type)) {
+      return false;
+    }
+
+    int slot;
+    if (scopes.empty()) {
+      // The loop's own scope already holds this variable from earlier iterations.
+      slot = external(identifier, true);
+      mark_written(slot);
+    } else {
+      CompilerScope &current = scopes.back();
+      // A name used before its declaration would refer to another variable on
+      // the first pass than on later ones.
+      if (current.referenced.count(identifier)) {
+        return false;
+      }
+      auto found = current.locals.find(identifier);
+      slot = found != current.locals.end() ? found->second : new_slot(type);
+      current.locals[identifier] = slot;
+    }
+
+    if (slot < 0 || slot_types[slot] != type) {
+      return false;
+    }
+    as.store(slot);
+    return true;
+  }
+
+  /**
+   * Emits a loop: condition, body and optional update, repeated until the condition fails.
+   */
+  bool loop_body(Node *condition, BlockNode *body, Node *update) {
+    size_t top = as.position();
+    if (expression(condition) != TYPE_BOOL) {
+      return false;
+    }
+    as.test();
+    size_t exit = as.jump_if_zero();
+    if (!statement(body) || (update && !statement(update))) {
+      return false;
+    }
+    as.jump_to(top);
+    as.patch(exit);
+    return true;
+  }
+
+  bool statement(Node *node) {
+    if (!node) {
+      return true;
+    }
+    if (coverage && node->statement >= 0) {
+      as.increment(&coverage[node->statement]);
+    }
+
+    if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+      for (Node *s : bn->statements) {
+        if (!statement(s)) {
+          return false;
+        }
+      }
+      return true;
+
+    } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+      if (vn->is_definition) {
+        return declaration(vn);
+      }
+      return expression(vn) != UNSUPPORTED;
+
+    } else if (dynamic_cast<TerminalNode *>(node)) {
+      return true;
+
+    } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+      if (un->token.type == RETURN) {
+        return false;
+      }
+      // Unary statements store their result back into a variable operand.
+      auto *variable = dynamic_cast<VariableNode *>(un->child);
+      if (!variable) {
+        return true;
+      }
+      int slot = resolve(variable->identifier.value);
+      if (slot < 0 || expression(un) != slot_types[slot]) {
+        return false;
+      }
+      as.store(slot);
+      mark_written(slot);
+      return true;
+
+    } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+      if (!is_assign(bnn->token.type)) {
+        return expression(bnn) != UNSUPPORTED;
+      }
+
+      auto *variable = dynamic_cast<VariableNode *>(bnn->left);
+      int slot = variable ? resolve(variable->identifier.value) : -1;
+      if (slot < 0) {
+        return false;
+      }
+
+      if (bnn->token.type == ASSIGN) {
+        // Assigning a value of another type would change the variable's type.
+        if (expression(bnn->right) != slot_types[slot]) {
+          return false;
+        }
+      } else {
+        if (slot_types[slot] != TYPE_INT) {
+          return false;
+        }
+        as.load(slot);
+        as.push();
+        if (expression(bnn->right) != TYPE_INT) {
+          return false;
+        }
+        as.pop_operands();
+        if (!as.arithmetic(bnn->token.type)) {
+          return false;
+        }
+      }
+      as.store(slot);
+      mark_written(slot);
+      return true;
+
+    } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+      if (expression(in->condition) != TYPE_BOOL) {
+        return false;
+      }
+      as.test();
+      size_t otherwise = as.jump_if_zero();
+      scopes.push_back({});
+      bool ok = statement(in->true_body);
+      scopes.pop_back();
+      size_t done = as.jump();
+      as.patch(otherwise);
+      scopes.push_back({});
+      ok = ok && statement(in->false_body);
+      scopes.pop_back();
+      as.patch(done);
+      return ok;
+
+    } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+      scopes.push_back({});
+      bool ok = loop_body(wn->condition, wn->body, nullptr);
+      scopes.pop_back();
+      return ok;
+
+    } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+      scopes.push_back({});
+      bool ok = statement(fn->initialization) && loop_body(fn->condition, fn->body, fn->update);
+      scopes.pop_back();
+      return ok;
+    }
+
+    // Function definitions and calls need the interpreter.
+    return false;
+  }
+};
+
+} // namespace
+
+Jit::~Jit() {
+  for (auto &entry : loops) {
+    if (CompiledLoop *compiled = entry.second) {
+#if JIT_SUPPORTED
+      munmap(compiled->memory, compiled->memory_size);
+#endif
+      delete compiled;
+    }
+  }
+}
+
+void Jit::count_statements(uint64_t *counters) {
+  coverage = counters;
+}
+
+bool Jit::supported() {
+  return JIT_SUPPORTED;
+}
+
+bool Jit::is_hot(Node *loop) {
+  return ++iterations[loop] >= THRESHOLD;
+}
+
+bool Jit::compiled(Node *loop) const {
+  auto found = loops.find(loop);
+  return found != loops.end() && found->second;
+}
+
+CompiledLoop *Jit::compile(Node *loop, const std::function<Value *(const std::string &)> &lookup) {
+  auto cached = loops.find(loop);
+  if (cached != loops.end()) {
+    return cached->second;
+  }
+
+  CompiledLoop *compiled = new CompiledLoop();
+  LoopCompiler compiler(compiled, lookup, coverage);
+  bool ok = false;
+  if (auto *wn = dynamic_cast<WhileNode *>(loop)) {
+    ok = compiler.loop_body(wn->condition, wn->body, nullptr);
+  } else if (auto *fn = dynamic_cast<ForNode *>(loop)) {
+    ok = compiler.loop_body(fn->condition, fn->body, fn->update);
+  }
+  compiler.as.ret();
+
+#if JIT_SUPPORTED
+  if (ok) {
+    // Write the code into a fresh mapping, then make it executable but no longer writable.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (compiler.as.code.size() + page - 1) / page * page;
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      ok = false;
+    } else {
+      memcpy(memory, compiler.as.code.data(), compiler.as.code.size());
+      if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        ok = false;
+      } else {
+        compiled->memory = memory;
+        compiled->memory_size = size;
+        compiled->code = reinterpret_cast<void (*)(int32_t *)>(memory);
+        compiled->frame_size = compiler.slot_types.size();
+      }
+    }
+  }
+#else
+  ok = false;
+#endif
+
+  if (!ok) {
+    delete compiled;
+    compiled = nullptr;
+    stats.jit_failed++;
+  } else {
+    stats.jit_compiled++;
+  }
+  loops[loop] = compiled;
+  return compiled;
+}
@@ -0,0 +1,541 @@
+#include "../include/kernels.h"
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Int arithmetic is done on unsigned values so that overflow wraps instead of
+// being undefined, matching what the vector instructions do.
+
+static int scalar_sum_int(const int *a, size_t n) {
+  unsigned total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += unsigned(a[i]);
+  }
+  return int(total);
+}
+
+static double scalar_sum_float(const double *a, size_t n) {
+  double total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += a[i];
+  }
+  return total;
+}
+
+static int scalar_min_int(const int *a, size_t n) {
+  return *std::min_element(a, a + n);
+}
+
+static double scalar_min_float(const double *a, size_t n) {
+  return *std::min_element(a, a + n);
+}
+
+static int scalar_max_int(const int *a, size_t n) {
+  return *std::max_element(a, a + n);
+}
+
+static double scalar_max_float(const double *a, size_t n) {
+  return *std::max_element(a, a + n);
+}
+
+static int scalar_dot_int(const int *a, const int *b, size_t n) {
+  unsigned total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += unsigned(a[i]) * unsigned(b[i]);
+  }
+  return int(total);
+}
+
+static double scalar_dot_float(const double *a, const double *b, size_t n) {
+  double total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += a[i] * b[i];
+  }
+  return total;
+}
+
+static void scalar_scale_int(int *a, size_t n, int factor) {
+  for (size_t i = 0; i < n; i++) {
+    a[i] = int(unsigned(a[i]) * unsigned(factor));
+  }
+}
+
+static void scalar_scale_float(double *a, size_t n, double factor) {
+  for (size_t i = 0; i < n; i++) {
+    a[i] *= factor;
+  }
+}
+
+static void scalar_add_int(int *a, const int *b, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    a[i] = int(unsigned(a[i]) + unsigned(b[i]));
+  }
+}
+
+static void scalar_add_float(double *a, const double *b, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    a[i] += b[i];
+  }
+}
+
+static size_t scalar_count_gt_int(const int *a, size_t n, int limit) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    count += a[i] > limit;
+  }
+  return count;
+}
+
+static size_t scalar_count_gt_float(const double *a, size_t n, double limit) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    count += a[i] > limit;
+  }
+  return count;
+}
+
+static void scalar_prefix_sum_int(int *a, size_t n) {
+  unsigned total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += unsigned(a[i]);
+    a[i] = int(total);
+  }
+}
+
+static void scalar_prefix_sum_float(double *a, size_t n) {
+  double total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += a[i];
+    a[i] = total;
+  }
+}
+
+static const ArrayKernels SCALAR = {
+    "scalar",
+    scalar_sum_int, scalar_sum_float, scalar_min_int, scalar_min_float, scalar_max_int, scalar_max_float,
+    scalar_dot_int, scalar_dot_float, scalar_scale_int, scalar_scale_float, scalar_add_int, scalar_add_float,
+    scalar_count_gt_int, scalar_count_gt_float, scalar_prefix_sum_int, scalar_prefix_sum_float};
+
+const ArrayKernels &scalar_kernels() {
+  return SCALAR;
+}
+
+#if defined(__x86_64__)
+
+// SSE2 is part of every x86-64 CPU, so these kernels need no detection. Each
+// one handles whole vectors and leaves the last few elements to the scalar
+// version. Reductions keep one partial result per lane, so float sums add
+// in a different order than the scalar loop and may round differently.
+
+/**
+ * Adds up the four lanes of an int vector.
+ */
+static int sse2_lanes_sum(__m128i v) {
+  alignas(16) int lanes[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), v);
+  return scalar_sum_int(lanes, 4);
+}
+
+/**
+ * Multiplies four pairs of ints, keeping the low 32 bits of each product.
+ * SSE2 has no such instruction, so the even and odd lanes are multiplied
+ * separately into 64-bit products and the low halves are interleaved.
+ */
+static __m128i sse2_multiply(__m128i a, __m128i b) {
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/**
+ * Picks a's lanes where mask is set and b's elsewhere.
+ */
+static __m128i sse2_select(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static int sse2_sum_int(const int *a, size_t n) {
+  __m128i total = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    total = _mm_add_epi32(total, _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+  }
+  return int(unsigned(sse2_lanes_sum(total)) + unsigned(scalar_sum_int(a + i, n - i)));
+}
+
+static double sse2_sum_float(const double *a, size_t n) {
+  __m128d total = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    total = _mm_add_pd(total, _mm_loadu_pd(a + i));
+  }
+  alignas(16) double lanes[2];
+  _mm_store_pd(lanes, total);
+  return lanes[0] + lanes[1] + scalar_sum_float(a + i, n - i);
+}
+
+static int sse2_min_int(const int *a, size_t n) {
+  if (n < 4) {
+    return scalar_min_int(a, n);
+  }
+  __m128i least = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    least = sse2_select(_mm_cmplt_epi32(v, least), v, least);
+  }
+  alignas(16) int lanes[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), least);
+  int result = scalar_min_int(lanes, 4);
+  return i < n ? std::min(result, scalar_min_int(a + i, n - i)) : result;
+}
+
+static int sse2_max_int(const int *a, size_t n) {
+  if (n < 4) {
+    return scalar_max_int(a, n);
+  }
+  __m128i greatest = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    greatest = sse2_select(_mm_cmpgt_epi32(v, greatest), v, greatest);
+  }
+  alignas(16) int lanes[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), greatest);
+  int result = scalar_max_int(lanes, 4);
+  return i < n ? std::max(result, scalar_max_int(a + i, n - i)) : result;
+}
+
+static double sse2_min_float(const double *a, size_t n) {
+  if (n < 2) {
+    return scalar_min_float(a, n);
+  }
+  __m128d least = _mm_loadu_pd(a);
+  size_t i = 2;
+  for (; i + 2 <= n; i += 2) {
+    least = _mm_min_pd(least, _mm_loadu_pd(a + i));
+  }
+  alignas(16) double lanes[2];
+  _mm_store_pd(lanes, least);
+  double result = std::min(lanes[0], lanes[1]);
+  return i < n ? std::min(result, a[i]) : result;
+}
+
+static double sse2_max_float(const double *a, size_t n) {
+  if (n < 2) {
+    return scalar_max_float(a, n);
+  }
+  __m128d greatest = _mm_loadu_pd(a);
+  size_t i = 2;
+  for (; i + 2 <= n; i += 2) {
+    greatest = _mm_max_pd(greatest, _mm_loadu_pd(a + i));
+  }
+  alignas(16) double lanes[2];
+  _mm_store_pd(lanes, greatest);
+  double result = std::max(lanes[0], lanes[1]);
+  return i < n ? std::max(result, a[i]) : result;
+}
+
+static int sse2_dot_int(const int *a, const int *b, size_t n) {
+  __m128i total = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    total = _mm_add_epi32(total, sse2_multiply(x, y));
+  }
+  return int(unsigned(sse2_lanes_sum(total)) + unsigned(scalar_dot_int(a + i, b + i, n - i)));
+}
+
+static double sse2_dot_float(const double *a, const double *b, size_t n) {
+  __m128d total = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    total = _mm_add_pd(total, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  alignas(16) double lanes[2];
+  _mm_store_pd(lanes, total);
+  return lanes[0] + lanes[1] + scalar_dot_float(a + i, b + i, n - i);
+}
+
+static void sse2_scale_int(int *a, size_t n, int factor) {
+  __m128i f = _mm_set1_epi32(factor);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i *p = reinterpret_cast<__m128i *>(a + i);
+    _mm_storeu_si128(p, sse2_multiply(_mm_loadu_si128(p), f));
+  }
+  scalar_scale_int(a + i, n - i, factor);
+}
+
+static void sse2_scale_float(double *a, size_t n, double factor) {
+  __m128d f = _mm_set1_pd(factor);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), f));
+  }
+  scalar_scale_float(a + i, n - i, factor);
+}
+
+static void sse2_add_int(int *a, const int *b, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i *p = reinterpret_cast<__m128i *>(a + i);
+    _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i))));
+  }
+  scalar_add_int(a + i, b + i, n - i);
+}
+
+static void sse2_add_float(double *a, const double *b, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(a + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  scalar_add_float(a + i, b + i, n - i);
+}
+
+static size_t sse2_count_gt_int(const int *a, size_t n, int limit) {
+  // A comparison sets matching lanes to -1, so subtracting it counts them.
+  // Arrays are indexed by int, so no lane can overflow.
+  __m128i l = _mm_set1_epi32(limit);
+  __m128i count = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    count = _mm_sub_epi32(count, _mm_cmpgt_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)), l));
+  }
+  return size_t(unsigned(sse2_lanes_sum(count))) + scalar_count_gt_int(a + i, n - i, limit);
+}
+
+static size_t sse2_count_gt_float(const double *a, size_t n, double limit) {
+  __m128d l = _mm_set1_pd(limit);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    count += __builtin_popcount(_mm_movemask_pd(_mm_cmpgt_pd(_mm_loadu_pd(a + i), l)));
+  }
+  return count + scalar_count_gt_float(a + i, n - i, limit);
+}
+
+static void sse2_prefix_sum_int(int *a, size_t n) {
+  // Two shifted adds give the running sum within a vector, then the total of
+  // the previous vectors is added to every lane.
+  __m128i carry = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i *p = reinterpret_cast<__m128i *>(a + i);
+    __m128i v = _mm_loadu_si128(p);
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi32(v, carry);
+    _mm_storeu_si128(p, v);
+    carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  if (i < n) {
+    a[i] = int(unsigned(a[i]) + unsigned(_mm_cvtsi128_si32(carry)));
+    scalar_prefix_sum_int(a + i, n - i);
+  }
+}
+
+static const ArrayKernels SSE2 = {
+    "sse2",
+    sse2_sum_int, sse2_sum_float, sse2_min_int, sse2_min_float, sse2_max_int, sse2_max_float,
+    sse2_dot_int, sse2_dot_float, sse2_scale_int, sse2_scale_float, sse2_add_int, sse2_add_float,
+    sse2_count_gt_int, sse2_count_gt_float, sse2_prefix_sum_int, scalar_prefix_sum_float};
+
+// AVX2 kernels are compiled for AVX2 regardless of the build flags and only
+// called after the CPU was checked for it. Float prefix sums stay scalar
+// everywhere, so they round exactly like the equivalent Ankr loop.
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static int avx2_lanes_sum(__m256i v) {
+  alignas(32) int lanes[8];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), v);
+  return scalar_sum_int(lanes, 8);
+}
+
+AVX2 static double avx2_lanes_sum(__m256d v) {
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, v);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+AVX2 static int avx2_sum_int(const int *a, size_t n) {
+  __m256i total = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    total = _mm256_add_epi32(total, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)));
+  }
+  return int(unsigned(avx2_lanes_sum(total)) + unsigned(scalar_sum_int(a + i, n - i)));
+}
+
+AVX2 static double avx2_sum_float(const double *a, size_t n) {
+  __m256d total = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    total = _mm256_add_pd(total, _mm256_loadu_pd(a + i));
+  }
+  return avx2_lanes_sum(total) + scalar_sum_float(a + i, n - i);
+}
+
+AVX2 static int avx2_min_int(const int *a, size_t n) {
+  if (n < 8) {
+    return scalar_min_int(a, n);
+  }
+  __m256i least = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a));
+  size_t i = 8;
+  for (; i + 8 <= n; i += 8) {
+    least = _mm256_min_epi32(least, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)));
+  }
+  alignas(32) int lanes[8];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), least);
+  int result = scalar_min_int(lanes, 8);
+  return i < n ? std::min(result, scalar_min_int(a + i, n - i)) : result;
+}
+
+AVX2 static int avx2_max_int(const int *a, size_t n) {
+  if (n < 8) {
+    return scalar_max_int(a, n);
+  }
+  __m256i greatest = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a));
+  size_t i = 8;
+  for (; i + 8 <= n; i += 8) {
+    greatest = _mm256_max_epi32(greatest, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)));
+  }
+  alignas(32) int lanes[8];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), greatest);
+  int result = scalar_max_int(lanes, 8);
+  return i < n ? std::max(result, scalar_max_int(a + i, n - i)) : result;
+}
+
+AVX2 static double avx2_min_float(const double *a, size_t n) {
+  if (n < 4) {
+    return scalar_min_float(a, n);
+  }
+  __m256d least = _mm256_loadu_pd(a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    least = _mm256_min_pd(least, _mm256_loadu_pd(a + i));
+  }
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, least);
+  double result = scalar_min_float(lanes, 4);
+  return i < n ? std::min(result, scalar_min_float(a + i, n - i)) : result;
+}
+
+AVX2 static double avx2_max_float(const double *a, size_t n) {
+  if (n < 4) {
+    return scalar_max_float(a, n);
+  }
+  __m256d greatest = _mm256_loadu_pd(a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    greatest = _mm256_max_pd(greatest, _mm256_loadu_pd(a + i));
+  }
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, greatest);
+  double result = scalar_max_float(lanes, 4);
+  return i < n ? std::max(result, scalar_max_float(a + i, n - i)) : result;
+}
+
+AVX2 static int avx2_dot_int(const int *a, const int *b, size_t n) {
+  __m256i total = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    total = _mm256_add_epi32(total, _mm256_mullo_epi32(x, y));
+  }
+  return int(unsigned(avx2_lanes_sum(total)) + unsigned(scalar_dot_int(a + i, b + i, n - i)));
+}
+
+AVX2 static double avx2_dot_float(const double *a, const double *b, size_t n) {
+  __m256d total = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    total = _mm256_add_pd(total, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  return avx2_lanes_sum(total) + scalar_dot_float(a + i, b + i, n - i);
+}
+
+AVX2 static void avx2_scale_int(int *a, size_t n, int factor) {
+  __m256i f = _mm256_set1_epi32(factor);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i *p = reinterpret_cast<__m256i *>(a + i);
+    _mm256_storeu_si256(p, _mm256_mullo_epi32(_mm256_loadu_si256(p), f));
+  }
+  scalar_scale_int(a + i, n - i, factor);
+}
+
+AVX2 static void avx2_scale_float(double *a, size_t n, double factor) {
+  __m256d f = _mm256_set1_pd(factor);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(a + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), f));
+  }
+  scalar_scale_float(a + i, n - i, factor);
+}
+
+AVX2 static void avx2_add_int(int *a, const int *b, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i *p = reinterpret_cast<__m256i *>(a + i);
+    _mm256_storeu_si256(
+        p, _mm256_add_epi32(_mm256_loadu_si256(p), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i))));
+  }
+  scalar_add_int(a + i, b + i, n - i);
+}
+
+AVX2 static void avx2_add_float(double *a, const double *b, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(a + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  scalar_add_float(a + i, b + i, n - i);
+}
+
+AVX2 static size_t avx2_count_gt_int(const int *a, size_t n, int limit) {
+  __m256i l = _mm256_set1_epi32(limit);
+  __m256i count = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    count = _mm256_sub_epi32(count,
+                             _mm256_cmpgt_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)), l));
+  }
+  return size_t(unsigned(avx2_lanes_sum(count))) + scalar_count_gt_int(a + i, n - i, limit);
+}
+
+AVX2 static size_t avx2_count_gt_float(const double *a, size_t n, double limit) {
+  __m256d l = _mm256_set1_pd(limit);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    count += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(a + i), l, _CMP_GT_OQ)));
+  }
+  return count + scalar_count_gt_float(a + i, n - i, limit);
+}
+
+static const ArrayKernels AVX2_KERNELS = {
+    "avx2",
+    avx2_sum_int, avx2_sum_float, avx2_min_int, avx2_min_float, avx2_max_int, avx2_max_float,
+    avx2_dot_int, avx2_dot_float, avx2_scale_int, avx2_scale_float, avx2_add_int, avx2_add_float,
+    avx2_count_gt_int, avx2_count_gt_float, sse2_prefix_sum_int, scalar_prefix_sum_float};
+
+#undef AVX2
+
+const ArrayKernels &best_kernels() {
+  static const ArrayKernels &best = __builtin_cpu_supports("avx2") ? AVX2_KERNELS : SSE2;
+  return best;
+}
+
+#else
+
+const ArrayKernels &best_kernels() {
+  return SCALAR;
+}
+
+#endif
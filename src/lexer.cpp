@@ -4,9 +4,12 @@
 #include <string>
 #include <vector>
 
-Lexer::Lexer(std::string code) : code(code), pos(), current_char(code[0]) {}
+Lexer::Lexer(std::string code) : code(code), pos(), current_char(code[0]), line(1) {}
 
 void Lexer::advance() {
+  if (current_char == '\n') {
+    line++;
+  }
   pos++;
   current_char = pos < code.size() ? code[pos] : EOF;
 }
@@ -45,12 +48,14 @@ Token Lexer::consume_string() {
   }
   advance(); // Skip closing quote
   //std::cout << "String: " << str << std::endl;
-  return {STRING, str};
+  return {STRING, str, 0, symbols.intern(str)};
 }
 
 std::vector<Token> Lexer::tokenize() {
   std::vector<Token> tokens;
   while (current_char != EOF) {
+    size_t first = tokens.size();
+    int start_line = line;
 
     // Space
     if (std::isspace(current_char)) {
@@ -96,21 +101,19 @@ std::vector<Token> Lexer::tokenize() {
       advance();
 
     } else if (std::isalpha(current_char)) {
+      // Read the whole word first, so identifiers that start with a keyword,
+      // such as "format" or "variance", stay identifiers.
       std::string value;
       do {
         value += current_char;
         advance();
-      } while (token_map.find(value) == token_map.end() &&
-               !(std::isspace(current_char) || current_char == ';' ||
-                 current_char == '(' || current_char == ')' ||
-                 current_char == ',' || current_char == '+' ||
-                 current_char == '-'));
+      } while (std::isalnum(current_char) || current_char == '_');
 
       // Keyword
       if (token_map.find(value) != token_map.end()) {
         tokens.push_back(token_map.at(value));
       } else {
-        tokens.push_back({IDENTIFIER, value});
+        tokens.push_back({IDENTIFIER, value, 0, symbols.intern(value)});
       }
 
     } else {
@@ -128,6 +131,10 @@ std::vector<Token> Lexer::tokenize() {
         throw std::runtime_error("Unknown Token");
       }
     }
+
+    for (size_t i = first; i < tokens.size(); i++) {
+      tokens[i].line = start_line;
+    }
   }
 
   return tokens;
@@ -1,25 +1,186 @@
 #include "../include/interpreter.h"
+#include "../include/server.h"
+#include "../include/stats.h"
+#include <charconv>
 #include <fstream>
 #include <iostream>
 #include <cstring>
+#include <memory>
 #include <string>
+#include <thread>
 
-int main(int argc, char *argv[]) {
+/**
+ * Runs a program, printing runtime counters and writing coverage afterwards if requested.
+ * @param coverage_path Where to write line coverage, empty for none.
+ * @param source Name of the script for the coverage report.
+ * @param trace Trace the program records to or replays from, or nullptr.
+ * @return The process exit status.
+ */
+static int run(Interpreter *interpreter, bool print_stats, const std::string &coverage_path,
+               const std::string &source, Trace *trace = nullptr) {
+  interpreter->set_trace(trace);
+  try {
+    interpreter->execute();
+  } catch (...) {
+    // A recording of a failed run can reproduce the failure
+    if (trace) {
+      trace->flush();
+    }
+    // Counters are still useful when the script fails
+    if (print_stats) {
+      std::cerr << stats_to_json(stats) << std::endl;
+    }
+    if (!coverage_path.empty()) {
+      interpreter->write_coverage(coverage_path, source);
+    }
+    throw;
+  }
 
-  if (argc < 2) {
-    std::cerr << "Usage: " << argv[0] << " <filename>" << std::endl;
-    return 1;
+  if (print_stats) {
+    std::cerr << stats_to_json(stats) << std::endl;
   }
+  if (!coverage_path.empty()) {
+    interpreter->write_coverage(coverage_path, source);
+  }
+
+  return 0;
+}
+
+/**
+ * Parses a whole argument as a non-negative count.
+ * @param count Where the count is stored.
+ * @return false if the argument is not a plain decimal number that fits.
+ */
+static bool parse_count(const char *text, size_t *count) {
+  const char *last = text + strlen(text);
+  auto result = std::from_chars(text, last, *count);
+  return result.ec == std::errc() && result.ptr == last && result.ptr != text;
+}
+
+/**
+ * Prints how to invoke the interpreter.
+ * @return The exit status for a bad invocation.
+ */
+static int usage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [-d] [-n] [--stats] [--no-jit] [--no-ir] [--dump-ir] [--no-simd] [--memo-size n] [--check] [--snapshot-after-init file]"
+            << " [--coverage=file] [--no-inline] [--inline-profile file] [--record=file | --replay=file] <filename>"
+            << std::endl
+            << "       " << program << " [-d] [-n] [--stats] [--no-jit] [--no-ir] [--dump-ir] [--no-simd] [--memo-size n] [--coverage=file]"
+            << " [--record=file | --replay=file] --restore file" << std::endl
+            << "       " << program << " [-n] [--stats] [--no-jit] [--no-ir] [--no-simd] [--memo-size n] [--no-inline] [--workers n] --serve socket" << std::endl
+            << "       " << program << " --client socket <filename>" << std::endl;
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
 
-  // Enable debug mode from command line
-  bool debug_mode = false;
+  // Parse command line flags, the first other argument is the file to run
+  InterpreterOptions options;
+  bool print_stats = false;
+  bool check_only = false;
+  std::string restore_path;
+  std::string coverage_path;
+  std::string record_path;
+  std::string replay_path;
+  std::string serve_path;
+  std::string client_path;
+  size_t workers = std::max(1u, std::thread::hardware_concurrency());
+  std::string filename;
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-d") == 0) {
-      debug_mode = true;
+      options.debug_mode = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      print_stats = true;
+    } else if (strcmp(argv[i], "-n") == 0) {
+      options.per_line = true;
+    } else if (strcmp(argv[i], "--no-jit") == 0) {
+      options.jit = false;
+    } else if (strcmp(argv[i], "--no-ir") == 0) {
+      options.ir = false;
+    } else if (strcmp(argv[i], "--dump-ir") == 0) {
+      options.dump_ir = true;
+    } else if (strcmp(argv[i], "--no-simd") == 0) {
+      options.simd = false;
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check_only = true;
+      options.lazy_parsing = false;
+      options.dead_code = false;
+      options.inlining = false;
+    } else if (strcmp(argv[i], "--snapshot-after-init") == 0 && i + 1 < argc) {
+      options.snapshot_path = argv[++i];
+    } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+      restore_path = argv[++i];
+    } else if (strncmp(argv[i], "--coverage=", 11) == 0) {
+      // Coverage reports every function and statement, so nothing is skipped or removed
+      coverage_path = argv[i] + 11;
+      options.coverage = true;
+      options.lazy_parsing = false;
+      options.dead_code = false;
+      options.inlining = false;
+    } else if (strncmp(argv[i], "--record=", 9) == 0) {
+      record_path = argv[i] + 9;
+    } else if (strncmp(argv[i], "--replay=", 9) == 0) {
+      replay_path = argv[i] + 9;
+    } else if (strcmp(argv[i], "--no-inline") == 0) {
+      options.inlining = false;
+    } else if (strcmp(argv[i], "--inline-profile") == 0 && i + 1 < argc) {
+      options.inline_profile = argv[++i];
+    } else if (strcmp(argv[i], "--memo-size") == 0 && i + 1 < argc) {
+      if (!parse_count(argv[++i], &options.memo_size)) {
+        return usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      serve_path = argv[++i];
+    } else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+      client_path = argv[++i];
+    } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+      if (!parse_count(argv[++i], &workers)) {
+        return usage(argv[0]);
+      }
+      workers = std::max<size_t>(1, workers);
+    } else if (filename.empty()) {
+      filename = argv[i];
     }
   }
 
-  std::string filename = argv[1];
+  // Traces belong to a single run, so a server cannot take one
+  bool tracing = !record_path.empty() || !replay_path.empty();
+
+  // A client hands its script and standard streams to a server, which runs it
+  if (!client_path.empty() && serve_path.empty() && restore_path.empty() && !filename.empty() && !tracing) {
+    return run_client(client_path, filename);
+  } else if (!serve_path.empty() && client_path.empty() && restore_path.empty() && filename.empty() && !tracing) {
+    Server server(serve_path, options, workers, [&](Interpreter *interpreter, const std::string &source) {
+      return run(interpreter, print_stats, coverage_path, source);
+    });
+    try {
+      server.run();
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+    return 1;
+  } else if (!client_path.empty() || !serve_path.empty() || filename.empty() == restore_path.empty() ||
+             (!record_path.empty() && !replay_path.empty())) {
+    return usage(argv[0]);
+  }
+
+  std::unique_ptr<Trace> trace;
+  try {
+    if (tracing && !check_only) {
+      trace.reset(record_path.empty() ? new Trace(replay_path, TRACE_REPLAY) : new Trace(record_path, TRACE_RECORD));
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  // A restored program continues after its checkpoint without reading its source
+  if (!restore_path.empty()) {
+    Interpreter interpreter(load_snapshot(restore_path), options);
+    return run(&interpreter, print_stats, coverage_path, restore_path, trace.get());
+  }
+
   std::ifstream file(filename);
   if (!file.is_open()) {
     std::cerr << "Failed to open file: " << filename << std::endl;
@@ -27,9 +188,19 @@ int main(int argc, char *argv[]) {
   }
 
   // Convert file into string of text
-  std::string code((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()); 
-  Interpreter interpreter(code, debug_mode);
-  interpreter.execute();
+  std::string code((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
-  return 0;
+  // Parses and analyzes every function, including ones nothing calls, without running the script
+  if (check_only) {
+    try {
+      Interpreter interpreter(code, options);
+    } catch (const std::exception &e) {
+      std::cerr << filename << ": " << e.what() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  Interpreter interpreter(code, options);
+  return run(&interpreter, print_stats, coverage_path, filename, trace.get());
 }
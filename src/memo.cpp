@@ -0,0 +1,57 @@
+#include "../include/memo.h"
+#include "../include/stats.h"
+
+MemoCache::MemoCache(size_t capacity) : entries(), index(), capacity(capacity) {}
+
+/**
+ * Appends the raw bytes of a scalar to a key.
+ */
+template <typename T> static void append_bytes(std::string *key, const T &value) {
+  key->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+bool MemoCache::make_key(FunctionNode *function, const std::vector<Value *> &arguments, std::string *key) {
+  key->clear();
+  append_bytes(key, function);
+  for (Value *argument : arguments) {
+    key->push_back(static_cast<char>(argument->type));
+    switch (argument->type) {
+    case TYPE_INT: append_bytes(key, static_cast<IntValue *>(argument)->value); break;
+    case TYPE_FLOAT: append_bytes(key, static_cast<FloatValue *>(argument)->value); break;
+    case TYPE_BOOL: key->push_back(static_cast<BoolValue *>(argument)->value); break;
+    case TYPE_STRING: {
+      // The length keeps ("ab", "c") and ("a", "bc") apart.
+      const std::string &text = static_cast<StringValue *>(argument)->value;
+      append_bytes(key, text.size());
+      key->append(text);
+      break;
+    }
+    default: return false;
+    }
+  }
+  return true;
+}
+
+Value *MemoCache::find(const std::string &key) {
+  auto found = index.find(key);
+  if (found == index.end()) {
+    stats.memo_misses++;
+    return nullptr;
+  }
+  stats.memo_hits++;
+  entries.splice(entries.begin(), entries, found->second);
+  return found->second->value;
+}
+
+void MemoCache::insert(const std::string &key, Value *value) {
+  if (capacity == 0 || index.count(key)) {
+    return;
+  }
+  if (entries.size() >= capacity) {
+    index.erase(entries.back().key);
+    entries.pop_back();
+    stats.memo_evictions++;
+  }
+  entries.push_front({key, value});
+  index[key] = entries.begin();
+}
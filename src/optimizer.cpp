@@ -0,0 +1,269 @@
+#include "../include/optimizer.h"
+#include <stdexcept>
+
+Optimizer::Optimizer(std::vector<std::string> entry_points)
+    : log(), functions(), called(), referenced(), entry_points(std::move(entry_points)) {}
+
+/**
+ * Names the source line of a node for the removal log.
+ */
+static std::string at_line(const Node *node) {
+  return node->line ? " on line " + std::to_string(node->line) : "";
+}
+
+Value *Optimizer::fold(Node *node) {
+  if (auto *tn = dynamic_cast<TerminalNode *>(node)) {
+    return tn->v;
+  }
+
+  try {
+    if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+      if (un->token.type != NOT && un->token.type != NEGATIVE) {
+        return nullptr;
+      }
+      Value *child = fold(un->child);
+      return child ? child->apply_operator(un->token, nullptr) : nullptr;
+    }
+
+    auto *bnn = dynamic_cast<BinaryNode *>(node);
+    if (!bnn || is_assign(bnn->token.type)) {
+      return nullptr;
+    }
+    // Integer division by zero would stop the interpreter instead of throwing.
+    if (bnn->token.type == DIVIDE || bnn->token.type == MODULO) {
+      return nullptr;
+    }
+    Value *left = fold(bnn->left);
+    Value *right = left ? fold(bnn->right) : nullptr;
+    if (!right) {
+      return nullptr;
+    }
+    // && and || short-circuit in the interpreter, so only fold them when both sides are bools.
+    if ((bnn->token.type == AND || bnn->token.type == OR) &&
+        (left->type != TYPE_BOOL || right->type != TYPE_BOOL)) {
+      return nullptr;
+    }
+    return left->apply_operator(bnn->token, right);
+  } catch (const std::runtime_error &) {
+    return nullptr;
+  }
+}
+
+void Optimizer::collect_functions(Node *node) {
+  if (!node) {
+    return;
+  }
+
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    for (Node *s : bn->statements) {
+      collect_functions(s);
+    }
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    if (fnn->is_definition) {
+      functions[fnn->identifier.value].push_back(fnn);
+      collect_functions(fnn->body);
+    }
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    collect_functions(in->true_body);
+    collect_functions(in->false_body);
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    collect_functions(wn->body);
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    collect_functions(fn->body);
+  }
+}
+
+void Optimizer::collect_uses(Node *node, std::set<std::string> *calls) {
+  if (!node) {
+    return;
+  }
+
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    for (Node *s : bn->statements) {
+      collect_uses(s, calls);
+    }
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    if (!vn->is_definition) {
+      referenced.insert(vn->identifier.value);
+    } else if (auto *assign = dynamic_cast<BinaryNode *>(vn->initializer)) {
+      // The declared name itself is not a use.
+      collect_uses(assign->right, calls);
+    }
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    // Definitions are followed once their name is known to be called.
+    if (!fnn->is_definition) {
+      calls->insert(fnn->identifier.value);
+      for (Node *p : fnn->parameters) {
+        collect_uses(p, calls);
+      }
+    }
+  } else if (auto *un = dynamic_cast<UnaryNode *>(node)) {
+    collect_uses(un->child, calls);
+  } else if (auto *bnn = dynamic_cast<BinaryNode *>(node)) {
+    collect_uses(bnn->left, calls);
+    collect_uses(bnn->right, calls);
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    collect_uses(in->condition, calls);
+    collect_uses(in->true_body, calls);
+    collect_uses(in->false_body, calls);
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    collect_uses(wn->condition, calls);
+    collect_uses(wn->body, calls);
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    collect_uses(fn->initialization, calls);
+    collect_uses(fn->condition, calls);
+    collect_uses(fn->update, calls);
+    collect_uses(fn->body, calls);
+  }
+}
+
+void Optimizer::find_uses(BlockNode *root) {
+  functions.clear();
+  called.clear();
+  referenced.clear();
+  collect_functions(root);
+
+  // Follow the call graph from the top level. Any definition of a called
+  // name may be the one a call reaches, so all of them are followed.
+  std::set<std::string> pending(entry_points.begin(), entry_points.end());
+  collect_uses(root, &pending);
+  while (!pending.empty()) {
+    std::string name = *pending.begin();
+    pending.erase(pending.begin());
+    if (!called.insert(name).second) {
+      continue;
+    }
+    auto defs = functions.find(name);
+    if (defs == functions.end()) {
+      continue;
+    }
+    for (FunctionNode *def : defs->second) {
+      std::set<std::string> calls;
+      for (Node *p : def->parameters) {
+        collect_uses(p, &calls);
+      }
+      collect_uses(def->body, &calls);
+      for (const std::string &callee : calls) {
+        if (!called.count(callee)) {
+          pending.insert(callee);
+        }
+      }
+    }
+  }
+}
+
+Node *Optimizer::simplify(Node *node, bool function_body) {
+  if (!node) {
+    return nullptr;
+  }
+
+  if (auto *bn = dynamic_cast<BlockNode *>(node)) {
+    simplify_block(bn, function_body);
+
+  } else if (auto *vn = dynamic_cast<VariableNode *>(node)) {
+    if (!vn->is_definition) {
+      return node;
+    }
+    auto *assign = dynamic_cast<BinaryNode *>(vn->initializer);
+    auto *variable = dynamic_cast<VariableNode *>(assign ? assign->left : vn->initializer);
+    Value *value = assign ? fold(assign->right) : nullptr;
+    // A value of the wrong type for an annotated declaration fails when it is stored.
+    bool fits = !variable || variable->annotation == TYPE_ANY || !value || value->type == variable->annotation ||
+                (value->type == TYPE_INT && variable->annotation == TYPE_FLOAT);
+    if (variable && !referenced.count(variable->identifier.value) && (!assign || value) && fits) {
+      log.push_back("Removed unused variable '" + variable->identifier.value + "'" + at_line(node));
+      delete node;
+      return nullptr;
+    }
+
+  } else if (auto *fnn = dynamic_cast<FunctionNode *>(node)) {
+    if (!fnn->is_definition) {
+      return node;
+    }
+    if (!called.count(fnn->identifier.value)) {
+      log.push_back("Removed uncalled function '" + fnn->identifier.value + "'" + at_line(node));
+      delete node;
+      return nullptr;
+    }
+    if (fnn->body) {
+      simplify_block(fnn->body, true);
+    }
+
+  } else if (auto *in = dynamic_cast<IfNode *>(node)) {
+    Value *condition = fold(in->condition);
+    if (condition && condition->type == TYPE_BOOL) {
+      if (static_cast<BoolValue *>(condition)->value) {
+        if (in->false_body) {
+          log.push_back("Removed else branch of always true condition" + at_line(node));
+          delete in->false_body;
+          in->false_body = nullptr;
+        }
+      } else if (!in->false_body) {
+        log.push_back("Removed if statement with always false condition" + at_line(node));
+        delete node;
+        return nullptr;
+      } else {
+        // The else branch keeps the scope the if statement would have pushed for it.
+        log.push_back("Removed branch of always false condition" + at_line(node));
+        delete in->condition;
+        delete in->true_body;
+        in->condition = new TerminalNode(new BoolValue(true));
+        in->true_body = in->false_body;
+        in->false_body = nullptr;
+      }
+    }
+    in->true_body = simplify(in->true_body, false);
+    in->false_body = simplify(in->false_body, false);
+
+  } else if (auto *wn = dynamic_cast<WhileNode *>(node)) {
+    Value *condition = fold(wn->condition);
+    if (condition && condition->type == TYPE_BOOL && !static_cast<BoolValue *>(condition)->value) {
+      log.push_back("Removed while loop with always false condition" + at_line(node));
+      delete node;
+      return nullptr;
+    }
+    simplify_block(wn->body, false);
+
+  } else if (auto *fn = dynamic_cast<ForNode *>(node)) {
+    simplify_block(fn->body, false);
+  }
+  return node;
+}
+
+void Optimizer::simplify_block(BlockNode *block, bool function_body) {
+  std::vector<Node *> kept;
+  for (size_t i = 0; i < block->statements.size(); i++) {
+    Node *s = simplify(block->statements[i], false);
+    if (!s) {
+      continue;
+    }
+    kept.push_back(s);
+
+    // A function returns at the first return among its own statements.
+    auto *un = dynamic_cast<UnaryNode *>(s);
+    if (function_body && un && un->token.type == RETURN && i + 1 < block->statements.size()) {
+      size_t count = block->statements.size() - i - 1;
+      log.push_back("Removed " + std::to_string(count) + (count == 1 ? " statement" : " statements") +
+                    " after return" + at_line(s));
+      for (size_t j = i + 1; j < block->statements.size(); j++) {
+        delete block->statements[j];
+      }
+      break;
+    }
+  }
+  block->statements = std::move(kept);
+}
+
+void Optimizer::eliminate_dead_code(BlockNode *root) {
+  // Each removal can leave more code unused, so repeat until nothing changes.
+  size_t before;
+  do {
+    before = log.size();
+    find_uses(root);
+    simplify_block(root, false);
+  } while (log.size() != before);
+}
+
+const std::vector<std::string> &Optimizer::removed() const {
+  return log;
+}
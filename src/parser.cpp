@@ -3,7 +3,13 @@
 #include <vector>
 #include <iostream>
 
-Parser::Parser(std::vector<Token> tokens, bool debug_mode) : tokens(tokens), pos(0), debug_mode(debug_mode) {}
+Parser::Parser(std::vector<Token> tokens, bool debug_mode, bool lazy_bodies,
+               const std::vector<std::string> &entry_points)
+    : tokens(std::move(tokens)), pos(0), debug_mode(debug_mode), lazy_bodies(lazy_bodies), deferred(), called(), pending() {
+  for (const std::string &identifier : entry_points) {
+    record_call(identifier);
+  }
+}
 Parser::~Parser() {}
 
 Token Parser::peek() {
@@ -53,6 +59,7 @@ Node *Parser::parse_expression() {
       if (peek().type == LEFT_PARENTHESIS) {
         FunctionNode *function_root = parse_function(false);
         function_root->identifier = t;
+        record_call(t.value);
         functions.push_back(function_root);
         infix.push_back({FUNCTION, t.value});
 
@@ -95,6 +102,8 @@ Node *Parser::parse_expression() {
 
   // Build Expression Tree
   std::stack<Node *> stack;
+  size_t variable_index = 0;
+  size_t function_index = 0;
   for (Token t : postfix) {
     if (is_operand(t.type)) {
       Node *operand;
@@ -103,7 +112,7 @@ Node *Parser::parse_expression() {
         operand = new TerminalNode(val);
 
       } else if (t.type == FLOAT) {
-        FloatValue *val = new FloatValue(stof(t.value));
+        FloatValue *val = new FloatValue(stod(t.value));
         operand = new TerminalNode(val);
 
       } else if (t.type == TRUE || t.type == FALSE) {
@@ -111,24 +120,15 @@ Node *Parser::parse_expression() {
         operand = new TerminalNode(val);
 
       } else if (t.type == STRING) {
-        StringValue *val = new StringValue(t.value);
+        StringValue *val = new StringValue(t.value, t.symbol);
         operand = new TerminalNode(val);
 
       } else if (t.type == VAR) {
-        for (VariableNode *vn : variables) {
-          if (vn->identifier.value  == t.value) {
-            operand = vn;
-            break;
-          }
-        }
+        // Postfix keeps operands in their original order.
+        operand = variables[variable_index++];
       } else if (t.type == FUNCTION) {
-        for (FunctionNode *fn : functions) {
-          if (fn->identifier.value == t.value) {
-            operand = fn;
-            break;
-          }
-        }
-      }    
+        operand = functions[function_index++];
+      }
       stack.push(operand);
     } else if (is_operator(t.type)) {
       if (is_unary(t.type)) {
@@ -173,6 +173,9 @@ std::vector<Token> Parser::to_postfix(std::vector<Token> infix) {
         stack.pop();
       }
       stack.pop(); // Remove the parenthesis from stack
+    } else if (t.type == NOT) {
+      // Prefix operator, applies to the operand that follows it.
+      stack.push(t);
     } else if (is_operator(t.type)) {
       while (!stack.empty() &&
              precedence(t.type) <= precedence(stack.top().type)) {
@@ -204,7 +207,9 @@ IfNode *Parser::parse_if() {
   if (peek().type == ELSE) {
     advance();
     if (peek().type == IF) {
+      int line = peek().line;
       false_body = parse_if(); // Recursively parse nested if statements
+      false_body->line = line;
     } else {
       false_body = parse_block();
     }
@@ -229,7 +234,16 @@ VariableNode *Parser::parse_variable(bool is_definition) {
   if (is_definition) {
     consume(VAR, "Expected 'var' declaration");
     identifier = peek();
-    initializer = parse_expression();
+    if (!at_annotated_name()) {
+      initializer = parse_expression();
+    } else if (VariableNode *variable = parse_annotated_name(); peek().type == ASSIGN) {
+      // var name: type = value; is built like the unannotated form, with the type on the assigned name.
+      Token assign = advance();
+      initializer = new BinaryNode(assign, variable, parse_expression());
+    } else {
+      consume(END_STATEMENT, "Expected '=' or ';' after the type of '" + identifier.value + "'");
+      initializer = variable;
+    }
   } else {
     identifier = advance();
   }
@@ -237,9 +251,37 @@ VariableNode *Parser::parse_variable(bool is_definition) {
   return new VariableNode(identifier, initializer, is_definition);
 }
 
+bool Parser::at_annotated_name() {
+  return pos + 1 < tokens.size() && tokens[pos].type == IDENTIFIER && tokens[pos + 1].type == COLON;
+}
+
+VariableNode *Parser::parse_annotated_name() {
+  Token identifier = advance();
+  consume(COLON, "Expected ':' after '" + identifier.value + "'");
+  auto *variable = new VariableNode(identifier, nullptr, false);
+  variable->annotation = parse_type();
+  return variable;
+}
+
+ValueType Parser::parse_type() {
+  static const std::map<std::string, ValueType> names = {
+      {"int", TYPE_INT}, {"float", TYPE_FLOAT}, {"string", TYPE_STRING}, {"bool", TYPE_BOOL}, {"array", TYPE_ARRAY}};
+  Token t = advance();
+  auto found = names.find(t.value);
+  if (t.type != IDENTIFIER || found == names.end()) {
+    throw std::runtime_error("Expected int, float, string, bool or array as a type, got '" + t.value + "'");
+  }
+  return found->second;
+}
+
 FunctionNode *Parser::parse_function(bool is_definition) {
   Token identifier;
+  bool is_pure = false;
   if (is_definition) {
+    if (peek().type == PURE) {
+      advance();
+      is_pure = true;
+    }
     consume(FUNCTION, "Expected 'function' before identifier");
     identifier = advance();
   } else {
@@ -250,17 +292,81 @@ FunctionNode *Parser::parse_function(bool is_definition) {
   std::vector<Node *> parameters;
 
   while (peek().type != RIGHT_PARENTHESIS) {
+    if (is_definition && at_annotated_name()) {
+      parameters.push_back(parse_annotated_name());
+      if (peek().type == COMMA) {
+        advance();
+      }
+      continue;
+    }
     Node *parameter = parse_expression();
     parameters.push_back(parameter);
   }
   consume(RIGHT_PARENTHESIS, "Expected ')' after parameters");
+  ValueType return_type = TYPE_ANY;
+  if (is_definition && peek().type == COLON) {
+    advance();
+    return_type = parse_type();
+  }
 
   BlockNode *body = nullptr;
-  if (is_definition) {
+  size_t body_start = pos;
+  if (is_definition && lazy_bodies) {
+    skip_block();
+  } else if (is_definition) {
     body = parse_block();
   }
 
-  return new FunctionNode(identifier, parameters, body, is_definition);
+  FunctionNode *function = new FunctionNode(identifier, parameters, body, is_definition, is_pure);
+  function->return_type = return_type;
+  if (is_definition && lazy_bodies) {
+    deferred[identifier.value].push_back({function, body_start});
+    if (called.count(identifier.value)) {
+      pending.push_back(identifier.value);
+    }
+  }
+  return function;
+}
+
+void Parser::skip_block() {
+  consume(LEFT_BRACKET, "Expected '{' at start of block");
+  int depth = 1;
+  while (depth > 0) {
+    if (at_end()) {
+      throw std::runtime_error("Expected '}' at end of block");
+    }
+    TokenType type = tokens[pos++].type;
+    if (type == LEFT_BRACKET) {
+      depth++;
+    } else if (type == RIGHT_BRACKET) {
+      depth--;
+    }
+  }
+}
+
+void Parser::record_call(const std::string &identifier) {
+  if (called.insert(identifier).second) {
+    pending.push_back(identifier);
+  }
+}
+
+void Parser::parse_called_bodies() {
+  // A function can only run if some code that runs calls it by name.
+  while (!pending.empty()) {
+    auto defs = deferred.find(pending.back());
+    pending.pop_back();
+    if (defs == deferred.end()) {
+      continue;
+    }
+
+    std::vector<std::pair<FunctionNode *, size_t>> bodies = std::move(defs->second);
+    deferred.erase(defs);
+    for (auto &[function, start] : bodies) {
+      pos = start;
+      function->body = parse_block();
+    }
+  }
+  pos = tokens.size();
 }
 
 UnaryNode *Parser::parse_return() {
@@ -296,15 +402,22 @@ BlockNode *Parser::parse_block() {
 }
 
 Node *Parser::parse_statement() {
+  int line = peek().line;
+  Node *statement;
   switch (peek().type) {
-    case IF: return parse_if();
-    case WHILE: return parse_while();
-    case FOR: return parse_for();
-    case VAR: return parse_variable(true);
-    case FUNCTION: return parse_function(true);
-    case RETURN: return parse_return();
-    default: return parse_expression();
+    case IF: statement = parse_if(); break;
+    case WHILE: statement = parse_while(); break;
+    case FOR: statement = parse_for(); break;
+    case VAR: statement = parse_variable(true); break;
+    case FUNCTION:
+    case PURE: statement = parse_function(true); break;
+    case RETURN: statement = parse_return(); break;
+    default: statement = parse_expression(); break;
+  }
+  if (statement) {
+    statement->line = line;
   }
+  return statement;
 }
 
 BlockNode *Parser::parse() {
@@ -313,6 +426,7 @@ BlockNode *Parser::parse() {
   while (!at_end()) {
     root_statements.push_back(parse_statement());
   }
+  parse_called_bodies();
 
   return new BlockNode(root_statements);
 }
@@ -0,0 +1,70 @@
+#include "../include/random.h"
+
+/**
+ * Rotates the bits of a 64-bit value left.
+ */
+static inline uint64_t rotate_left(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+Random::Random(uint64_t seed) : state() {
+  reseed(seed);
+}
+
+void Random::reseed(uint64_t seed) {
+  for (uint64_t &word : state) {
+    seed += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = seed;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    word = z ^ (z >> 31);
+  }
+}
+
+uint64_t Random::next() {
+  const uint64_t result = rotate_left(state[1] * 5, 7) * 9;
+  const uint64_t t = state[1] << 17;
+  state[2] ^= state[0];
+  state[3] ^= state[1];
+  state[1] ^= state[2];
+  state[0] ^= state[3];
+  state[2] ^= t;
+  state[3] = rotate_left(state[3], 45);
+  return result;
+}
+
+uint32_t Random::below(uint32_t bound) {
+  // The high half of a 32x32-bit product is uniform in [0, bound) once the
+  // few low halves that would over-represent some results are rejected.
+  uint64_t product = (next() >> 32) * uint64_t(bound);
+  uint32_t low = static_cast<uint32_t>(product);
+  if (low < bound) {
+    const uint32_t threshold = -bound % bound;
+    while (low < threshold) {
+      product = (next() >> 32) * uint64_t(bound);
+      low = static_cast<uint32_t>(product);
+    }
+  }
+  return static_cast<uint32_t>(product >> 32);
+}
+
+double Random::uniform() {
+  return (next() >> 11) * 0x1.0p-53;
+}
+
+void Random::fill(int *out, size_t count, uint32_t bound) {
+  // The state is kept in locals so it stays in registers for the whole loop.
+  Random local = *this;
+  for (size_t i = 0; i < count; i++) {
+    out[i] = static_cast<int>(local.below(bound));
+  }
+  *this = local;
+}
+
+void Random::fill(double *out, size_t count) {
+  Random local = *this;
+  for (size_t i = 0; i < count; i++) {
+    out[i] = local.uniform();
+  }
+  *this = local;
+}
@@ -0,0 +1,529 @@
+#include "../include/server.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+static const int STREAMS = 3; ///< Standard input, output and error are passed with each request.
+
+/// Pipe the SIGCHLD handler writes to, so finished workers wake up poll().
+static int child_exits[2] = {-1, -1};
+
+static void on_child_exit(int) {
+  int saved = errno;
+  char byte = 0;
+  if (write(child_exits[1], &byte, 1) < 0) {
+    // The pipe is full, so poll() wakes up anyway.
+  }
+  errno = saved;
+}
+
+/// Stops a worker whose script took too long to parse; the message goes to the client.
+static void on_compile_timeout(int) {
+  static const char message[] = "Timed out parsing the script\n";
+  if (write(STDERR_FILENO, message, sizeof(message) - 1) < 0) {
+    // The client is gone, so nobody reads the message.
+  }
+  _exit(1);
+}
+
+/**
+ * Builds the address of a Unix domain socket.
+ */
+static sockaddr_un socket_address(const std::string &path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("Socket path is too long: " + path);
+  }
+  memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return address;
+}
+
+/**
+ * Writes a whole buffer, retrying after partial writes.
+ * @return false if the file descriptor stopped accepting data.
+ */
+static bool write_all(int fd, const void *data, size_t size) {
+  const char *next = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t n = ::write(fd, next, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return false;
+    }
+    next += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * Fills a whole buffer, retrying after partial reads.
+ * @return false if the file descriptor ended first.
+ */
+static bool read_all(int fd, void *data, size_t size) {
+  char *next = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t n = ::read(fd, next, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return false;
+    }
+    next += n;
+    size -= n;
+  }
+  return true;
+}
+
+/// What reading a request without blocking found.
+enum RequestState {
+  REQUEST_PARTIAL,  ///< More bytes are still to come.
+  REQUEST_COMPLETE, ///< The whole request arrived.
+  REQUEST_INVALID,  ///< The request was malformed or the client went away.
+};
+
+/**
+ * Reads whatever has arrived of a run request without blocking: the length of
+ * the script's path, the path, and the client's standard streams passed along
+ * with the first bytes.
+ * @param data Bytes received so far, extended here.
+ * @param streams Where the received file descriptors are stored.
+ * @param has_streams Set once the descriptors arrived.
+ * @return Whether the request is complete. Received descriptors are left in
+ *         streams even when the request is invalid.
+ */
+static RequestState read_request(int connection, std::string *data, int streams[STREAMS], bool *has_streams) {
+  while (true) {
+    char bytes[256];
+    iovec buffer = {bytes, sizeof(bytes)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * STREAMS)];
+    msghdr message = {};
+    message.msg_iov = &buffer;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t n = recvmsg(connection, &message, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK ? REQUEST_PARTIAL : REQUEST_INVALID;
+    }
+
+    bool valid = true;
+    for (cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+      if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+        continue;
+      }
+      int received[STREAMS];
+      size_t count = std::min<size_t>((header->cmsg_len - CMSG_LEN(0)) / sizeof(int), STREAMS);
+      memcpy(received, CMSG_DATA(header), sizeof(int) * count);
+      if (*has_streams || count != STREAMS || (message.msg_flags & MSG_CTRUNC)) {
+        for (size_t i = 0; i < count; i++) {
+          close(received[i]);
+        }
+        valid = false;
+      } else {
+        memcpy(streams, received, sizeof(received));
+        *has_streams = true;
+      }
+    }
+    if (!valid || n == 0) {
+      return REQUEST_INVALID;
+    }
+
+    // The descriptors come with the first bytes, so any data without them is malformed.
+    data->append(bytes, n);
+    uint32_t length;
+    if (!*has_streams) {
+      return REQUEST_INVALID;
+    } else if (data->size() < sizeof(length)) {
+      continue;
+    }
+    memcpy(&length, data->data(), sizeof(length));
+    if (length == 0 || length >= PATH_MAX || data->size() > sizeof(length) + length) {
+      return REQUEST_INVALID;
+    } else if (data->size() == sizeof(length) + length) {
+      return REQUEST_COMPLETE;
+    }
+  }
+}
+
+/**
+ * Sends a run request; see read_request.
+ * @return false if the server closed the connection.
+ */
+static bool send_request(int connection, const std::string &path, const int streams[STREAMS]) {
+  uint32_t length = path.size();
+  iovec data[2] = {{&length, sizeof(length)}, {const_cast<char *>(path.data()), path.size()}};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * STREAMS)] = {};
+  msghdr message = {};
+  message.msg_iov = data;
+  message.msg_iovlen = 2;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  cmsghdr *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int) * STREAMS);
+  memcpy(CMSG_DATA(header), streams, sizeof(int) * STREAMS);
+
+  ssize_t n;
+  do {
+    n = sendmsg(connection, &message, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return false;
+  }
+
+  // The descriptors went with the first bytes; the rest of the path may follow on its own.
+  size_t sent = n;
+  if (sent < sizeof(length)) {
+    return write_all(connection, reinterpret_cast<char *>(&length) + sent, sizeof(length) - sent) &&
+           write_all(connection, path.data(), path.size());
+  }
+  sent -= sizeof(length);
+  return write_all(connection, path.data() + sent, path.size() - sent);
+}
+
+/**
+ * Sends a run's exit status and closes the connection.
+ */
+static void finish(int connection, int32_t status) {
+  write_all(connection, &status, sizeof(status));
+  close(connection);
+}
+
+/**
+ * Closes a request's connection and the streams it received.
+ */
+static void discard(int connection, bool has_streams, const int streams[STREAMS]) {
+  if (has_streams) {
+    for (int i = 0; i < STREAMS; i++) {
+      close(streams[i]);
+    }
+  }
+  close(connection);
+}
+
+Server::Server(std::string socket_path, const InterpreterOptions &options, size_t workers, ProgramRunner runner)
+    : socket_path(std::move(socket_path)), options(options), workers(workers), runner(std::move(runner)), programs(),
+      cache(), pending(), queued(), running(), listener(-1) {}
+
+Server::~Server() {
+  for (Program &program : programs) {
+    delete program.interpreter;
+  }
+  for (auto &request : pending) {
+    discard(request.first, request.second.has_streams, request.second.streams);
+  }
+  for (auto &request : queued) {
+    discard(request.first, request.second.has_streams, request.second.streams);
+  }
+  if (listener >= 0) {
+    close(listener);
+  }
+}
+
+Interpreter *Server::find(const std::string &path, const struct stat &info) {
+  auto found = cache.find(path);
+  if (found == cache.end()) {
+    return nullptr;
+  }
+  Program &program = *found->second;
+  if (program.modified.tv_sec == info.st_mtim.tv_sec && program.modified.tv_nsec == info.st_mtim.tv_nsec &&
+      program.size == info.st_size) {
+    programs.splice(programs.begin(), programs, found->second);
+    return program.interpreter;
+  }
+  delete program.interpreter;
+  programs.erase(found->second);
+  cache.erase(found);
+  return nullptr;
+}
+
+void Server::store(const Worker &worker) {
+  auto found = cache.find(worker.path);
+  if (found != cache.end()) {
+    // Another worker may have cached the same version first
+    const Program &program = *found->second;
+    if (program.modified.tv_sec == worker.modified.tv_sec && program.modified.tv_nsec == worker.modified.tv_nsec &&
+        program.size == worker.size) {
+      return;
+    }
+    delete program.interpreter;
+    programs.erase(found->second);
+    cache.erase(found);
+  }
+
+  Interpreter *interpreter;
+  try {
+    interpreter = new Interpreter(worker.code, options);
+  } catch (const std::exception &) {
+    return;
+  }
+
+  programs.push_front({worker.path, worker.modified, worker.size, interpreter});
+  cache[worker.path] = programs.begin();
+  if (programs.size() > CACHE_SIZE) {
+    delete programs.back().interpreter;
+    cache.erase(programs.back().path);
+    programs.pop_back();
+  }
+}
+
+void Server::receive(int connection) {
+  Request &request = pending[connection];
+  RequestState state = read_request(connection, &request.data, request.streams, &request.has_streams);
+  if (state == REQUEST_PARTIAL) {
+    return;
+  } else if (state == REQUEST_COMPLETE) {
+    queued.emplace_back(connection, std::move(request));
+  } else {
+    discard(connection, request.has_streams, request.streams);
+  }
+  pending.erase(connection);
+  start();
+}
+
+void Server::start() {
+  while (running.size() < workers && !queued.empty()) {
+    std::pair<int, Request> next = std::move(queued.front());
+    queued.pop_front();
+    handle(next.first, next.second);
+  }
+}
+
+void Server::handle(int connection, Request &request) {
+  Worker worker = {connection, request.data.substr(sizeof(uint32_t)), {}, 0, "", -1};
+  const std::string &path = worker.path;
+
+  // A new or changed script is only read here; the worker parses it
+  Interpreter *interpreter = nullptr;
+  std::string error;
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    error = path + ": Failed to open file: " + path + "\n";
+  } else {
+    worker.modified = info.st_mtim;
+    worker.size = info.st_size;
+    interpreter = find(path, info);
+    if (!interpreter) {
+      std::ifstream file(path);
+      if (!file.is_open()) {
+        error = path + ": Failed to open file: " + path + "\n";
+      } else {
+        worker.code.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+      }
+    }
+  }
+
+  int compiled[2] = {-1, -1};
+  pid_t pid = -1;
+  if (error.empty()) {
+    if (!interpreter && pipe2(compiled, O_CLOEXEC) != 0) {
+      error = std::string("Failed to start a worker: ") + strerror(errno) + "\n";
+    } else {
+      std::cout.flush();
+      std::cerr.flush();
+      pid = fork();
+      if (pid < 0) {
+        error = std::string("Failed to start a worker: ") + strerror(errno) + "\n";
+      }
+    }
+  }
+
+  if (pid == 0) {
+    // The worker runs its own copy of the program on the client's streams.
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    for (int i = 0; i < STREAMS; i++) {
+      dup2(request.streams[i], i);
+      close(request.streams[i]);
+    }
+    close(listener);
+    close(child_exits[0]);
+    close(child_exits[1]);
+    close(connection);
+    for (const auto &other : running) {
+      close(other.second.connection);
+      if (other.second.compiled >= 0) {
+        close(other.second.compiled);
+      }
+    }
+    // Other clients must see their streams close when the server closes them
+    for (const auto &other : pending) {
+      discard(other.first, other.second.has_streams, other.second.streams);
+    }
+    for (const auto &other : queued) {
+      discard(other.first, other.second.has_streams, other.second.streams);
+    }
+
+    int status;
+    try {
+      if (!interpreter) {
+        // A script that crashes or hangs the parser only takes this worker down
+        close(compiled[0]);
+        signal(SIGALRM, on_compile_timeout);
+        alarm(COMPILE_SECONDS);
+        interpreter = new Interpreter(worker.code, options);
+        alarm(0);
+        signal(SIGALRM, SIG_DFL);
+        write_all(compiled[1], "", 1);
+        close(compiled[1]);
+      }
+      status = runner(interpreter, path);
+    } catch (const std::exception &e) {
+      std::cerr << path << ": " << e.what() << std::endl;
+      status = 1;
+    }
+    // Flushes and closes the files the script left open.
+    delete interpreter;
+    std::cout.flush();
+    _exit(status);
+  }
+
+  if (pid < 0) {
+    write_all(request.streams[2], error.data(), error.size());
+  }
+  for (int i = 0; i < STREAMS; i++) {
+    close(request.streams[i]);
+  }
+  if (compiled[1] >= 0) {
+    close(compiled[1]);
+  }
+  if (pid < 0) {
+    if (compiled[0] >= 0) {
+      close(compiled[0]);
+    }
+    finish(connection, 1);
+  } else {
+    worker.compiled = compiled[0];
+    running[pid] = std::move(worker);
+  }
+}
+
+void Server::reap() {
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    auto found = running.find(pid);
+    if (found == running.end()) {
+      continue;
+    }
+    Worker &worker = found->second;
+    finish(worker.connection, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+
+    // The server parses a script only after a worker parsed the same source without failing
+    if (worker.compiled >= 0) {
+      char byte;
+      ssize_t n;
+      do {
+        n = read(worker.compiled, &byte, 1);
+      } while (n < 0 && errno == EINTR);
+      close(worker.compiled);
+      if (n == 1) {
+        store(worker);
+      }
+    }
+    running.erase(found);
+  }
+  start();
+}
+
+void Server::run() {
+  if (pipe2(child_exits, O_CLOEXEC | O_NONBLOCK) != 0) {
+    throw std::runtime_error(std::string("Failed to create pipe: ") + strerror(errno));
+  }
+  struct sigaction action = {};
+  action.sa_handler = on_child_exit;
+  action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &action, nullptr);
+  // A client that went away must not kill the server when it gets its status.
+  signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un address = socket_address(socket_path);
+  listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  unlink(socket_path.c_str());
+  if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    throw std::runtime_error("Failed to listen on " + socket_path + ": " + strerror(errno));
+  }
+
+  std::vector<pollfd> events;
+  while (true) {
+    // Requests are read as their bytes arrive and wait in the queue while every worker is busy.
+    events.clear();
+    events.push_back({child_exits[0], POLLIN, 0});
+    events.push_back({listener, POLLIN, 0});
+    for (const auto &request : pending) {
+      events.push_back({request.first, POLLIN, 0});
+    }
+    if (poll(events.data(), events.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("Failed to wait for clients: ") + strerror(errno));
+    }
+
+    if (events[0].revents & POLLIN) {
+      char bytes[64];
+      while (read(child_exits[0], bytes, sizeof(bytes)) > 0) {
+      }
+      reap();
+    }
+    if (events[1].revents & POLLIN) {
+      int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+      if (connection >= 0) {
+        pending[connection] = {"", {-1, -1, -1}, false};
+      }
+    }
+    for (size_t i = 2; i < events.size(); i++) {
+      if (events[i].revents) {
+        receive(events[i].fd);
+      }
+    }
+  }
+}
+
+int run_client(const std::string &socket_path, const std::string &script) {
+  char resolved[PATH_MAX];
+  if (!realpath(script.c_str(), resolved)) {
+    std::cerr << "Failed to open file: " << script << std::endl;
+    return 1;
+  }
+
+  int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un address = socket_address(socket_path);
+  if (connection < 0 || connect(connection, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+    std::cerr << "Failed to connect to " << socket_path << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  const int streams[STREAMS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  int32_t status;
+  if (!send_request(connection, resolved, streams) || !read_all(connection, &status, sizeof(status))) {
+    std::cerr << "Server at " << socket_path << " closed the connection" << std::endl;
+    close(connection);
+    return 1;
+  }
+  close(connection);
+  return status;
+}
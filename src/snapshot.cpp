@@ -0,0 +1,532 @@
+#include "../include/snapshot.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+static const char MAGIC[8] = {'A', 'N', 'K', 'R', 'S', 'N', 'A', 'P'};
+static const uint32_t VERSION = 4;
+
+/**
+ * Kinds of node in the encoded AST.
+ */
+enum NodeTag : uint8_t {
+  TAG_NULL, TAG_BLOCK, TAG_VARIABLE, TAG_TYPED_VARIABLE, TAG_FUNCTION, TAG_TERMINAL,
+  TAG_UNARY, TAG_BINARY, TAG_TYPED_BINARY, TAG_IF, TAG_WHILE, TAG_FOR
+};
+
+/**
+ * Appends the encoding of a program's state to a byte buffer. Nodes are
+ * numbered in the order they are written, so bindings can refer to the
+ * function they hold and to the node their name belongs to.
+ */
+class SnapshotEncoder {
+public:
+  std::string data; ///< Encoded bytes.
+  std::unordered_map<const Node *, uint32_t> nodes; ///< Number of each node written.
+  std::unordered_map<Symbol, uint32_t> names; ///< Number of a node owning each identifier.
+  std::unordered_map<const ArrayValue *, uint32_t> arrays; ///< Number of each array written.
+
+  void u8(uint8_t v) { data.push_back(static_cast<char>(v)); }
+
+  void u32(uint32_t v) { data.append(reinterpret_cast<const char *>(&v), sizeof(v)); }
+
+  void u64(uint64_t v) { data.append(reinterpret_cast<const char *>(&v), sizeof(v)); }
+
+  void f64(double v) { data.append(reinterpret_cast<const char *>(&v), sizeof(v)); }
+
+  void string(const std::string &s) {
+    u32(s.size());
+    data += s;
+  }
+
+  void token(const Token &t) {
+    u32(t.type);
+    string(t.value);
+  }
+
+  void value(const Value *v) {
+    u8(v->type);
+    switch (v->type) {
+    case TYPE_INT: u32(static_cast<const IntValue *>(v)->value); break;
+    case TYPE_FLOAT: f64(static_cast<const FloatValue *>(v)->value); break;
+    case TYPE_BOOL: u8(static_cast<const BoolValue *>(v)->value); break;
+    case TYPE_STRING:
+      u8(static_cast<const StringValue *>(v)->shared);
+      string(static_cast<const StringValue *>(v)->value);
+      break;
+    case TYPE_ARRAY: {
+      // Arrays are modified in place, so one held by several variables is
+      // written once and referred to by number afterwards.
+      const auto *array = static_cast<const ArrayValue *>(v);
+      auto found = arrays.find(array);
+      if (found != arrays.end()) {
+        u32(found->second);
+        break;
+      }
+      u32(arrays.size());
+      arrays[array] = arrays.size();
+      u8(array->element_type);
+      u32(array->size());
+      if (array->element_type == TYPE_INT) {
+        data.append(reinterpret_cast<const char *>(array->ints.data()), array->ints.size() * sizeof(int));
+      } else {
+        data.append(reinterpret_cast<const char *>(array->floats.data()), array->floats.size() * sizeof(double));
+      }
+      break;
+    }
+    default: break;
+    }
+  }
+
+  /**
+   * Writes the tag and source line that start every node.
+   */
+  void begin(NodeTag tag, const Node *n) {
+    u8(tag);
+    u32(n->line);
+  }
+
+  void node(const Node *n) {
+    if (!n) {
+      u8(TAG_NULL);
+      return;
+    }
+    uint32_t id = nodes.size();
+    nodes[n] = id;
+
+    // Subclasses are checked before the classes they extend.
+    if (auto *bn = dynamic_cast<const BlockNode *>(n)) {
+      begin(TAG_BLOCK, n);
+      u32(bn->statements.size());
+      for (Node *s : bn->statements) {
+        node(s);
+      }
+    } else if (auto *tvn = dynamic_cast<const TypedVariableNode *>(n)) {
+      names[tvn->identifier.symbol] = id;
+      begin(TAG_TYPED_VARIABLE, n);
+      token(tvn->identifier);
+      u8(tvn->type);
+    } else if (auto *vn = dynamic_cast<const VariableNode *>(n)) {
+      names[vn->identifier.symbol] = id;
+      begin(TAG_VARIABLE, n);
+      token(vn->identifier);
+      u8(vn->is_definition);
+      u8(vn->annotation);
+      node(vn->initializer);
+    } else if (auto *fnn = dynamic_cast<const FunctionNode *>(n)) {
+      names[fnn->identifier.symbol] = id;
+      begin(TAG_FUNCTION, n);
+      token(fnn->identifier);
+      u8(fnn->is_definition);
+      u8(fnn->is_pure);
+      u8(fnn->return_type);
+      u32(fnn->parameters.size());
+      for (Node *p : fnn->parameters) {
+        node(p);
+      }
+      node(fnn->body);
+    } else if (auto *tn = dynamic_cast<const TerminalNode *>(n)) {
+      begin(TAG_TERMINAL, n);
+      value(tn->v);
+    } else if (auto *un = dynamic_cast<const UnaryNode *>(n)) {
+      begin(TAG_UNARY, n);
+      token(un->token);
+      node(un->child);
+    } else if (auto *tbn = dynamic_cast<const TypedBinaryNode *>(n)) {
+      begin(TAG_TYPED_BINARY, n);
+      token(tbn->token);
+      u8(tbn->left_type);
+      u8(tbn->right_type);
+      u8(tbn->type);
+      node(tbn->left);
+      node(tbn->right);
+    } else if (auto *bnn = dynamic_cast<const BinaryNode *>(n)) {
+      begin(TAG_BINARY, n);
+      token(bnn->token);
+      node(bnn->left);
+      node(bnn->right);
+    } else if (auto *in = dynamic_cast<const IfNode *>(n)) {
+      begin(TAG_IF, n);
+      node(in->condition);
+      node(in->true_body);
+      node(in->false_body);
+    } else if (auto *wn = dynamic_cast<const WhileNode *>(n)) {
+      begin(TAG_WHILE, n);
+      node(wn->condition);
+      node(wn->body);
+    } else if (auto *fn = dynamic_cast<const ForNode *>(n)) {
+      begin(TAG_FOR, n);
+      node(fn->initialization);
+      node(fn->condition);
+      node(fn->update);
+      node(fn->body);
+    } else {
+      throw std::runtime_error("Cannot save node in snapshot: " + n->to_string());
+    }
+  }
+};
+
+/**
+ * Reads an encoded program's state back from memory, checking every read
+ * against the end of the data.
+ */
+class SnapshotDecoder {
+private:
+  const char *position; ///< Next byte to read.
+  const char *end;      ///< End of the data.
+
+  /**
+   * Takes the next bytes of the data.
+   * @param size Number of bytes.
+   * @return Pointer to the first byte.
+   */
+  const char *take(size_t size) {
+    if (size_t(end - position) < size) {
+      throw std::runtime_error("Snapshot is truncated");
+    }
+    const char *start = position;
+    position += size;
+    return start;
+  }
+
+  /**
+   * Reads how many nodes follow, before anything is allocated for them.
+   * Even a missing node takes a byte, so a count beyond the bytes left is corrupt.
+   */
+  uint32_t node_count() {
+    uint32_t count = u32();
+    if (count > size_t(end - position)) {
+      throw std::runtime_error("Snapshot is corrupt: invalid node count");
+    }
+    return count;
+  }
+
+public:
+  std::vector<Node *> nodes;               ///< Nodes by number.
+  std::vector<Symbol> names;               ///< Identifier of each node, NO_SYMBOL if it has none.
+  std::vector<ArrayValue *> arrays;        ///< Arrays by number.
+
+  SnapshotDecoder(const char *data, size_t size) : position(data), end(data + size), nodes(), names(), arrays() {}
+
+  uint8_t u8() { return static_cast<uint8_t>(*take(1)); }
+
+  uint32_t u32() {
+    uint32_t v;
+    memcpy(&v, take(sizeof(v)), sizeof(v));
+    return v;
+  }
+
+  uint64_t u64() {
+    uint64_t v;
+    memcpy(&v, take(sizeof(v)), sizeof(v));
+    return v;
+  }
+
+  double f64() {
+    double v;
+    memcpy(&v, take(sizeof(v)), sizeof(v));
+    return v;
+  }
+
+  std::string string() {
+    uint32_t size = u32();
+    return std::string(take(size), size);
+  }
+
+  Token token() {
+    TokenType type = static_cast<TokenType>(u32());
+    Token t{type, string()};
+    if (type == IDENTIFIER || type == STRING) {
+      t.symbol = symbols.intern(t.value);
+    }
+    return t;
+  }
+
+  ValueType type() {
+    uint8_t t = u8();
+    if (t > VALUE_TYPE_COUNT + 1) {
+      throw std::runtime_error("Snapshot is corrupt: invalid type");
+    }
+    return static_cast<ValueType>(t);
+  }
+
+  Value *value() {
+    switch (type()) {
+    case TYPE_INT: return new IntValue(static_cast<int32_t>(u32()));
+    case TYPE_FLOAT: return new FloatValue(f64());
+    case TYPE_BOOL: return new BoolValue(u8() != 0);
+    case TYPE_STRING: {
+      bool shared = u8() != 0;
+      auto *s = new StringValue(string());
+      s->shared = shared;
+      return s;
+    }
+    case TYPE_VOID: return new VoidValue();
+    case TYPE_ARRAY: return array();
+    default: throw std::runtime_error("Snapshot is corrupt: invalid value");
+    }
+  }
+
+  ArrayValue *array() {
+    uint32_t id = u32();
+    if (id < arrays.size()) {
+      return arrays[id];
+    } else if (id > arrays.size()) {
+      throw std::runtime_error("Snapshot is corrupt: invalid array");
+    }
+    ValueType element_type = type();
+    if (element_type != TYPE_INT && element_type != TYPE_FLOAT) {
+      throw std::runtime_error("Snapshot is corrupt: invalid array");
+    }
+    uint32_t size = u32();
+    // The elements must be there before any memory is set aside for them
+    size_t element_size = element_type == TYPE_INT ? sizeof(int) : sizeof(double);
+    const char *elements = take(size_t(size) * element_size);
+    auto *array = new ArrayValue(element_type, 0);
+    if (element_type == TYPE_INT) {
+      array->ints.resize(size);
+      memcpy(array->ints.data(), elements, size_t(size) * sizeof(int));
+    } else {
+      array->floats.resize(size);
+      memcpy(array->floats.data(), elements, size_t(size) * sizeof(double));
+    }
+    arrays.push_back(array);
+    return array;
+  }
+
+  BlockNode *block() {
+    Node *n = node();
+    auto *bn = dynamic_cast<BlockNode *>(n);
+    if (n && !bn) {
+      delete n;
+      throw std::runtime_error("Snapshot is corrupt: expected a block");
+    }
+    return bn;
+  }
+
+  Node *node() {
+    uint8_t tag = u8();
+    if (tag == TAG_NULL) {
+      return nullptr;
+    }
+    uint32_t id = nodes.size();
+    nodes.push_back(nullptr);
+    names.push_back(NO_SYMBOL);
+    int line = u32();
+
+    Node *n;
+    switch (tag) {
+    case TAG_BLOCK: {
+      std::vector<Node *> statements(node_count());
+      for (Node *&s : statements) {
+        s = node();
+      }
+      n = new BlockNode(statements);
+      break;
+    }
+    case TAG_VARIABLE: {
+      Token identifier = token();
+      bool is_definition = u8() != 0;
+      ValueType annotation = type();
+      auto *vn = new VariableNode(identifier, node(), is_definition);
+      vn->annotation = annotation;
+      names[id] = vn->identifier.symbol;
+      n = vn;
+      break;
+    }
+    case TAG_TYPED_VARIABLE: {
+      Token identifier = token();
+      auto *tvn = new TypedVariableNode(identifier, type());
+      names[id] = tvn->identifier.symbol;
+      n = tvn;
+      break;
+    }
+    case TAG_FUNCTION: {
+      Token identifier = token();
+      bool is_definition = u8() != 0;
+      bool is_pure = u8() != 0;
+      ValueType return_type = type();
+      std::vector<Node *> parameters(node_count());
+      for (Node *&p : parameters) {
+        p = node();
+      }
+      auto *fnn = new FunctionNode(identifier, parameters, block(), is_definition, is_pure);
+      fnn->return_type = return_type;
+      names[id] = fnn->identifier.symbol;
+      n = fnn;
+      break;
+    }
+    case TAG_TERMINAL: {
+      Value *v = value();
+      if (auto *literal = dynamic_cast<StringValue *>(v)) {
+        literal->symbol = symbols.intern(literal->value);
+      }
+      n = new TerminalNode(v);
+      break;
+    }
+    case TAG_UNARY: {
+      Token t = token();
+      n = new UnaryNode(t, node());
+      break;
+    }
+    case TAG_BINARY: {
+      Token t = token();
+      Node *left = node();
+      n = new BinaryNode(t, left, node());
+      break;
+    }
+    case TAG_TYPED_BINARY: {
+      Token t = token();
+      ValueType left_type = type();
+      ValueType right_type = type();
+      ValueType result = type();
+      Node *left = node();
+      n = new TypedBinaryNode(t, left, node(), left_type, right_type, result);
+      break;
+    }
+    case TAG_IF: {
+      Node *condition = node();
+      Node *true_body = node();
+      n = new IfNode(condition, true_body, node());
+      break;
+    }
+    case TAG_WHILE: {
+      Node *condition = node();
+      n = new WhileNode(condition, block());
+      break;
+    }
+    case TAG_FOR: {
+      Node *initialization = node();
+      Node *condition = node();
+      Node *update = node();
+      n = new ForNode(initialization, condition, update, block());
+      break;
+    }
+    default: throw std::runtime_error("Snapshot is corrupt: invalid node");
+    }
+    n->line = line;
+    nodes[id] = n;
+    return n;
+  }
+
+  /**
+   * Reads a node number written by the encoder.
+   * @return The node's number, checked to exist.
+   */
+  uint32_t node_id() {
+    uint32_t id = u32();
+    if (id >= nodes.size()) {
+      throw std::runtime_error("Snapshot is corrupt: invalid node reference");
+    }
+    return id;
+  }
+
+  bool at_end() const { return position == end; }
+};
+
+void save_snapshot(const std::string &path, const Snapshot &snapshot) {
+  SnapshotEncoder encoder;
+  encoder.data.append(MAGIC, sizeof(MAGIC));
+  encoder.u32(VERSION);
+  encoder.node(snapshot.ast);
+  encoder.u32(snapshot.next_statement);
+  for (uint64_t word : snapshot.random.state) {
+    encoder.u64(word);
+  }
+
+  encoder.u32(snapshot.globals.size());
+  for (const Binding &b : snapshot.globals) {
+    // A function is restored from its definition, a variable from any node with its name.
+    uint32_t id;
+    if (b.function) {
+      id = encoder.nodes.at(b.function);
+    } else {
+      auto name = encoder.names.find(b.name);
+      if (name == encoder.names.end()) {
+        throw std::runtime_error("Cannot save a variable whose name is not part of the program");
+      }
+      id = name->second;
+    }
+    encoder.u8(b.function != nullptr);
+    encoder.u32(id);
+    if (!b.function) {
+      encoder.u8(b.type);
+      encoder.value(b.value);
+    }
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(encoder.data.data(), encoder.data.size());
+  file.close();
+  if (!file) {
+    throw std::runtime_error("Failed to write snapshot: " + path);
+  }
+}
+
+Snapshot load_snapshot(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open snapshot: " + path + ": " + strerror(errno));
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(MAGIC)) {
+    ::close(fd);
+    throw std::runtime_error("Not a snapshot: " + path);
+  }
+  size_t size = info.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("Failed to map snapshot: " + path + ": " + strerror(errno));
+  }
+
+  Snapshot snapshot;
+  try {
+    if (memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+      throw std::runtime_error("Not a snapshot: " + path);
+    }
+    SnapshotDecoder decoder(static_cast<const char *>(data) + sizeof(MAGIC), size - sizeof(MAGIC));
+    if (decoder.u32() != VERSION) {
+      throw std::runtime_error("Snapshot was written by a different version of ankr: " + path);
+    }
+    snapshot.ast = decoder.block();
+    snapshot.next_statement = decoder.u32();
+    if (!snapshot.ast || snapshot.next_statement > snapshot.ast->statements.size()) {
+      throw std::runtime_error("Snapshot is corrupt: invalid resume point");
+    }
+    for (uint64_t &word : snapshot.random.state) {
+      word = decoder.u64();
+    }
+
+    uint32_t count = decoder.u32();
+    for (uint32_t i = 0; i < count; i++) {
+      bool is_function = decoder.u8() != 0;
+      uint32_t id = decoder.node_id();
+      auto *function = dynamic_cast<FunctionNode *>(decoder.nodes[id]);
+      if (!decoder.names[id] || (is_function && !function)) {
+        throw std::runtime_error("Snapshot is corrupt: invalid binding");
+      }
+      if (is_function) {
+        snapshot.globals.push_back({decoder.names[id], nullptr, function});
+      } else {
+        ValueType declared = decoder.type();
+        snapshot.globals.push_back({decoder.names[id], decoder.value(), nullptr, declared});
+      }
+    }
+    if (!decoder.at_end()) {
+      throw std::runtime_error("Snapshot is corrupt: trailing data");
+    }
+  } catch (...) {
+    munmap(data, size);
+    delete snapshot.ast;
+    throw;
+  }
+  munmap(data, size);
+  return snapshot;
+}
@@ -0,0 +1,88 @@
+#include "../include/stats.h"
+#include <sstream>
+
+thread_local Stats stats = {};
+
+static const char *node_names[NODE_KIND_COUNT] = {
+    "block", "variable", "function", "terminal", "unary",
+    "binary", "if", "while", "for"};
+
+static const char *type_names[VALUE_TYPE_COUNT + 1] = {
+    "int", "float", "string", "bool", "void", "array", "none"};
+
+/**
+ * Finds the source spelling of an operator, e.g. "+" for ADD.
+ */
+static std::string operator_name(int type) {
+  for (const auto &entry : token_map) {
+    if (entry.second.type == type) {
+      return entry.first;
+    }
+  }
+  return std::to_string(type);
+}
+
+std::string stats_to_json(const Stats &s) {
+  std::ostringstream json;
+  json << "{\n";
+
+  json << "  \"nodes\": {";
+  for (int i = 0; i < NODE_KIND_COUNT; i++) {
+    json << (i ? ", " : "") << "\"" << node_names[i] << "\": " << s.nodes[i];
+  }
+  json << "},\n";
+
+  // Only operator/type combinations that actually occurred are listed.
+  json << "  \"operators\": {";
+  bool first_operator = true;
+  for (int op = 0; op < TOKEN_TYPE_COUNT; op++) {
+    bool first_pair = true;
+    for (int left = 0; left < VALUE_TYPE_COUNT; left++) {
+      for (int right = 0; right <= VALUE_TYPE_COUNT; right++) {
+        uint64_t count = s.operators[op][left][right];
+        if (!count) {
+          continue;
+        }
+        if (first_pair) {
+          json << (first_operator ? "\n" : ",\n") << "    \"" << operator_name(op) << "\": {";
+          first_operator = false;
+        }
+        json << (first_pair ? "" : ", ") << "\"" << type_names[left] << "," << type_names[right] << "\": " << count;
+        first_pair = false;
+      }
+    }
+    if (!first_pair) {
+      json << "}";
+    }
+  }
+  json << (first_operator ? "},\n" : "\n  },\n");
+
+  json << "  \"values\": {";
+  for (int i = 0; i < VALUE_TYPE_COUNT; i++) {
+    json << (i ? ", " : "") << "\"" << type_names[i] << "\": {\"allocated\": " << s.values_allocated[i]
+         << ", \"freed\": " << s.values_freed[i] << "}";
+  }
+  json << "},\n";
+
+  json << "  \"scopes\": {\"pushes\": " << s.scope_pushes << ", \"pops\": " << s.scope_pops
+       << ", \"peak_depth\": " << s.peak_scope_depth << "},\n";
+
+  double average = s.variable_lookups ? double(s.lookup_entries_scanned) / s.variable_lookups : 0.0;
+  json << "  \"lookups\": {\"count\": " << s.variable_lookups << ", \"entries_scanned\": " << s.lookup_entries_scanned
+       << ", \"average_scanned\": " << average << "},\n";
+
+  json << "  \"typed_operations\": " << s.typed_operations << ",\n";
+  json << "  \"strings_appended_in_place\": " << s.strings_appended << ",\n";
+
+  json << "  \"calls\": {\"functions\": " << s.function_calls << ", \"builtins\": " << s.builtin_calls << "},\n";
+
+  json << "  \"memo\": {\"hits\": " << s.memo_hits << ", \"misses\": " << s.memo_misses
+       << ", \"evictions\": " << s.memo_evictions << "},\n";
+
+  json << "  \"jit\": {\"compiled\": " << s.jit_compiled << ", \"failed\": " << s.jit_failed
+       << ", \"entries\": " << s.jit_entries << ", \"guard_exits\": " << s.jit_guard_exits << "},\n";
+  json << "  \"ir\": {\"compiled\": " << s.ir_compiled << ", \"failed\": " << s.ir_failed
+       << ", \"entries\": " << s.ir_entries << ", \"guard_exits\": " << s.ir_guard_exits << "}\n";
+  json << "}";
+  return json.str();
+}
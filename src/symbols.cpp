@@ -0,0 +1,137 @@
+#include "../include/symbols.h"
+#include <functional>
+#include <stdexcept>
+
+SymbolTable symbols;
+
+SymbolTable::Table::Table(size_t capacity) : capacity(capacity), slots(new std::atomic<Symbol>[capacity]) {
+  for (size_t i = 0; i < capacity; i++) {
+    slots[i].store(NO_SYMBOL, std::memory_order_relaxed);
+  }
+}
+
+SymbolTable::SymbolTable() : next(NO_SYMBOL + 1) {
+  for (Shard &shard : shards) {
+    shard.tables.push_back(new Table(64));
+    shard.table.store(shard.tables.back(), std::memory_order_relaxed);
+  }
+  for (auto &chunk : chunks) {
+    chunk.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+SymbolTable::~SymbolTable() {
+  for (unsigned c = 0; c < CHUNKS; c++) {
+    std::atomic<const std::string *> *chunk = chunks[c].load();
+    for (size_t i = 0; chunk && i < static_cast<size_t>(FIRST_CHUNK) << c; i++) {
+      delete chunk[i].load();
+    }
+    delete[] chunk;
+  }
+  for (Shard &shard : shards) {
+    for (Table *table : shard.tables) {
+      delete table;
+    }
+  }
+}
+
+size_t SymbolTable::locate(Symbol symbol, unsigned *chunk) {
+  // Chunk c holds FIRST_CHUNK << c names, starting after the names of the chunks before it.
+  uint64_t position = symbol / FIRST_CHUNK + 1;
+  *chunk = 63 - __builtin_clzll(position);
+  return symbol - static_cast<uint64_t>(FIRST_CHUNK) * ((uint64_t(1) << *chunk) - 1);
+}
+
+Symbol SymbolTable::probe(const Table *table, size_t hash, const std::string &name) const {
+  size_t mask = table->capacity - 1;
+  for (size_t i = (hash / SHARDS) & mask;; i = (i + 1) & mask) {
+    Symbol symbol = table->slots[i].load(std::memory_order_acquire);
+    if (symbol == NO_SYMBOL || this->name(symbol) == name) {
+      return symbol;
+    }
+  }
+}
+
+Symbol SymbolTable::intern(const std::string &name) {
+  size_t hash = std::hash<std::string>()(name);
+  Shard &shard = shards[hash % SHARDS];
+  if (Symbol symbol = probe(shard.table.load(std::memory_order_acquire), hash, name)) {
+    return symbol;
+  }
+
+  std::lock_guard<std::mutex> guard(shard.lock);
+  Table *table = shard.table.load(std::memory_order_relaxed);
+  if (Symbol symbol = probe(table, hash, name)) {
+    return symbol; // Added by another thread since the first probe
+  }
+
+  // Tables stay at most half full, so probes stay short and always end.
+  if (2 * (shard.count + 1) > table->capacity) {
+    auto *larger = new Table(2 * table->capacity);
+    size_t mask = larger->capacity - 1;
+    for (size_t i = 0; i < table->capacity; i++) {
+      Symbol symbol = table->slots[i].load(std::memory_order_relaxed);
+      if (symbol != NO_SYMBOL) {
+        size_t j = (std::hash<std::string>()(this->name(symbol)) / SHARDS) & mask;
+        while (larger->slots[j].load(std::memory_order_relaxed) != NO_SYMBOL) {
+          j = (j + 1) & mask;
+        }
+        larger->slots[j].store(symbol, std::memory_order_relaxed);
+      }
+    }
+    shard.tables.push_back(larger);
+    shard.table.store(larger, std::memory_order_release);
+    table = larger;
+  }
+
+  Symbol symbol = next.fetch_add(1, std::memory_order_relaxed);
+  if (symbol >= static_cast<uint64_t>(FIRST_CHUNK) * ((uint64_t(1) << CHUNKS) - 1)) {
+    throw std::runtime_error("Too many distinct identifiers and strings");
+  }
+  unsigned c;
+  size_t offset = locate(symbol, &c);
+  std::atomic<const std::string *> *chunk = chunks[c].load(std::memory_order_acquire);
+  if (!chunk) {
+    size_t size = static_cast<size_t>(FIRST_CHUNK) << c;
+    auto *fresh = new std::atomic<const std::string *>[size];
+    for (size_t i = 0; i < size; i++) {
+      fresh[i].store(nullptr, std::memory_order_relaxed);
+    }
+    // Writers of other shards may need the same chunk at the same time.
+    if (chunks[c].compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) {
+      chunk = fresh;
+    } else {
+      delete[] fresh;
+    }
+  }
+  chunk[offset].store(new std::string(name), std::memory_order_release);
+
+  size_t mask = table->capacity - 1;
+  size_t i = (hash / SHARDS) & mask;
+  while (table->slots[i].load(std::memory_order_relaxed) != NO_SYMBOL) {
+    i = (i + 1) & mask;
+  }
+  // Publishing the symbol last makes its name visible to readers that find it.
+  table->slots[i].store(symbol, std::memory_order_release);
+  shard.count++;
+  return symbol;
+}
+
+Symbol SymbolTable::find(const std::string &name) const {
+  size_t hash = std::hash<std::string>()(name);
+  return probe(shards[hash % SHARDS].table.load(std::memory_order_acquire), hash, name);
+}
+
+const std::string &SymbolTable::name(Symbol symbol) const {
+  static const std::string none;
+  if (symbol == NO_SYMBOL) {
+    return none;
+  }
+  unsigned c;
+  size_t offset = locate(symbol, &c);
+  return *chunks[c].load(std::memory_order_acquire)[offset].load(std::memory_order_acquire);
+}
+
+size_t SymbolTable::size() const {
+  return next.load(std::memory_order_relaxed) - 1;
+}
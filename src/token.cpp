@@ -68,7 +68,6 @@ int precedence(TokenType type) {
   case DIVIDE:
   case MODULO:
     return 2;
-  case NOT:
   case NEGATIVE:
   case INCREMENT:
   case DECREMENT:
@@ -86,6 +85,8 @@ int precedence(TokenType type) {
   case EQUAL:
   case NOT_EQUAL:
     return 7;
+  case NOT:
+    return 8;
   default:
     return -1;
   }
@@ -103,6 +104,7 @@ std::map<std::string, Token> token_map = {
     {"true", {TRUE, "true"}},
     {"false", {FALSE, "false"}},
     {"break", {BREAK, "break"}},
+    {"pure", {PURE, "pure"}},
     // Operators and Punctuation
     {"+", {ADD, "+"}},
     {"-", {SUBTRACT, "-"}},
@@ -118,6 +120,7 @@ std::map<std::string, Token> token_map = {
     {"}", {RIGHT_BRACKET, "}"}},
     {",", {COMMA, ","}},
     {".", {DOT, "."}},
+    {":", {COLON, ":"}},
     // Assignment
     {"=", {ASSIGN, "="}},
     {"+=", {ASSIGN_ADD, "+="}},
@@ -0,0 +1,171 @@
+#include "../include/trace.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+static const char MAGIC[8] = {'A', 'N', 'K', 'R', 'T', 'R', 'C', 'E'};
+static const uint8_t VERSION = 1;
+
+Trace::Trace(const std::string &path, TraceMode mode)
+    : path(path), writer(), fd(-1), interactive(isatty(STDIN_FILENO)), data(), position() {
+  if (mode == TRACE_RECORD) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open trace: " + path + " (" + strerror(errno) + ")");
+    }
+    writer = new OutputWriter(fd);
+    const char version = VERSION;
+    writer->write(std::string_view(MAGIC, sizeof(MAGIC)));
+    writer->write(std::string_view(&version, 1));
+    return;
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("Failed to open trace: " + path);
+  }
+  data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  if (data.size() < sizeof(MAGIC) + 1 || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+    throw std::runtime_error("Not a trace: " + path);
+  } else if (static_cast<uint8_t>(data[sizeof(MAGIC)]) != VERSION) {
+    throw std::runtime_error("Trace was written by a different version of ankr: " + path);
+  }
+  position = sizeof(MAGIC) + 1;
+}
+
+Trace::~Trace() {
+  if (writer) {
+    try {
+      writer->flush();
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+    delete writer;
+    ::close(fd);
+  }
+}
+
+bool Trace::replaying() const {
+  return !writer;
+}
+
+void Trace::put(Event event) {
+  char byte = static_cast<char>(event);
+  writer->write(std::string_view(&byte, 1));
+}
+
+void Trace::put_varint(uint64_t value) {
+  char bytes[10];
+  size_t length = 0;
+  while (value >= 0x80) {
+    bytes[length++] = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  bytes[length++] = static_cast<char>(value);
+  writer->write(std::string_view(bytes, length));
+}
+
+Trace::Event Trace::take(Event expected, Event alternative, const char *what) {
+  if (position >= data.size()) {
+    throw std::runtime_error("Trace ended where the program expected " + std::string(what) + ": " + path);
+  }
+  auto event = static_cast<Event>(data[position]);
+  if (event != expected && event != alternative) {
+    throw std::runtime_error("Trace does not match the program: expected " + std::string(what) + " at byte " +
+                             std::to_string(position) + " of " + path);
+  }
+  position++;
+  return event;
+}
+
+uint64_t Trace::take_varint() {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (position >= data.size()) {
+      break;
+    }
+    uint8_t byte = static_cast<uint8_t>(data[position++]);
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  throw std::runtime_error("Trace is corrupt: " + path);
+}
+
+void Trace::record_line(const std::string_view *line) {
+  if (!line) {
+    put(EVENT_END_OF_INPUT);
+  } else {
+    put(EVENT_LINE);
+    put_varint(line->size());
+    writer->write(*line);
+  }
+  // A session typed at a terminal may well end with Ctrl-C.
+  if (interactive) {
+    flush();
+  }
+}
+
+bool Trace::replay_line(std::string_view *line) {
+  if (take(EVENT_LINE, EVENT_END_OF_INPUT, "a line of input") == EVENT_END_OF_INPUT) {
+    *line = std::string_view();
+    return false;
+  }
+  uint64_t length = take_varint();
+  if (length > data.size() - position) {
+    throw std::runtime_error("Trace is truncated: " + path);
+  }
+  *line = std::string_view(data.data() + position, length);
+  position += length;
+  return true;
+}
+
+void Trace::record_eof(bool eof) {
+  put(eof ? EVENT_NO_MORE_INPUT : EVENT_MORE_INPUT);
+  if (interactive) {
+    flush();
+  }
+}
+
+bool Trace::replay_eof() {
+  return take(EVENT_NO_MORE_INPUT, EVENT_MORE_INPUT, "eof()") == EVENT_NO_MORE_INPUT;
+}
+
+int Trace::random_int(int drawn) {
+  if (writer) {
+    put(EVENT_INT);
+    // Zigzag encoding keeps small negative numbers short too.
+    put_varint((static_cast<uint32_t>(drawn) << 1) ^ static_cast<uint32_t>(drawn >> 31));
+    return drawn;
+  }
+  take(EVENT_INT, EVENT_INT, "a number from rand()");
+  auto encoded = static_cast<uint32_t>(take_varint());
+  return static_cast<int>((encoded >> 1) ^ (0u - (encoded & 1)));
+}
+
+double Trace::random_float(double drawn) {
+  if (writer) {
+    put(EVENT_FLOAT);
+    writer->write(std::string_view(reinterpret_cast<const char *>(&drawn), sizeof(drawn)));
+    return drawn;
+  }
+  take(EVENT_FLOAT, EVENT_FLOAT, "a number from rand_float()");
+  if (data.size() - position < sizeof(double)) {
+    throw std::runtime_error("Trace is truncated: " + path);
+  }
+  double value;
+  memcpy(&value, data.data() + position, sizeof(value));
+  position += sizeof(value);
+  return value;
+}
+
+void Trace::flush() {
+  if (writer) {
+    writer->flush();
+  }
+}
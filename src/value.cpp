@@ -1,7 +1,63 @@
 #include "../include/value.h"
+#include "../include/stats.h"
+#include <algorithm>
+#include <cfloat>
+#include <charconv>
 #include <sstream>
 #include <stdexcept>
 
+const char *type_name(ValueType type) {
+  static const char *names[VALUE_TYPE_COUNT] = {"int", "float", "string", "bool", "void", "array"};
+  return type < VALUE_TYPE_COUNT ? names[type] : "unknown";
+}
+
+void append_int(std::string *out, long value) {
+  char digits[24];
+  char *end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+  out->append(digits, end - digits);
+}
+
+void append_float(std::string *out, double value, int precision) {
+  // The integer part of a double takes at most DBL_MAX_10_EXP + 1 digits.
+  char digits[DBL_MAX_10_EXP + 40];
+  if (precision < 32) {
+    char *end = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed, precision).ptr;
+    out->append(digits, end - digits);
+    return;
+  }
+  size_t start = out->size();
+  out->resize(start + DBL_MAX_10_EXP + 8 + precision);
+  char *end = std::to_chars(&(*out)[start], &(*out)[0] + out->size(), value, std::chars_format::fixed, precision).ptr;
+  out->resize(end - out->data());
+}
+
+void append_text(std::string *out, const Value *value) {
+  switch (value->type) {
+  case TYPE_INT:
+    append_int(out, static_cast<const IntValue *>(value)->value);
+    break;
+  case TYPE_FLOAT:
+    append_float(out, static_cast<const FloatValue *>(value)->value);
+    break;
+  case TYPE_STRING:
+    out->append(static_cast<const StringValue *>(value)->value);
+    break;
+  case TYPE_BOOL:
+    out->append(static_cast<const BoolValue *>(value)->value ? "true" : "false");
+    break;
+  default:
+    out->append(value->to_string());
+  }
+}
+
+Value::Value(ValueType type) : type(type) {
+  stats.values_allocated[type]++;
+}
+
+Value::~Value() {
+  stats.values_freed[type]++;
+}
+
 Value *IntValue::apply_operator(Token t, Value *to) {
   //  Unary Operator
   if (!to) {
@@ -237,9 +293,11 @@ Value *StringValue::apply_operator(Token t, Value *to) {
   auto *is_string = dynamic_cast<StringValue *>(to);
 
   if (t.type == ADD || t.type == ASSIGN_ADD) {
-    std::string temp(this->value);
-    temp += to->to_string();
-    return new StringValue(temp);
+    auto *result = new StringValue("");
+    result->value.reserve(this->value.size() + (is_string ? is_string->value.size() : 0));
+    result->value += this->value;
+    result->append(to);
+    return result;
   } else if (t.type == ASSIGN) {
     if (auto *is_int = dynamic_cast<IntValue *>(to)) {
       return new IntValue(is_int->value);
@@ -248,19 +306,20 @@ Value *StringValue::apply_operator(Token t, Value *to) {
     } else if (auto *is_float = dynamic_cast<FloatValue *>(to)) {
       return new FloatValue(is_float->value);
     } else {
-      return new StringValue(dynamic_cast<StringValue *>(to)->value);
+      auto *copied = dynamic_cast<StringValue *>(to);
+      return new StringValue(copied->value, copied->symbol);
     }
 
   } else if (t.type == EQUAL) {
     if (is_string) {
-      return new BoolValue(this->value == is_string->value);
+      return new BoolValue(equals(is_string));
     } else {
       return new BoolValue(false);
     }
 
   } else {
     if (is_string) {
-      return new BoolValue(this->value != is_string->value);
+      return new BoolValue(!equals(is_string));
     } else {
       return new BoolValue(true);
     }
@@ -269,6 +328,17 @@ Value *StringValue::apply_operator(Token t, Value *to) {
 
 
 Value *BoolValue::apply_operator(Token t, Value *to) {
+  //  Unary Operator
+  if (!to) {
+    switch (t.type) {
+    case NOT:
+      return new BoolValue(!this->value);
+    case RETURN:
+      return this;
+    default: throw std::runtime_error("Invalid operands for expression: " + t.value + "'bool'");
+    }
+  }
+
   auto *is_string = dynamic_cast<StringValue *>(to);
   auto *is_float = dynamic_cast<FloatValue *>(to);
   auto *is_int = dynamic_cast<IntValue *>(to);
@@ -327,7 +397,9 @@ Value *VoidValue::apply_operator(Token t, Value *to) {
 
 
 std::string IntValue::to_string() const {
-  return std::to_string(value);
+  std::string text;
+  append_int(&text, value);
+  return text;
 }
 
 std::string IntValue::get_type() const {
@@ -336,13 +408,52 @@ std::string IntValue::get_type() const {
 
 
 std::string FloatValue::to_string() const {
-  return std::to_string(value);
+  std::string text;
+  append_float(&text, value);
+  return text;
 }
 
 std::string FloatValue::get_type() const {
   return "float";
 }
 
+void StringValue::append(const Value *to) {
+  if (to->type == TYPE_STRING) {
+    size_t needed = value.size() + static_cast<const StringValue *>(to)->value.size();
+    if (needed > value.capacity()) {
+      value.reserve(std::max(needed, value.capacity() * 2));
+    }
+  }
+  // Numbers are converted in place; std::string grows geometrically on its own.
+  append_text(&value, to);
+  symbol = NO_SYMBOL;
+  hashed = false;
+}
+
+size_t StringValue::hash() const {
+  if (!hashed) {
+    cached_hash = std::hash<std::string>()(value);
+    hashed = true;
+  }
+  return cached_hash;
+}
+
+bool StringValue::equals(const StringValue *other) const {
+  if (this == other) {
+    return true;
+  } else if (symbol != NO_SYMBOL && other->symbol != NO_SYMBOL) {
+    return symbol == other->symbol;
+  } else if (value.size() != other->value.size()) {
+    return false;
+  }
+  // Shared strings no longer change, so their hashes are worth keeping: a
+  // value compared against several literals is only hashed once.
+  if (shared && other->shared && hash() != other->hash()) {
+    return false;
+  }
+  return value == other->value;
+}
+
 std::string StringValue::to_string() const {
   return value;
 }
@@ -366,3 +477,41 @@ std::string VoidValue::to_string() const {
 std::string VoidValue::get_type() const {
   return "void";
 }
+
+ArrayValue::ArrayValue(ValueType element_type, size_t size) : Value(TYPE_ARRAY), element_type(element_type), ints(), floats() {
+  if (element_type == TYPE_INT) {
+    ints.resize(size);
+  } else {
+    floats.resize(size);
+  }
+}
+
+Value *ArrayValue::apply_operator(Token t, Value *to) {
+  // Arrays are references, so assigning or returning one never copies it.
+  if (t.type == RETURN && !to) {
+    return this;
+  } else if (t.type == ASSIGN && to) {
+    return to;
+  }
+  throw std::runtime_error("Invalid operands for expression: 'array' " + t.value +
+                           (to ? " '" + to->get_type() + "'" : ""));
+}
+
+std::string ArrayValue::to_string() const {
+  std::string text = "[";
+  for (size_t i = 0; i < size(); i++) {
+    if (i) {
+      text += ", ";
+    }
+    if (element_type == TYPE_INT) {
+      append_int(&text, ints[i]);
+    } else {
+      append_float(&text, floats[i]);
+    }
+  }
+  return text + "]";
+}
+
+std::string ArrayValue::get_type() const {
+  return "array";
+}